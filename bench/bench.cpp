@@ -0,0 +1,593 @@
+//
+// Micro benchmarks for the building blocks of play_video, play_audio and play_wall.
+//
+// bench [--benchmark_filter=substring] [--benchmark_min_time=seconds] [--benchmark_corpus=dir]
+//
+// The results are written to stdout as JSON in the layout of Google Benchmark's
+// --benchmark_format=json, so the usual compare tools can diff two runs.
+//
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+
+#include "media/event_loop.h"
+#include "media/media.h"
+#include "player/player.h"
+#include "wall/wall.h"
+
+using namespace std;
+
+class BenchState {
+public:
+    explicit BenchState(int64_t iterations) : iterations(iterations), bytes(0), items(0), skipped(false) {}
+
+    // the fixture is not available on this machine, reported as an error instead of a time
+    void skip(const string &message) {
+        skipped = true;
+        label = message;
+    }
+
+    const int64_t iterations;
+    // totals over all iterations, turned into per second rates in the report
+    int64_t bytes;
+    int64_t items;
+    bool skipped;
+    string label;
+};
+
+struct Benchmark {
+    string name;
+    function<void(BenchState &)> run;
+};
+
+struct BenchResult {
+    int64_t iterations;
+    double realTime;
+    double cpuTime;
+};
+
+static vector<Benchmark> benchmarks;
+// where the benchmarks that need real files look for them, see gen_corpus
+static string corpusDir = "corpus";
+
+static void register_benchmark(const string &name, function<void(BenchState &)> run) {
+    benchmarks.push_back(Benchmark{name, move(run)});
+}
+
+static double process_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static string json_escape(const string &s) {
+    string out;
+    for (auto c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+// Grow the iteration count like Google Benchmark until one run takes minTime.
+static BenchResult run_benchmark(const Benchmark &benchmark, double minTime, BenchState **last) {
+    int64_t iterations = 1;
+    while (true) {
+        auto state = new BenchState(iterations);
+        auto cpuStart = process_cpu_seconds();
+        auto start = chrono::steady_clock::now();
+        benchmark.run(*state);
+        double real = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double cpu = process_cpu_seconds() - cpuStart;
+        if (real >= minTime || state->skipped || iterations >= (int64_t) 1 << 40) {
+            *last = state;
+            return BenchResult{iterations, real, cpu};
+        }
+        delete state;
+        double multiplier = real > 0 ? minTime * 1.4 / real : 10;
+        multiplier = FFMIN(FFMAX(multiplier, 2.0), 10.0);
+        iterations = (int64_t) (iterations * multiplier) + 1;
+    }
+}
+
+static void print_report(const vector<pair<string, pair<BenchResult, BenchState *>>> &results) {
+    char date[64];
+    auto now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    cout << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"num_cpus\": " << thread::hardware_concurrency() << ",\n"
+         << "    \"libavcodec\": \"" << LIBAVCODEC_IDENT << "\",\n"
+#ifdef NDEBUG
+         << "    \"library_build_type\": \"release\"\n"
+#else
+         << "    \"library_build_type\": \"debug\"\n"
+#endif
+         << "  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto &result = results[i].second.first;
+        auto state = results[i].second.second;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "%s\n    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+                 "      \"iterations\": %lld,\n      \"real_time\": %.4f,\n      \"cpu_time\": %.4f,\n"
+                 "      \"time_unit\": \"ns\"",
+                 i ? "," : "", json_escape(results[i].first).c_str(), (long long) result.iterations,
+                 result.realTime * 1e9 / result.iterations, result.cpuTime * 1e9 / result.iterations);
+        cout << line;
+        if (state->bytes)
+            cout << ",\n      \"bytes_per_second\": " << (double) state->bytes / result.realTime;
+        if (state->items)
+            cout << ",\n      \"items_per_second\": " << (double) state->items / result.realTime;
+        if (state->skipped)
+            cout << ",\n      \"error_occurred\": true,\n      \"error_message\": \"" << json_escape(state->label) << "\"";
+        else if (!state->label.empty())
+            cout << ",\n      \"label\": \"" << json_escape(state->label) << "\"";
+        cout << "\n    }";
+    }
+    cout << "\n  ]\n}" << endl;
+}
+
+// PacketQueue: play_video's demuxer allocates one packet per av_read_frame() and moves it in.
+
+static void bench_packet_alloc(BenchState &state) {
+    for (int64_t i = 0; i < state.iterations; ++i) {
+        media::Packet packet;
+    }
+    state.items = state.iterations;
+}
+
+static void bench_packet_queue_uncontended(BenchState &state) {
+    PacketQueue queue(PACKET_QUEUE_MAX_SIZE);
+    media::Packet out;
+    for (int64_t i = 0; i < state.iterations; ++i) {
+        queue.push(media::Packet());
+        queue.pop(out);
+    }
+    state.items = state.iterations;
+}
+
+static void bench_packet_queue_contended(BenchState &state) {
+    PacketQueue queue(PACKET_QUEUE_MAX_SIZE);
+    auto iterations = state.iterations;
+    thread consumer([&queue, iterations] {
+        media::Packet out;
+        for (int64_t i = 0; i < iterations; ++i)
+            queue.pop(out);
+    });
+    for (int64_t i = 0; i < iterations; ++i)
+        queue.push(media::Packet());
+    consumer.join();
+    state.items = state.iterations;
+}
+
+// EventLoop: tasks posted from another thread, and timers through the min-heap.
+
+static void bench_event_loop_post(BenchState &state) {
+    media::EventLoop loop;
+    int64_t ran = 0;
+    thread runner([&loop] { loop.run(); });
+    for (int64_t i = 0; i < state.iterations; ++i)
+        loop.post([&ran] { ran++; });
+    loop.stop();
+    runner.join();
+    state.items = ran;
+    state.label = "wakeups=" + to_string(loop.wakeups());
+}
+
+static void bench_event_loop_timer(BenchState &state) {
+    media::EventLoop loop;
+    int64_t ran = 0;
+    thread runner([&loop] { loop.run(); });
+    for (int64_t i = 0; i < state.iterations; ++i)
+        loop.schedule(0, [&ran] { ran++; });
+    // the deadlines only grow, so this one runs last
+    loop.schedule(0, [&loop] { loop.stop(); });
+    runner.join();
+    state.items = ran;
+    state.label = "wakeups=" + to_string(loop.wakeups());
+}
+
+// The frame ring between decodeVideo() and the refresh timer, shown through a software renderer.
+
+struct RingFixture {
+    RingFixture(int width, int height) : width(width), height(height) {
+        surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        // showFrame() creates the texture on the first frame
+        videoInfo.renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+        // padded planes like a decoder's, showFrame() uploads them with their own pitches
+        source->width = width;
+        source->height = height;
+        source->format = AV_PIX_FMT_YUV420P;
+        if (av_frame_get_buffer(source.get(), 0) >= 0) {
+            for (int plane = 0; plane < 3; ++plane)
+                memset(source->buf[plane]->data, 0x80, source->buf[plane]->size);
+        }
+    }
+
+    ~RingFixture() {
+        if (videoInfo.texture)
+            SDL_DestroyTexture(videoInfo.texture);
+        if (videoInfo.renderer)
+            SDL_DestroyRenderer(videoInfo.renderer);
+        if (surface)
+            SDL_FreeSurface(surface);
+    }
+
+    bool ok() const { return videoInfo.renderer && source->buf[0]; }
+
+    int width, height;
+    SDL_Surface *surface;
+    VideoInfo videoInfo;
+    media::Frame source;
+};
+
+static void bench_frame_ring(BenchState &state, int width, int height) {
+    RingFixture fixture(width, height);
+    if (!fixture.ok()) {
+        state.skip("no software renderer");
+        return;
+    }
+    auto videoInfo = &fixture.videoInfo;
+    auto iterations = state.iterations;
+    thread producer([&fixture, videoInfo, iterations] {
+        for (int64_t i = 0; i < iterations; ++i)
+            queue_frame(videoInfo, av_frame_clone(fixture.source.get()), i * 0.04);
+    });
+    for (int64_t i = 0; i < iterations; ++i) {
+        SDL_LockMutex(videoInfo->ringQMutex);
+        while (videoInfo->ringQSize == 0)
+            SDL_CondWait(videoInfo->ringQCond, videoInfo->ringQMutex);
+        SDL_UnlockMutex(videoInfo->ringQMutex);
+        showFrame(videoInfo);
+        pop_frame(videoInfo);
+    }
+    producer.join();
+    state.items = state.iterations;
+    state.bytes = state.iterations * av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+}
+
+// find_dirty_tiles() between two 1080p frames: the same, one changed pixel, every pixel changed.
+
+static void bench_dirty_tiles(BenchState &state, int changed) {
+    media::Frame previous, frame;
+    for (auto f : {previous.get(), frame.get()}) {
+        f->format = AV_PIX_FMT_YUV420P;
+        f->width = 1920;
+        f->height = 1080;
+        if (av_frame_get_buffer(f, 0) < 0) {
+            state.skip("out of memory");
+            return;
+        }
+        for (int plane = 0; plane < 3; ++plane)
+            memset(f->buf[plane]->data, 0x80, f->buf[plane]->size);
+    }
+    if (changed == 1)
+        frame->data[0][540 * frame->linesize[0] + 960] = 0;
+    else if (changed > 1)
+        memset(frame->buf[0]->data, 0, frame->buf[0]->size);
+    vector<SDL_Rect> rects;
+    for (int64_t i = 0; i < state.iterations; ++i)
+        find_dirty_tiles(previous.get(), frame.get(), rects);
+    state.items = state.iterations;
+    state.bytes = state.iterations * av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 1920, 1080, 1);
+    state.label = "rects=" + to_string(rects.size());
+}
+
+// Open a corpus file and decode its first video frame, with the default probing and with a fast start.
+
+// the first file in corpusDir with this extension, empty when there is none
+static string find_corpus_file(const string &extension) {
+    string found;
+    auto dir = opendir(corpusDir.c_str());
+    if (dir == nullptr)
+        return found;
+    while (auto entry = readdir(dir)) {
+        string name = entry->d_name;
+        auto suffix = "." + extension;
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0 &&
+            (found.empty() || corpusDir + "/" + name < found))
+            found = corpusDir + "/" + name;
+    }
+    closedir(dir);
+    return found;
+}
+
+static void bench_first_frame(BenchState &state, const string &extension, bool fastStart) {
+    auto url = find_corpus_file(extension);
+    if (url.empty()) {
+        state.skip("no ." + extension + " file in " + corpusDir);
+        return;
+    }
+    int64_t probeBytes = 0;
+    for (int64_t i = 0; i < state.iterations; ++i) {
+        media::InputFormat input;
+        AVDictionary *options = nullptr;
+        if (fastStart)
+            media::fastStartOptions(&options);
+        auto ret = input.open(url, &options);
+        av_dict_free(&options);
+        if (ret < 0) {
+            state.skip(media::errorString(ret));
+            return;
+        }
+        probeBytes = input->pb ? input->pb->bytes_read : 0;
+        // like play_video: the first video stream, decoding starts at its first keyframe
+        media::StreamDecoder decoder;
+        media::Frame frame;
+        auto index = -1;
+        media::Packet packet;
+        while ((ret = input.read(packet)) >= 0) {
+            auto stream = input.stream(packet->stream_index);
+            if (index == -1 && stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+                (packet->flags & AV_PKT_FLAG_KEY)) {
+                if (decoder.open(stream) < 0) {
+                    state.skip("no decoder");
+                    return;
+                }
+                index = packet->stream_index;
+            }
+            if (index == -1 || packet->stream_index != index) {
+                packet.unref();
+                continue;
+            }
+            decoder.send(&packet);
+            packet.unref();
+            if (decoder.receive(frame) >= 0)
+                break;
+        }
+        if (ret < 0 && ret != AVERROR_EOF) {
+            state.skip(media::errorString(ret));
+            return;
+        }
+    }
+    state.items = state.iterations;
+    state.label = "probe_bytes=" + to_string(probeBytes);
+}
+
+// get_audio_clock() and audio_callback() against a 48kHz stereo float stream, the SDL format play_video asks for.
+
+static bool open_audio_fixture(VideoInfo *videoInfo) {
+    auto parameters = avcodec_parameters_alloc();
+    if (parameters == nullptr)
+        return false;
+    parameters->codec_type = AVMEDIA_TYPE_AUDIO;
+    parameters->codec_id = AV_CODEC_ID_PCM_F32LE;
+    parameters->sample_rate = 48000;
+    parameters->channels = 2;
+    parameters->channel_layout = AV_CH_LAYOUT_STEREO;
+    parameters->format = AV_SAMPLE_FMT_FLT;
+    auto ret = videoInfo->audioDecoder.open(parameters, AVRational{1, 48000});
+    avcodec_parameters_free(&parameters);
+    videoInfo->audioOpened = ret >= 0;
+    return ret >= 0;
+}
+
+static void bench_get_audio_clock(BenchState &state) {
+    VideoInfo videoInfo;
+    if (!open_audio_fixture(&videoInfo)) {
+        state.skip("no pcm_f32le decoder");
+        return;
+    }
+    videoInfo.audioBufferSize = sizeof(videoInfo.audioBuffer);
+    volatile double sink = 0;
+    for (int64_t i = 0; i < state.iterations; ++i) {
+        videoInfo.audioClock = i * 0.02;
+        videoInfo.audioBufferIndex = (unsigned) (i * 8) % videoInfo.audioBufferSize;
+        sink = sink + get_audio_clock(&videoInfo);
+    }
+    state.items = state.iterations;
+}
+
+static void bench_audio_callback(BenchState &state, int samples) {
+    VideoInfo videoInfo;
+    if (!open_audio_fixture(&videoInfo)) {
+        state.skip("no pcm_f32le decoder");
+        return;
+    }
+    // the buffer never runs dry, so only the copy into the SDL stream is measured
+    int len = samples * 2 * 4;
+    vector<uint8_t> stream(len);
+    videoInfo.audioBufferSize = sizeof(videoInfo.audioBuffer) / len * len;
+    videoInfo.audioBufferIndex = 0;
+    for (int64_t i = 0; i < state.iterations; ++i) {
+        if (videoInfo.audioBufferIndex >= videoInfo.audioBufferSize)
+            videoInfo.audioBufferIndex = 0;
+        audio_callback(&videoInfo, stream.data(), len);
+    }
+    state.bytes = state.iterations * len;
+}
+
+// sws_scale from the usual decoder outputs to the YUV420P play_video uploads, with play_video's flags.
+
+static void bench_sws_scale(BenchState &state, AVPixelFormat format, int width, int height) {
+    media::Frame src, dst;
+    src->format = format;
+    src->width = width;
+    src->height = height;
+    dst->format = AV_PIX_FMT_YUV420P;
+    dst->width = width;
+    dst->height = height;
+    auto context = sws_getContext(width, height, format, width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC,
+                                  nullptr, nullptr, nullptr);
+    if (context == nullptr || av_frame_get_buffer(src.get(), 0) < 0 || av_frame_get_buffer(dst.get(), 0) < 0) {
+        state.skip("unsupported");
+        sws_freeContext(context);
+        return;
+    }
+    for (int plane = 0; plane < 4 && src->buf[plane]; ++plane)
+        memset(src->buf[plane]->data, 0x80, src->buf[plane]->size);
+    for (int64_t i = 0; i < state.iterations; ++i)
+        sws_scale(context, src->data, src->linesize, 0, height, dst->data, dst->linesize);
+    sws_freeContext(context);
+    state.items = state.iterations;
+    state.bytes = state.iterations * av_image_get_buffer_size(format, width, height, 1);
+}
+
+// swr_convert from the usual decoder sample formats to the packed float play_audio hands to SDL.
+
+static void bench_swr_convert(BenchState &state, AVSampleFormat format, int samples) {
+    auto context = swr_alloc_set_opts(nullptr, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, 48000,
+                                      AV_CH_LAYOUT_STEREO, format, 48000, 0, nullptr);
+    if (context == nullptr || swr_init(context) < 0) {
+        state.skip("unsupported");
+        swr_free(&context);
+        return;
+    }
+    uint8_t **src = nullptr;
+    int srcLinesize;
+    av_samples_alloc_array_and_samples(&src, &srcLinesize, 2, samples, format, 0);
+    vector<uint8_t> out(samples * 2 * 4);
+    auto outData = out.data();
+    for (int64_t i = 0; i < state.iterations; ++i)
+        swr_convert(context, &outData, samples, (const uint8_t **) src, samples);
+    if (src)
+        av_freep(&src[0]);
+    av_freep(&src);
+    swr_free(&context);
+    state.items = state.iterations * samples;
+    state.bytes = state.iterations * av_samples_get_buffer_size(nullptr, 2, samples, format, 1);
+}
+
+// play_wall's compositor: tiles 1080p YUV420P frames into a 1080p mosaic, on one thread or one per core.
+
+static void bench_mosaic_compose(BenchState &state, int tiles, int threads) {
+    vector<media::Frame> sources(tiles);
+    vector<const AVFrame *> frames;
+    for (auto &frame : sources) {
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 1920;
+        frame->height = 1080;
+        if (av_frame_get_buffer(frame.get(), 0) < 0) {
+            state.skip("out of memory");
+            return;
+        }
+        for (int plane = 0; plane < 3; ++plane)
+            memset(frame->buf[plane]->data, 0x80, frame->buf[plane]->size);
+        frames.push_back(frame.get());
+    }
+    media::Frame mosaic;
+    mosaic->format = AV_PIX_FMT_YUV420P;
+    mosaic->width = 1920;
+    mosaic->height = 1080;
+    if (av_frame_get_buffer(mosaic.get(), 0) < 0) {
+        state.skip("out of memory");
+        return;
+    }
+    wall::Compositor compositor(threads);
+    for (int64_t i = 0; i < state.iterations; ++i)
+        compositor.compose(frames, mosaic.get());
+    state.items = state.iterations * tiles;
+    state.bytes = state.iterations * av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 1920, 1080, 1);
+}
+
+static void register_all() {
+    register_benchmark("BM_PacketAlloc", bench_packet_alloc);
+    register_benchmark("BM_PacketQueue_PutGet/uncontended", bench_packet_queue_uncontended);
+    register_benchmark("BM_PacketQueue_PutGet/contended", bench_packet_queue_contended);
+    register_benchmark("BM_EventLoop_Post", bench_event_loop_post);
+    register_benchmark("BM_EventLoop_Timer", bench_event_loop_timer);
+    register_benchmark("BM_FrameRing_QueueShow/1280x720", [](BenchState &state) {
+        bench_frame_ring(state, 1280, 720);
+    });
+    register_benchmark("BM_FrameRing_QueueShow/1920x1080", [](BenchState &state) {
+        bench_frame_ring(state, 1920, 1080);
+    });
+    register_benchmark("BM_DirtyTiles/unchanged", [](BenchState &state) { bench_dirty_tiles(state, 0); });
+    register_benchmark("BM_DirtyTiles/one_pixel", [](BenchState &state) { bench_dirty_tiles(state, 1); });
+    register_benchmark("BM_DirtyTiles/all", [](BenchState &state) { bench_dirty_tiles(state, 2); });
+    register_benchmark("BM_GetAudioClock", bench_get_audio_clock);
+    // SDL asks for 4096 samples in play_video, smaller devices pull 1024
+    for (int samples : {1024, 4096}) {
+        register_benchmark("BM_AudioCallback/" + to_string(samples), [samples](BenchState &state) {
+            bench_audio_callback(state, samples);
+        });
+    }
+    for (auto format : {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV422P,
+                        AV_PIX_FMT_YUV420P10LE}) {
+        for (auto size : {make_pair(1280, 720), make_pair(1920, 1080)}) {
+            string name = string("BM_SwsScale/") + av_get_pix_fmt_name(format) + "/" +
+                          to_string(size.first) + "x" + to_string(size.second);
+            register_benchmark(name, [format, size](BenchState &state) {
+                bench_sws_scale(state, format, size.first, size.second);
+            });
+        }
+    }
+    for (int tiles : {4, 16, 64}) {
+        register_benchmark("BM_MosaicCompose/" + to_string(tiles) + "/serial", [tiles](BenchState &state) {
+            bench_mosaic_compose(state, tiles, 1);
+        });
+        register_benchmark("BM_MosaicCompose/" + to_string(tiles) + "/parallel", [tiles](BenchState &state) {
+            bench_mosaic_compose(state, tiles, 0);
+        });
+    }
+    for (string extension : {"mp4", "mkv", "ts", "h264"}) {
+        register_benchmark("BM_FirstFrame/" + extension + "/default", [extension](BenchState &state) {
+            bench_first_frame(state, extension, false);
+        });
+        register_benchmark("BM_FirstFrame/" + extension + "/fast_start", [extension](BenchState &state) {
+            bench_first_frame(state, extension, true);
+        });
+    }
+    for (auto format : {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32P}) {
+        string name = string("BM_SwrConvert/") + av_get_sample_fmt_name(format) + "/1024";
+        register_benchmark(name, [format](BenchState &state) {
+            bench_swr_convert(state, format, 1024);
+        });
+    }
+}
+
+int main(int argc, char **argv) {
+    string filter;
+    double minTime = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.compare(0, 19, "--benchmark_filter=") == 0) {
+            filter = arg.substr(19);
+        } else if (arg.compare(0, 21, "--benchmark_min_time=") == 0) {
+            minTime = atof(arg.c_str() + 21);
+        } else if (arg.compare(0, 19, "--benchmark_corpus=") == 0) {
+            corpusDir = arg.substr(19);
+        } else {
+            cerr << "usage: " << argv[0] << " [--benchmark_filter=substring] [--benchmark_min_time=seconds]"
+                 << " [--benchmark_corpus=dir]" << endl;
+            return 1;
+        }
+    }
+    av_log_set_level(AV_LOG_ERROR);
+    register_all();
+    vector<pair<string, pair<BenchResult, BenchState *>>> results;
+    for (auto &benchmark : benchmarks) {
+        if (!filter.empty() && benchmark.name.find(filter) == string::npos)
+            continue;
+        BenchState *state;
+        auto result = run_benchmark(benchmark, minTime, &state);
+        if (state->skipped)
+            cerr << benchmark.name << ": skipped, " << state->label << endl;
+        else
+            cerr << benchmark.name << ": " << result.realTime * 1e9 / result.iterations << " ns" << endl;
+        results.push_back(make_pair(benchmark.name, make_pair(result, state)));
+    }
+    print_report(results);
+    for (auto &result : results)
+        delete result.second.second;
+    return 0;
+}
@@ -24,15 +24,88 @@
  * audio decoding with libavcodec API example
  *
  * @example decode_audio.c
+ * A reader thread prefetches the input in READ_BLOCK_SIZE blocks into a ring
+ * of READ_BLOCKS blocks. The parser consumes every block in place; frames
+ * that span two blocks are buffered by the parser itself, so nothing is ever
+ * moved. Decoded planar samples are interleaved into one buffer in a single
+ * pass and written with one fwrite per frame.
  */
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
+#include <libavutil/time.h>
 #include <libavcodec/avcodec.h>
-#define AUDIO_INBUF_SIZE 20480
-#define AUDIO_REFILL_THRESH 4096
+#define READ_BLOCK_SIZE (1 << 20)
+#define READ_BLOCKS 4
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+typedef struct ReadBlock {
+    uint8_t data[READ_BLOCK_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
+    size_t size;
+} ReadBlock;
+/* blocks [read_head, read_head + read_count) are filled and wait for the parser */
+typedef struct ReadAhead {
+    FILE *f;
+    ReadBlock *blocks;
+    int read_head, read_count;
+    int eof;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* microseconds the parser waited for the reader */
+    int64_t wait_time;
+} ReadAhead;
+static uint8_t *out_buf = NULL;
+static unsigned int out_buf_size = 0;
+static void *read_thread(void *arg)
+{
+    ReadAhead *ra = arg;
+    int index = 0;
+    while (1) {
+        ReadBlock *block;
+        pthread_mutex_lock(&ra->mutex);
+        while (ra->read_count == READ_BLOCKS)
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        pthread_mutex_unlock(&ra->mutex);
+        block = &ra->blocks[index];
+        block->size = fread(block->data, 1, READ_BLOCK_SIZE, ra->f);
+        memset(block->data + block->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        pthread_mutex_lock(&ra->mutex);
+        if (block->size)
+            ra->read_count++;
+        else
+            ra->eof = 1;
+        pthread_cond_signal(&ra->cond);
+        pthread_mutex_unlock(&ra->mutex);
+        if (!block->size)
+            break;
+        index = (index + 1) % READ_BLOCKS;
+    }
+    return NULL;
+}
+/* Next filled block, NULL at end of file. */
+static ReadBlock *read_block_get(ReadAhead *ra)
+{
+    ReadBlock *block = NULL;
+    int64_t start = av_gettime_relative();
+    pthread_mutex_lock(&ra->mutex);
+    while (!ra->read_count && !ra->eof)
+        pthread_cond_wait(&ra->cond, &ra->mutex);
+    if (ra->read_count)
+        block = &ra->blocks[ra->read_head];
+    pthread_mutex_unlock(&ra->mutex);
+    ra->wait_time += av_gettime_relative() - start;
+    return block;
+}
+static void read_block_release(ReadAhead *ra)
+{
+    pthread_mutex_lock(&ra->mutex);
+    ra->read_head = (ra->read_head + 1) % READ_BLOCKS;
+    ra->read_count--;
+    pthread_cond_signal(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+}
 static int get_format_from_sample_fmt(const char **fmt,
                                       enum AVSampleFormat sample_fmt)
 {
@@ -64,6 +137,7 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
 {
     int i, ch;
     int ret, data_size;
+    uint8_t *out;
     /* send the packet with the compressed data to the decoder */
     ret = avcodec_send_packet(dec_ctx, pkt);
     if (ret < 0) {
@@ -85,9 +159,24 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
             fprintf(stderr, "Failed to calculate data size\n");
             exit(1);
         }
-        for (i = 0; i < frame->nb_samples; i++)
-            for (ch = 0; ch < dec_ctx->channels; ch++)
-                fwrite(frame->data[ch] + data_size*i, 1, data_size, outfile);
+        /* packed formats are already interleaved */
+        if (!av_sample_fmt_is_planar(frame->format)) {
+            fwrite(frame->data[0], 1, (size_t)frame->nb_samples * dec_ctx->channels * data_size, outfile);
+            continue;
+        }
+        av_fast_malloc(&out_buf, &out_buf_size, (size_t)frame->nb_samples * dec_ctx->channels * data_size);
+        if (!out_buf) {
+            fprintf(stderr, "Could not allocate the output buffer\n");
+            exit(1);
+        }
+        out = out_buf;
+        for (i = 0; i < frame->nb_samples; i++) {
+            for (ch = 0; ch < dec_ctx->channels; ch++) {
+                memcpy(out, frame->extended_data[ch] + data_size*i, data_size);
+                out += data_size;
+            }
+        }
+        fwrite(out_buf, 1, out - out_buf, outfile);
     }
 }
 int main(int argc, char **argv)
@@ -96,11 +185,15 @@ int main(int argc, char **argv)
     const AVCodec *codec;
     AVCodecContext *c= NULL;
     AVCodecParserContext *parser = NULL;
-    int len, ret;
+    int ret;
     FILE *f, *outfile;
-    uint8_t inbuf[AUDIO_INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
+    ReadAhead ra = { 0 };
+    ReadBlock *block;
+    pthread_t reader;
     uint8_t *data;
     size_t   data_size;
+    int64_t start, bytes_in = 0;
+    double elapsed;
     AVPacket *pkt;
     AVFrame *decoded_frame = NULL;
     enum AVSampleFormat sfmt;
@@ -144,49 +237,62 @@ int main(int argc, char **argv)
         av_free(c);
         exit(1);
     }
+    /* the reader does its own large reads, the output gets a large buffer */
+    setvbuf(f, NULL, _IONBF, 0);
+    setvbuf(outfile, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    ra.f = f;
+    ra.blocks = av_malloc_array(READ_BLOCKS, sizeof(*ra.blocks));
+    if (!ra.blocks) {
+        fprintf(stderr, "Could not allocate the read ahead buffer\n");
+        exit(1);
+    }
+    pthread_mutex_init(&ra.mutex, NULL);
+    pthread_cond_init(&ra.cond, NULL);
+    if (pthread_create(&reader, NULL, read_thread, &ra)) {
+        fprintf(stderr, "Could not start the reader thread\n");
+        exit(1);
+    }
+    if (!(decoded_frame = av_frame_alloc())) {
+        fprintf(stderr, "Could not allocate audio frame\n");
+        exit(1);
+    }
     /* decode until eof */
-    data      = inbuf;
-    data_size = fread(inbuf, 1, AUDIO_INBUF_SIZE, f);
-    while (data_size > 0) {
-        if (!decoded_frame) {
-            if (!(decoded_frame = av_frame_alloc())) {
-                fprintf(stderr, "Could not allocate audio frame\n");
+    start = av_gettime_relative();
+    while ((block = read_block_get(&ra))) {
+        data      = block->data;
+        data_size = block->size;
+        bytes_in += data_size;
+        while (data_size > 0) {
+            ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+                                   data, data_size,
+                                   AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            if (ret < 0) {
+                fprintf(stderr, "Error while parsing\n");
                 exit(1);
             }
+            data      += ret;
+            data_size -= ret;
+            if (pkt->size)
+                decode(c, pkt, decoded_frame, outfile);
         }
-        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
-                               data, data_size,
-                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
-        if (ret < 0) {
-            fprintf(stderr, "Error while parsing\n");
-            exit(1);
-        }
-        data      += ret;
-        data_size -= ret;
-        if (pkt->size)
-            decode(c, pkt, decoded_frame, outfile);
-        if (data_size < AUDIO_REFILL_THRESH) {
-            memmove(inbuf, data, data_size);
-            data = inbuf;
-            len = fread(data + data_size, 1,
-                        AUDIO_INBUF_SIZE - data_size, f);
-            if (len > 0)
-                data_size += len;
-        }
+        read_block_release(&ra);
     }
+    pthread_join(reader, NULL);
+    /* the parser may still hold the last frame */
+    ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size, NULL, 0,
+                           AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+    if (ret >= 0 && pkt->size)
+        decode(c, pkt, decoded_frame, outfile);
     /* flush the decoder */
     pkt->data = NULL;
     pkt->size = 0;
     decode(c, pkt, decoded_frame, outfile);
+    fflush(outfile);
+    elapsed = (av_gettime_relative() - start) / 1e6;
+    fprintf(stderr, "%"PRId64" bytes in %.3fs (%.1f MB/s), %.3fs waiting for input\n",
+            bytes_in, elapsed, elapsed > 0 ? bytes_in / elapsed / 1e6 : 0, ra.wait_time / 1e6);
     /* print output pcm infomations, because there have no metadata of pcm */
-    sfmt = c->sample_fmt;
-    if (av_sample_fmt_is_planar(sfmt)) {
-        const char *packed = av_get_sample_fmt_name(sfmt);
-        printf("Warning: the sample format the decoder produced is planar "
-               "(%s). This example will output the first channel only.\n",
-               packed ? packed : "?");
-        sfmt = av_get_packed_sample_fmt(sfmt);
-    }
+    sfmt = av_get_packed_sample_fmt(c->sample_fmt);
     n_channels = c->channels;
     if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
         goto end;
@@ -201,5 +307,9 @@ int main(int argc, char **argv)
     av_parser_close(parser);
     av_frame_free(&decoded_frame);
     av_packet_free(&pkt);
+    av_freep(&ra.blocks);
+    av_freep(&out_buf);
+    pthread_mutex_destroy(&ra.mutex);
+    pthread_cond_destroy(&ra.cond);
     return 0;
 }
@@ -5,10 +5,15 @@ extern "C" {
 #include<string>
 #include <iostream>
 #include <fstream>
+#include "stream_output.h"
+#include "media/media.h"
 
 #define INBUF_SIZE 4096
 using namespace std;
 
+/* set when the output is y4m:url or nut:url instead of a PGM file prefix */
+static StreamOutput *stream_out = nullptr;
+
 static void pgm_save(unsigned char *buf, int wrap, int xsize, int ysize, string filename) {
     ofstream o(filename);
     char buff[1024];
@@ -34,6 +39,13 @@ static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,string
             cerr << "Error during decoding" << endl;
             exit(1);
         }
+        if (stream_out) {
+            if (stream_output_write_frame(stream_out, frame, dec_ctx->framerate) < 0) {
+                cerr << "Error writing the stream output" << endl;
+                exit(1);
+            }
+            continue;
+        }
         cout << "saving frame" << dec_ctx->frame_number << endl;
         char buf[1024];
         snprintf(buf, sizeof(buf), "%s-%d", outfile.c_str(), dec_ctx->frame_number);
@@ -47,10 +59,19 @@ int main(int argc, char **argv) {
     string input, output;
     if (argc <= 2) {
         fprintf(stderr, "Usage: %s <input file> <output file>\n"
-                        "And check your input file is encoded by mpeg1video please.\n", argv[0]);
+                        "And check your input file is encoded by mpeg1video please.\n"
+                        "An output file of y4m:url or nut:url streams all frames to url, - is stdout.\n", argv[0]);
     }
     input = string(argv[1]);
     output = string(argv[2]);
+    StreamOutput so;
+    enum StreamFormat stream_format;
+    const char *stream_url;
+    if (stream_output_parse(argv[2], &stream_format, &stream_url)) {
+        if (stream_output_open(&so, stream_url, stream_format) < 0)
+            exit(1);
+        stream_out = &so;
+    }
     uint8_t inbuf[INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
     memset(inbuf + INBUF_SIZE, 0, AV_INPUT_BUFFER_PADDING_SIZE);
     AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
@@ -63,22 +84,19 @@ int main(int argc, char **argv) {
         cerr << "parser not found" << endl;
         exit(1);
     }
-    AVCodecContext *c = avcodec_alloc_context3(codec);
-    if (c == nullptr) {
-        cerr << "Could not allocate video codec context" << endl;
-    }
-    if (avcodec_open2(c, codec, NULL) < 0) {
+    media::CodecContext c;
+    if (c.openDecoder(codec) < 0) {
         cerr << "Could not open codec" << endl;
         exit(1);
     }
     ifstream f(input, ios_base::in);
-    AVPacket *pkt = av_packet_alloc();
-    if (pkt == nullptr) {
+    media::Packet pkt;
+    if (!pkt) {
         cerr << "Could not allocate video packet" << endl;
         exit(1);
     }
-    AVFrame *frame = av_frame_alloc();
-    if (frame == nullptr) {
+    media::Frame frame;
+    if (!frame) {
         cerr << "Could not allocate video frame" << endl;
         exit(1);
     }
@@ -87,7 +105,7 @@ int main(int argc, char **argv) {
         uint8_t *data = inbuf;
         auto data_size = f.gcount();
         while (data_size > 0) {
-            auto ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+            auto ret = av_parser_parse2(parser, c.get(), &pkt->data, &pkt->size,
                                         data, data_size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
             if (ret < 0) {
                 cerr << "Error while parsing" << endl;
@@ -96,15 +114,14 @@ int main(int argc, char **argv) {
             data += ret;
             data_size -= ret;
             if (pkt->size) {
-                decode(c, av_frame_alloc(), pkt, output);
+                decode(c.get(), frame.get(), pkt.get(), output);
             }
         }
     }
-    decode(c, frame, nullptr, output);
+    decode(c.get(), frame.get(), nullptr, output);
+    if (stream_out && stream_output_close(stream_out) < 0)
+        cerr << "Error closing the stream output" << endl;
     f.close();
     av_parser_close(parser);
-    avcodec_free_context(&c);
-    av_frame_free(&frame);
-    av_packet_free(&pkg);
     return 0;
 }
\ No newline at end of file
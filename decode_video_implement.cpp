@@ -8,11 +8,16 @@ extern "C" {
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include "stream_output.h"
+#include "media/media.h"
 
 #define INBUF_SIZE 4096
 #define PREFIX_SIZE 256
 using namespace std;
 
+/* set when the output is y4m:url or nut:url instead of a PGM file prefix */
+static StreamOutput *stream_out = nullptr;
+
 
 static void pgm_save(string out_file, unsigned char *buff, int wrap, int xsize, int ysize) {
     ofstream out(out_file, ios_base::out);
@@ -40,6 +45,13 @@ static void decode(AVCodecContext *ctx, AVPacket *packet, AVFrame *frame, string
             cerr << "Failed in receive frame" << endl;
             exit(1);
         }
+        if (stream_out) {
+            if (stream_output_write_frame(stream_out, frame, ctx->framerate) < 0) {
+                cerr << "Failed in write stream output" << endl;
+                exit(1);
+            }
+            continue;
+        }
         stringstream ss;
         ss << out_file_prefix << "-" << ctx->frame_number;
         pgm_save(ss.str(), frame->data[0], frame->linesize[0], frame->width, frame->height);
@@ -50,22 +62,29 @@ static void decode(AVCodecContext *ctx, AVPacket *packet, AVFrame *frame, string
 int main(int argc, char **argv) {
     if (argc <= 3) {
         cerr << "argc too less " << endl;
+        cerr << "usage: " << argv[0] << " input codec_name out_file_prefix|y4m:url|nut:url" << endl;
         exit(1);
     }
     ifstream src_file(argv[1]);
     auto codec_name = argv[2];
     string out_file_prefix(argv[3]);
+    StreamOutput so;
+    enum StreamFormat stream_format;
+    const char *stream_url;
+    if (stream_output_parse(argv[3], &stream_format, &stream_url)) {
+        if (stream_output_open(&so, stream_url, stream_format) < 0)
+            exit(1);
+        stream_out = &so;
+    }
     auto codec = avcodec_find_decoder_by_name(codec_name);
     if (codec == nullptr) {
         cerr << "Could not found codec" << codec_name << endl;
         exit(1);
     }
-    auto ctx = avcodec_alloc_context3(codec);
-    if (ctx == nullptr) {
-        cerr << "Could not allocate context" << endl;
-        exit(1);
-    }
-    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+    media::CodecContext ctx;
+    auto ret = ctx.openDecoder(codec);
+    if (ret < 0) {
+        cerr << "Could not open codec " << codec_name << " error:" << media::errorString(ret) << endl;
         exit(1);
     }
     auto parser = av_parser_init(codec->id);
@@ -73,13 +92,13 @@ int main(int argc, char **argv) {
         cerr << "Failed in init parser" << endl;
         exit(1);
     }
-    auto frame = av_frame_alloc();
-    if (frame == nullptr) {
+    media::Frame frame;
+    if (!frame) {
         cerr << "Could not allocate frame" << endl;
         exit(1);
     }
-    auto packet = av_packet_alloc();
-    if (packet == nullptr) {
+    media::Packet packet;
+    if (!packet) {
         cerr << "Could not allocate packet" << endl;
         exit(1);
     }
@@ -90,20 +109,19 @@ int main(int argc, char **argv) {
         uint8_t *data = inbuf;
         auto read_length = src_file.gcount();
         while (read_length > 0) {
-            auto parse_len = av_parser_parse2(parser, ctx, &packet->data, &packet->size, data, read_length,
+            auto parse_len = av_parser_parse2(parser, ctx.get(), &packet->data, &packet->size, data, read_length,
                                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
             data += parse_len;
             read_length -= parse_len;
             if (packet->size > 0) {
-                decode(ctx, packet, frame,out_file_prefix);
+                decode(ctx.get(), packet.get(), frame.get(), out_file_prefix);
             }
         }
     }
-    decode(ctx, nullptr, frame,out_file_prefix);
+    decode(ctx.get(), nullptr, frame.get(), out_file_prefix);
+    if (stream_out && stream_output_close(stream_out) < 0)
+        cerr << "Failed in close stream output" << endl;
     src_file.close();
-    avcodec_close(ctx);
     av_parser_close(parser);
-    av_frame_free(&frame);
-    av_packet_free(&packet);
     return 0;
 }
\ No newline at end of file
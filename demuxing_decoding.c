@@ -26,11 +26,35 @@
  * Show how to use the libavformat and libavcodec API to demux and
  * decode audio and video data.
  * @example demuxing_decoding.c
+ *
+ * Video frames are written straight from the decoder planes with writev(),
+ * one iovec per plane when it has no padding and one per row otherwise.
+ * When the resolution or pixel format changes a new rawvideo segment,
+ * video_output_file.N, is started. Planar audio is interleaved into packed
+ * samples before it is written.
+ *
+ * A video_output_file of y4m:url or nut:url streams the video instead, see
+ * stream_output.h; "-" as url is stdout.
  */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <libavutil/avstring.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/samplefmt.h>
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
+#include "stream_output.h"
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 static AVFormatContext *fmt_ctx = NULL;
 static AVCodecContext *video_dec_ctx = NULL, *audio_dec_ctx;
 static int width, height;
@@ -39,58 +63,189 @@ static AVStream *video_stream = NULL, *audio_stream = NULL;
 static const char *src_filename = NULL;
 static const char *video_dst_filename = NULL;
 static const char *audio_dst_filename = NULL;
-static FILE *video_dst_file = NULL;
-static FILE *audio_dst_file = NULL;
-static uint8_t *video_dst_data[4] = {NULL};
-static int      video_dst_linesize[4];
-static int video_dst_bufsize;
+static int video_dst_fd = -1;
+static int audio_dst_fd = -1;
+/* rawvideo segment being written, 0 is video_dst_filename itself */
+static int video_segment = 0;
+static char video_segment_filename[1024];
+static struct iovec *video_iov = NULL;
+static int video_iov_size = 0;
+static uint8_t *audio_buf = NULL;
+static unsigned int audio_buf_size = 0;
+static StreamOutput stream_out;
+static int use_stream_out = 0;
 static int video_stream_idx = -1, audio_stream_idx = -1;
 static AVFrame *frame = NULL;
 static AVPacket pkt;
 static int video_frame_count = 0;
 static int audio_frame_count = 0;
+/* writev() all of iov, in chunks of IOV_MAX and across partial writes */
+static int write_iov(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, FFMIN(iovcnt, IOV_MAX));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        while (iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+static void print_video_segment(void)
+{
+    printf("Play the output video file with the command:\n"
+           "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
+           av_get_pix_fmt_name(pix_fmt), width, height,
+           video_segment_filename);
+}
+static int open_video_segment(void)
+{
+    if (video_segment)
+        snprintf(video_segment_filename, sizeof(video_segment_filename), "%s.%d",
+                 video_dst_filename, video_segment);
+    else
+        av_strlcpy(video_segment_filename, video_dst_filename, sizeof(video_segment_filename));
+    video_dst_fd = open(video_segment_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (video_dst_fd < 0) {
+        fprintf(stderr, "Could not open destination file %s\n", video_segment_filename);
+        return AVERROR(errno);
+    }
+    return 0;
+}
 static int output_video_frame(AVFrame *frame)
 {
+    const AVPixFmtDescriptor *desc;
+    int row_size[4];
+    int nb_planes, nb_iov = 0, i, y, ret;
+    if (use_stream_out) {
+        printf("video_frame n:%d coded_n:%d\n",
+               video_frame_count++, frame->coded_picture_number);
+        return stream_output_write_frame(&stream_out, frame,
+                                         av_guess_frame_rate(fmt_ctx, video_stream, NULL));
+    }
     if (frame->width != width || frame->height != height ||
         frame->format != pix_fmt) {
-        /* To handle this change, one could call av_image_alloc again and
-         * decode the following frames into another rawvideo file. */
-        fprintf(stderr, "Error: Width, height and pixel format have to be "
-                        "constant in a rawvideo file, but the width, height or "
-                        "pixel format of the input video changed:\n"
-                        "old: width = %d, height = %d, format = %s\n"
-                        "new: width = %d, height = %d, format = %s\n",
+        /* rawvideo can not change geometry, continue in a new segment */
+        fprintf(stderr, "Video changed from %dx%d %s to %dx%d %s, starting segment %d\n",
                 width, height, av_get_pix_fmt_name(pix_fmt),
-                frame->width, frame->height,
-                av_get_pix_fmt_name(frame->format));
-        return -1;
+                frame->width, frame->height, av_get_pix_fmt_name(frame->format),
+                video_segment + 1);
+        print_video_segment();
+        close(video_dst_fd);
+        video_segment++;
+        width = frame->width;
+        height = frame->height;
+        pix_fmt = frame->format;
+        if ((ret = open_video_segment()) < 0)
+            return ret;
     }
     printf("video_frame n:%d coded_n:%d\n",
            video_frame_count++, frame->coded_picture_number);
-    /* copy decoded frame to destination buffer:
-     * this is required since rawvideo expects non aligned data */
-    av_image_copy(video_dst_data, video_dst_linesize,
-                  (const uint8_t **)(frame->data), frame->linesize,
-                  pix_fmt, width, height);
-    /* write to rawvideo file */
-    fwrite(video_dst_data[0], 1, video_dst_bufsize, video_dst_file);
-    return 0;
+    desc = av_pix_fmt_desc_get(pix_fmt);
+    nb_planes = av_pix_fmt_count_planes(pix_fmt);
+    if (!desc || nb_planes <= 0 ||
+        (ret = av_image_fill_linesizes(row_size, pix_fmt, width)) < 0) {
+        fprintf(stderr, "Unsupported pixel format %s\n", av_get_pix_fmt_name(pix_fmt));
+        return AVERROR(EINVAL);
+    }
+    /* rawvideo expects unpadded rows, point at them instead of copying them out */
+    if (video_iov_size < height * nb_planes + 1) {
+        av_freep(&video_iov);
+        video_iov = av_malloc_array(height * nb_planes + 1, sizeof(*video_iov));
+        if (!video_iov)
+            return AVERROR(ENOMEM);
+        video_iov_size = height * nb_planes + 1;
+    }
+    for (i = 0; i < nb_planes; i++) {
+        int h = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+        if (frame->linesize[i] == row_size[i]) {
+            video_iov[nb_iov].iov_base = frame->data[i];
+            video_iov[nb_iov++].iov_len = (size_t)row_size[i] * h;
+            continue;
+        }
+        for (y = 0; y < h; y++) {
+            video_iov[nb_iov].iov_base = frame->data[i] + (ptrdiff_t)y * frame->linesize[i];
+            video_iov[nb_iov++].iov_len = row_size[i];
+        }
+    }
+    if (desc->flags & AV_PIX_FMT_FLAG_PAL) {
+        video_iov[nb_iov].iov_base = frame->data[1];
+        video_iov[nb_iov++].iov_len = 4 * 256;
+    }
+    return write_iov(video_dst_fd, video_iov, nb_iov);
+}
+/* Interleave nb_channels planes of bps byte samples into dst. */
+static void interleave_samples(uint8_t *dst, uint8_t **src, int nb_channels, int nb_samples, int bps)
+{
+    int i = 0, ch;
+#if defined(__SSE2__)
+    if (nb_channels == 2 && bps == 4) {
+        for (; i + 4 <= nb_samples; i += 4) {
+            __m128i l = _mm_loadu_si128((const __m128i *)(src[0] + i * 4));
+            __m128i r = _mm_loadu_si128((const __m128i *)(src[1] + i * 4));
+            _mm_storeu_si128((__m128i *)(dst + i * 8), _mm_unpacklo_epi32(l, r));
+            _mm_storeu_si128((__m128i *)(dst + i * 8 + 16), _mm_unpackhi_epi32(l, r));
+        }
+    } else if (nb_channels == 2 && bps == 2) {
+        for (; i + 8 <= nb_samples; i += 8) {
+            __m128i l = _mm_loadu_si128((const __m128i *)(src[0] + i * 2));
+            __m128i r = _mm_loadu_si128((const __m128i *)(src[1] + i * 2));
+            _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(l, r));
+        }
+    }
+#endif
+    for (; i < nb_samples; i++) {
+        for (ch = 0; ch < nb_channels; ch++) {
+            uint8_t *out = dst + (i * nb_channels + ch) * bps;
+            const uint8_t *in = src[ch] + i * bps;
+            switch (bps) {
+                case 1: *out = *in; break;
+                case 2: memcpy(out, in, 2); break;
+                case 4: memcpy(out, in, 4); break;
+                default: memcpy(out, in, 8); break;
+            }
+        }
+    }
 }
 static int output_audio_frame(AVFrame *frame)
 {
-    size_t unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample(frame->format);
+    int bps = av_get_bytes_per_sample(frame->format);
+    size_t size = (size_t)frame->nb_samples * bps * frame->channels;
+    const uint8_t *data = frame->extended_data[0];
+    ssize_t n;
     printf("audio_frame n:%d nb_samples:%d pts:%s\n",
            audio_frame_count++, frame->nb_samples,
            av_ts2timestr(frame->pts, &audio_dec_ctx->time_base));
-    /* Write the raw audio data samples of the first plane. This works
-     * fine for packed formats (e.g. AV_SAMPLE_FMT_S16). However,
-     * most audio decoders output planar audio, which uses a separate
-     * plane of audio samples for each channel (e.g. AV_SAMPLE_FMT_S16P).
-     * In other words, this code will write only the first audio channel
-     * in these cases.
-     * You should use libswresample or libavfilter to convert the frame
-     * to packed data. */
-    fwrite(frame->extended_data[0], 1, unpadded_linesize, audio_dst_file);
+    /* most audio decoders output planar audio, one plane per channel, while
+     * rawaudio is packed: interleave the planes first */
+    if (av_sample_fmt_is_planar(frame->format) && frame->channels > 1) {
+        av_fast_malloc(&audio_buf, &audio_buf_size, size);
+        if (!audio_buf)
+            return AVERROR(ENOMEM);
+        interleave_samples(audio_buf, frame->extended_data, frame->channels, frame->nb_samples, bps);
+        data = audio_buf;
+    }
+    while (size > 0) {
+        n = write(audio_dst_fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        data += n;
+        size -= n;
+    }
     return 0;
 }
 static int decode_packet(AVCodecContext *dec, const AVPacket *pkt)
@@ -222,28 +377,26 @@ int main (int argc, char **argv)
     }
     if (open_codec_context(&video_stream_idx, &video_dec_ctx, fmt_ctx, AVMEDIA_TYPE_VIDEO) >= 0) {
         video_stream = fmt_ctx->streams[video_stream_idx];
-        video_dst_file = fopen(video_dst_filename, "wb");
-        if (!video_dst_file) {
-            fprintf(stderr, "Could not open destination file %s\n", video_dst_filename);
-            ret = 1;
-            goto end;
-        }
-        /* allocate image where the decoded image will be put */
         width = video_dec_ctx->width;
         height = video_dec_ctx->height;
         pix_fmt = video_dec_ctx->pix_fmt;
-        ret = av_image_alloc(video_dst_data, video_dst_linesize,
-                             width, height, pix_fmt, 1);
-        if (ret < 0) {
-            fprintf(stderr, "Could not allocate raw video buffer\n");
+        enum StreamFormat stream_format;
+        const char *stream_url;
+        if (stream_output_parse(video_dst_filename, &stream_format, &stream_url)) {
+            if (stream_output_open(&stream_out, stream_url, stream_format) < 0) {
+                ret = 1;
+                goto end;
+            }
+            use_stream_out = 1;
+        } else if (open_video_segment() < 0) {
+            ret = 1;
             goto end;
         }
-        video_dst_bufsize = ret;
     }
     if (open_codec_context(&audio_stream_idx, &audio_dec_ctx, fmt_ctx, AVMEDIA_TYPE_AUDIO) >= 0) {
         audio_stream = fmt_ctx->streams[audio_stream_idx];
-        audio_dst_file = fopen(audio_dst_filename, "wb");
-        if (!audio_dst_file) {
+        audio_dst_fd = open(audio_dst_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (audio_dst_fd < 0) {
             fprintf(stderr, "Could not open destination file %s\n", audio_dst_filename);
             ret = 1;
             goto end;
@@ -288,24 +441,12 @@ int main (int argc, char **argv)
     if (audio_dec_ctx)
         decode_packet(audio_dec_ctx, NULL);
     printf("Demuxing succeeded.\n");
-    if (video_stream) {
-        printf("Play the output video file with the command:\n"
-               "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
-               av_get_pix_fmt_name(pix_fmt), width, height,
-               video_dst_filename);
-    }
+    if (video_stream && !use_stream_out)
+        print_video_segment();
     if (audio_stream) {
-        enum AVSampleFormat sfmt = audio_dec_ctx->sample_fmt;
+        enum AVSampleFormat sfmt = av_get_packed_sample_fmt(audio_dec_ctx->sample_fmt);
         int n_channels = audio_dec_ctx->channels;
         const char *fmt;
-        if (av_sample_fmt_is_planar(sfmt)) {
-            const char *packed = av_get_sample_fmt_name(sfmt);
-            printf("Warning: the sample format the decoder produced is planar "
-                   "(%s). This example will output the first channel only.\n",
-                   packed ? packed : "?");
-            sfmt = av_get_packed_sample_fmt(sfmt);
-            n_channels = 1;
-        }
         if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
             goto end;
         printf("Play the output audio file with the command:\n"
@@ -317,11 +458,14 @@ int main (int argc, char **argv)
     avcodec_free_context(&video_dec_ctx);
     avcodec_free_context(&audio_dec_ctx);
     avformat_close_input(&fmt_ctx);
-    if (video_dst_file)
-        fclose(video_dst_file);
-    if (audio_dst_file)
-        fclose(audio_dst_file);
+    if (video_dst_fd >= 0)
+        close(video_dst_fd);
+    if (use_stream_out && stream_output_close(&stream_out) < 0)
+        fprintf(stderr, "Error closing the video stream output\n");
+    if (audio_dst_fd >= 0)
+        close(audio_dst_fd);
     av_frame_free(&frame);
-    av_free(video_dst_data[0]);
+    av_freep(&video_iov);
+    av_freep(&audio_buf);
     return ret < 0;
 }
\ No newline at end of file
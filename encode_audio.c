@@ -24,15 +24,65 @@
  * audio encoding with libavcodec API example.
  *
  * @example encode_audio.c
+ *
+ * Batch mode encodes raw s16le PCM files (or "-" for stdin) of any length,
+ * several files at a time, one thread per file:
+ *
+ *     encode_audio -batch -c aac -j 4 -ar 44100 -ac 2 a.pcm a.aac b.pcm b.aac
+ *
+ * Input is read in CHUNK_SAMPLES chunks from an AVBufferPool. When the
+ * encoder takes s16 input at the input rate and layout, encoder frames
+ * reference the chunk directly and only the tail that does not fill a whole
+ * frame goes through an AVAudioFifo. Otherwise libswresample converts
+ * straight into the encoder frames and keeps the remainder itself. Packets
+ * go through a muxer whose AVIOContext has an OUTPUT_BATCH_SIZE buffer, so
+ * the output is written in large blocks.
+ *
+ * -bench encodes a synthetic tone with MP2, AAC and Opus and reports the
+ * realtime factor per core (audio seconds per CPU second).
  */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/common.h>
 #include <libavutil/frame.h>
 #include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
+#include <libswresample/swresample.h>
+
+#define CHUNK_SAMPLES 65536
+#define OUTPUT_BATCH_SIZE (1 << 20)
+#define MAX_JOBS 64
+
+typedef struct EncodeJob {
+    const char *input, *output;
+    /* NULL to guess the muxer from the output name */
+    const char *format;
+    const char *codec_name;
+    int sample_rate, channels;
+    /* -bench: interleaved s16 input from memory instead of a file */
+    const int16_t *pcm;
+    int64_t pcm_samples;
+    int64_t samples;
+    double cpu_time;
+    int ret;
+} EncodeJob;
+
+static EncodeJob jobs[MAX_JOBS];
+static int nb_jobs;
+static int next_job;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* check that a given sample format is supported by the encoder */
 static int check_sample_fmt(const AVCodec *codec, enum AVSampleFormat sample_fmt) {
@@ -103,6 +153,463 @@ static void encode(AVCodecContext *ctx, AVFrame *frame, AVPacket *pkt,
     }
 }
 
+static int64_t pick_channel_layout(const AVCodec *codec, int channels) {
+    const uint64_t *p = codec->channel_layouts;
+    uint64_t layout = av_get_default_channel_layout(channels);
+    if (!p)
+        return layout;
+    for (; *p; p++) {
+        if (*p == layout)
+            return layout;
+    }
+    return select_channel_layout(codec);
+}
+
+static int pick_sample_rate(const AVCodec *codec, int sample_rate) {
+    const int *p = codec->supported_samplerates;
+    if (!p)
+        return sample_rate;
+    for (; *p; p++) {
+        if (*p == sample_rate)
+            return sample_rate;
+    }
+    return select_sample_rate(codec);
+}
+
+static int write_output(void *opaque, uint8_t *buf, int buf_size) {
+    int fd = *(int *) opaque;
+    int written = 0;
+    while (written < buf_size) {
+        ssize_t n = write(fd, buf + written, buf_size - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        written += n;
+    }
+    return written;
+}
+
+/* Fill size bytes unless the input ends first. */
+static int read_input(EncodeJob *job, int fd, int64_t *pcm_pos, uint8_t *buf, int size) {
+    int done = 0;
+    if (job->pcm) {
+        int64_t left = (job->pcm_samples * job->channels - *pcm_pos) * 2;
+        done = FFMIN(size, left);
+        memcpy(buf, job->pcm + *pcm_pos, done);
+        *pcm_pos += done / 2;
+        return done;
+    }
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return AVERROR(errno);
+        if (!n)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static int encode_batch(AVCodecContext *ctx, AVFrame *frame, AVPacket *pkt, AVFormatContext *oc) {
+    int ret = avcodec_send_frame(ctx, frame);
+    if (ret < 0)
+        return ret;
+    while ((ret = avcodec_receive_packet(ctx, pkt)) >= 0) {
+        av_packet_rescale_ts(pkt, ctx->time_base, oc->streams[0]->time_base);
+        pkt->stream_index = 0;
+        ret = av_write_frame(oc, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* Send a frame of nb_samples, padding a short last frame with silence when the encoder needs full frames. */
+static int send_samples(AVCodecContext *c, AVFrame *frame, int nb_samples, int64_t *pts,
+                        AVPacket *pkt, AVFormatContext *oc) {
+    if (nb_samples < c->frame_size &&
+        !(c->codec->capabilities & (AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_VARIABLE_FRAME_SIZE))) {
+        av_samples_set_silence(frame->extended_data, nb_samples, c->frame_size - nb_samples,
+                               c->channels, c->sample_fmt);
+        nb_samples = c->frame_size;
+    }
+    frame->nb_samples = nb_samples;
+    frame->pts = *pts;
+    *pts += nb_samples;
+    return encode_batch(c, frame, pkt, oc);
+}
+
+/*
+ * Convert into the encoder frame, *filled samples of which are already
+ * converted, and send every frame that becomes full. in NULL drains the
+ * resampler.
+ */
+static int convert_samples(struct SwrContext *swr, AVCodecContext *c, AVFrame *frame, int *filled,
+                           const uint8_t **in, int in_count, int64_t *pts, AVPacket *pkt, AVFormatContext *oc) {
+    int planar = av_sample_fmt_is_planar(c->sample_fmt);
+    int bps = av_get_bytes_per_sample(c->sample_fmt);
+    int ret, ch;
+    while (1) {
+        uint8_t *out[AV_NUM_DATA_POINTERS];
+        if (!*filled && (ret = av_frame_make_writable(frame)) < 0)
+            return ret;
+        for (ch = 0; ch < (planar ? c->channels : 1) && ch < AV_NUM_DATA_POINTERS; ch++)
+            out[ch] = frame->extended_data[ch] + *filled * bps * (planar ? 1 : c->channels);
+        ret = swr_convert(swr, out, c->frame_size ? c->frame_size - *filled : CHUNK_SAMPLES - *filled,
+                          in, in_count);
+        in_count = 0;
+        if (ret <= 0)
+            return ret;
+        *filled += ret;
+        /* a partial frame waits for more input, or for the drain to finish */
+        if (*filled < (c->frame_size ? c->frame_size : CHUNK_SAMPLES)) {
+            if (in)
+                return 0;
+            continue;
+        }
+        if ((ret = send_samples(c, frame, *filled, pts, pkt, oc)) < 0)
+            return ret;
+        *filled = 0;
+    }
+}
+
+static int encode_job(EncodeJob *job) {
+    const AVCodec *codec;
+    AVCodecContext *c = NULL;
+    AVFormatContext *oc = NULL;
+    AVStream *st;
+    struct SwrContext *swr = NULL;
+    AVAudioFifo *fifo = NULL;
+    AVBufferPool *pool = NULL;
+    AVFrame *frame = NULL;
+    AVPacket *pkt = NULL;
+    uint8_t *io_buffer = NULL;
+    int in_fd = -1, out_fd = -1;
+    int64_t pcm_pos = 0, pts = 0;
+    int frame_size, chunk_bytes, in_sample_bytes = 2 * job->channels;
+    int convert, filled = 0, ret;
+    codec = avcodec_find_encoder_by_name(job->codec_name);
+    if (!codec) {
+        fprintf(stderr, "Codec %s not found\n", job->codec_name);
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    c = avcodec_alloc_context3(codec);
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!c || !pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    c->bit_rate = codec->id == AV_CODEC_ID_MP2 ? 64000 : 128000;
+    c->sample_fmt = check_sample_fmt(codec, AV_SAMPLE_FMT_S16) ? AV_SAMPLE_FMT_S16 : codec->sample_fmts[0];
+    c->sample_rate = pick_sample_rate(codec, job->sample_rate);
+    c->channel_layout = pick_channel_layout(codec, job->channels);
+    c->channels = av_get_channel_layout_nb_channels(c->channel_layout);
+    c->time_base = (AVRational){1, c->sample_rate};
+    c->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, job->format, job->output)) < 0) {
+        fprintf(stderr, "Could not find a muxer for %s\n", job->output);
+        goto end;
+    }
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+        c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(c, codec, NULL)) < 0) {
+        fprintf(stderr, "Could not open codec %s\n", job->codec_name);
+        goto end;
+    }
+    st = avformat_new_stream(oc, NULL);
+    if (!st) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    st->time_base = c->time_base;
+    if ((ret = avcodec_parameters_from_context(st->codecpar, c)) < 0)
+        goto end;
+    out_fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!job->pcm)
+        in_fd = strcmp(job->input, "-") ? open(job->input, O_RDONLY) : dup(STDIN_FILENO);
+    io_buffer = av_malloc(OUTPUT_BATCH_SIZE);
+    if (out_fd < 0 || (!job->pcm && in_fd < 0) || !io_buffer) {
+        fprintf(stderr, "Could not open %s or %s\n", job->input, job->output);
+        ret = io_buffer ? AVERROR(errno) : AVERROR(ENOMEM);
+        goto end;
+    }
+    oc->pb = avio_alloc_context(io_buffer, OUTPUT_BATCH_SIZE, 1, &out_fd, NULL, write_output, NULL);
+    if (!oc->pb) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    io_buffer = NULL;
+    if ((ret = avformat_write_header(oc, NULL)) < 0)
+        goto end;
+
+    frame_size = c->frame_size && !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) ?
+                 c->frame_size : CHUNK_SAMPLES;
+    convert = c->sample_fmt != AV_SAMPLE_FMT_S16 || c->sample_rate != job->sample_rate ||
+              c->channels != job->channels;
+    chunk_bytes = CHUNK_SAMPLES * in_sample_bytes;
+    pool = av_buffer_pool_init(chunk_bytes, NULL);
+    fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_S16, c->channels, frame_size);
+    frame->format = c->sample_fmt;
+    frame->channel_layout = c->channel_layout;
+    frame->channels = c->channels;
+    frame->sample_rate = c->sample_rate;
+    frame->nb_samples = frame_size;
+    if (!pool || !fifo || (ret = av_frame_get_buffer(frame, 0)) < 0) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (convert) {
+        swr = swr_alloc_set_opts(NULL, c->channel_layout, c->sample_fmt, c->sample_rate,
+                                 av_get_default_channel_layout(job->channels), AV_SAMPLE_FMT_S16,
+                                 job->sample_rate, 0, NULL);
+        if (!swr || (ret = swr_init(swr)) < 0) {
+            fprintf(stderr, "Could not initialize the resampler\n");
+            ret = swr ? ret : AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+
+    while (1) {
+        AVBufferRef *chunk = av_buffer_pool_get(pool);
+        int nb_samples, offset = 0;
+        if (!chunk) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ret = read_input(job, in_fd, &pcm_pos, chunk->data, chunk_bytes);
+        nb_samples = ret > 0 ? ret / in_sample_bytes : 0;
+        if (nb_samples <= 0) {
+            av_buffer_unref(&chunk);
+            if (ret < 0)
+                goto end;
+            break;
+        }
+        job->samples += nb_samples;
+        if (convert) {
+            /* convert straight into encoder frames, swr keeps what does not fit */
+            const uint8_t *in[1] = { chunk->data };
+            ret = convert_samples(swr, c, frame, &filled, in, nb_samples, &pts, pkt, oc);
+            av_buffer_unref(&chunk);
+            if (ret < 0)
+                goto end;
+            continue;
+        }
+        /* complete the frame started by the previous chunk */
+        if (av_audio_fifo_size(fifo)) {
+            void *head = chunk->data;
+            offset = FFMIN(frame_size - av_audio_fifo_size(fifo), nb_samples);
+            av_audio_fifo_write(fifo, &head, offset);
+            if (av_audio_fifo_size(fifo) == frame_size) {
+                if ((ret = av_frame_make_writable(frame)) < 0 ||
+                    av_audio_fifo_read(fifo, (void **) frame->extended_data, frame_size) < frame_size ||
+                    (ret = send_samples(c, frame, frame_size, &pts, pkt, oc)) < 0) {
+                    av_buffer_unref(&chunk);
+                    goto end;
+                }
+            }
+        }
+        /* whole frames reference the chunk, no copy */
+        while (nb_samples - offset >= frame_size) {
+            AVFrame *ref = av_frame_alloc();
+            if (!ref || !(ref->buf[0] = av_buffer_ref(chunk))) {
+                av_frame_free(&ref);
+                av_buffer_unref(&chunk);
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            ref->data[0] = chunk->data + offset * in_sample_bytes;
+            ref->linesize[0] = frame_size * in_sample_bytes;
+            ref->format = AV_SAMPLE_FMT_S16;
+            ref->channel_layout = c->channel_layout;
+            ref->channels = c->channels;
+            ref->sample_rate = c->sample_rate;
+            ret = send_samples(c, ref, frame_size, &pts, pkt, oc);
+            av_frame_free(&ref);
+            if (ret < 0) {
+                av_buffer_unref(&chunk);
+                goto end;
+            }
+            offset += frame_size;
+        }
+        if (offset < nb_samples) {
+            void *tail = chunk->data + offset * in_sample_bytes;
+            av_audio_fifo_write(fifo, &tail, nb_samples - offset);
+        }
+        av_buffer_unref(&chunk);
+    }
+    /* what is left in the resampler or the fifo makes up the last frames */
+    if (convert) {
+        if ((ret = convert_samples(swr, c, frame, &filled, NULL, 0, &pts, pkt, oc)) < 0)
+            goto end;
+        if (filled && (ret = send_samples(c, frame, filled, &pts, pkt, oc)) < 0)
+            goto end;
+    }
+    while (!convert && av_audio_fifo_size(fifo)) {
+        int n;
+        if ((ret = av_frame_make_writable(frame)) < 0)
+            goto end;
+        n = av_audio_fifo_read(fifo, (void **) frame->extended_data, frame_size);
+        if (n <= 0)
+            break;
+        if ((ret = send_samples(c, frame, n, &pts, pkt, oc)) < 0)
+            goto end;
+    }
+    if ((ret = encode_batch(c, NULL, pkt, oc)) < 0)
+        goto end;
+    ret = av_write_trailer(oc);
+    end:
+    if (oc && oc->pb) {
+        avio_flush(oc->pb);
+        av_freep(&oc->pb->buffer);
+        avio_context_free(&oc->pb);
+    }
+    avformat_free_context(oc);
+    avcodec_free_context(&c);
+    swr_free(&swr);
+    if (fifo)
+        av_audio_fifo_free(fifo);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    av_buffer_pool_uninit(&pool);
+    av_free(io_buffer);
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+    return ret;
+}
+
+static double thread_cpu_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *job_thread(void *arg) {
+    while (1) {
+        EncodeJob *job;
+        double start;
+        pthread_mutex_lock(&job_mutex);
+        job = next_job < nb_jobs ? &jobs[next_job++] : NULL;
+        pthread_mutex_unlock(&job_mutex);
+        if (!job)
+            break;
+        start = thread_cpu_time();
+        job->ret = encode_job(job);
+        job->cpu_time = thread_cpu_time() - start;
+        if (job->ret < 0)
+            fprintf(stderr, "%s: %s\n", job->input, av_err2str(job->ret));
+    }
+    return NULL;
+}
+
+/* Run all jobs on nb_threads threads, return the wall time in seconds. */
+static double run_jobs(int nb_threads) {
+    pthread_t threads[MAX_JOBS];
+    int64_t start = av_gettime_relative();
+    int i;
+    next_job = 0;
+    nb_threads = FFMIN(nb_threads, nb_jobs);
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(&threads[i], NULL, job_thread, NULL)) {
+            nb_threads = i;
+            break;
+        }
+    }
+    if (!nb_threads)
+        job_thread(NULL);
+    for (i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+    return (av_gettime_relative() - start) / 1e6;
+}
+
+static void print_jobs(const char *label, double wall) {
+    double audio = 0, cpu = 0;
+    int i;
+    for (i = 0; i < nb_jobs; i++) {
+        audio += (double) jobs[i].samples / jobs[i].sample_rate;
+        cpu += jobs[i].cpu_time;
+    }
+    printf("%s: %d files, %.1fs of audio, %.3fs wall, %.3fs cpu, realtime factor %.1fx per core, %.1fx overall\n",
+           label, nb_jobs, audio, wall, cpu, cpu > 0 ? audio / cpu : 0, wall > 0 ? audio / wall : 0);
+}
+
+static int batch_main(int argc, char **argv) {
+    const char *codec_name = "mp2";
+    int threads = 1, sample_rate = 44100, channels = 2, bench = 0, bench_seconds = 60;
+    int i, ret = 0;
+    bench = !strcmp(argv[1], "-bench");
+    for (i = 2; i < argc && argv[i][0] == '-' && argv[i][1]; i += 2) {
+        if (i + 1 >= argc)
+            break;
+        if (!strcmp(argv[i], "-c"))
+            codec_name = argv[i + 1];
+        else if (!strcmp(argv[i], "-j"))
+            threads = av_clip(atoi(argv[i + 1]), 1, MAX_JOBS);
+        else if (!strcmp(argv[i], "-ar"))
+            sample_rate = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-ac"))
+            channels = av_clip(atoi(argv[i + 1]), 1, 8);
+    }
+    if (bench) {
+        static const char *const codecs[][2] = { { "mp2", "mp2" }, { "aac", "adts" }, { "libopus", "ogg" } };
+        int16_t *pcm;
+        int64_t n, j;
+        float t = 0, tincr;
+        if (i < argc)
+            bench_seconds = FFMAX(atoi(argv[i]), 1);
+        /* 48 kHz stereo, every encoder takes it without resampling */
+        sample_rate = 48000;
+        channels = 2;
+        n = (int64_t) bench_seconds * sample_rate;
+        pcm = av_malloc_array(n * channels, sizeof(*pcm));
+        if (!pcm)
+            return 1;
+        tincr = 2 * M_PI * 440.0 / sample_rate;
+        for (j = 0; j < n; j++) {
+            pcm[2 * j] = pcm[2 * j + 1] = (int) (sin(t) * 10000);
+            t += tincr;
+        }
+        for (i = 0; i < FF_ARRAY_ELEMS(codecs); i++) {
+            double wall;
+            int k;
+            if (!avcodec_find_encoder_by_name(codecs[i][0])) {
+                printf("%s: encoder not available\n", codecs[i][0]);
+                continue;
+            }
+            nb_jobs = threads;
+            for (k = 0; k < nb_jobs; k++) {
+                jobs[k] = (EncodeJob) { .input = "tone", .output = "/dev/null", .format = codecs[i][1],
+                                        .codec_name = codecs[i][0], .sample_rate = sample_rate,
+                                        .channels = channels, .pcm = pcm, .pcm_samples = n };
+            }
+            wall = run_jobs(threads);
+            print_jobs(codecs[i][0], wall);
+        }
+        av_free(pcm);
+        return 0;
+    }
+    for (nb_jobs = 0; i + 1 < argc && nb_jobs < MAX_JOBS; i += 2, nb_jobs++) {
+        jobs[nb_jobs] = (EncodeJob) { .input = argv[i], .output = argv[i + 1], .codec_name = codec_name,
+                                      .sample_rate = sample_rate, .channels = channels };
+    }
+    if (!nb_jobs) {
+        fprintf(stderr, "Usage: %s -batch [-c codec] [-j jobs] [-ar rate] [-ac channels] input output ...\n"
+                        "       %s -bench [-j jobs] [seconds]\n", argv[0], argv[0]);
+        return 1;
+    }
+    print_jobs(codec_name, run_jobs(threads));
+    for (i = 0; i < nb_jobs; i++)
+        ret |= jobs[i].ret < 0;
+    return ret;
+}
+
 int main(int argc, char **argv) {
     const char *filename;
     const AVCodec *codec;
@@ -114,9 +621,13 @@ int main(int argc, char **argv) {
     uint16_t *samples;
     float t, tincr;
     if (argc <= 1) {
-        fprintf(stderr, "Usage: %s <output file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <output file>\n"
+                        "       %s -batch [-c codec] [-j jobs] [-ar rate] [-ac channels] input output ...\n"
+                        "       %s -bench [-j jobs] [seconds]\n", argv[0], argv[0], argv[0]);
         return 0;
     }
+    if (!strcmp(argv[1], "-batch") || !strcmp(argv[1], "-bench"))
+        return batch_main(argc, argv);
     filename = argv[1];
     /* find the MP2 encoder */
     codec = avcodec_find_encoder(AV_CODEC_ID_MP2);
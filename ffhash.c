@@ -24,27 +24,60 @@
  */
 //#include <config.h>
 #include <libavutil/avstring.h>
+#include <libavutil/cpu.h>
 #include <libavutil/error.h>
 #include <libavutil/hash.h>
 #include <libavutil/mem.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #if HAVE_IO_H
 #include <io.h>
 #endif
-#if HAVE_UNISTD_H
 #include <unistd.h>
-#endif
 #define SIZE 65536
-static struct AVHashContext *hash;
+/* read size of the large-read path */
+#define LARGE_SIZE (4 << 20)
+/* av_hash_update() takes an int length, so a mapping is hashed in slices */
+#define MAP_SLICE (1 << 30)
+#define MAX_THREADS 64
+#define RESULT_SIZE (2 * AV_HASH_MAX_SIZE + 64)
+enum ReadMode {
+    READ_SMALL,
+    READ_LARGE,
+    READ_MMAP,
+};
+typedef struct FileJob {
+    char *file;
+    char result[RESULT_SIZE];
+    int ret;
+    int64_t bytes;
+} FileJob;
+static const char *hash_name;
 static int out_b64;
+static enum ReadMode read_mode = READ_SMALL;
+static int nb_threads = 1;
+static int64_t tree_chunk;
+static struct AVHashContext *hashes[MAX_THREADS];
+static FileJob *jobs;
+static int nb_jobs, next_job;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
 static void usage(void)
 {
     int i = 0;
     const char *name;
-    printf("usage: ffhash [b64:]algorithm [input]...\n");
+    printf("usage: ffhash [-j threads] [-r|-m] [-t chunk_size] [-B] [b64:]algorithm [input]...\n");
+    printf("  -j threads     hash up to threads files concurrently (or tree chunks with -t)\n");
+    printf("  -r             read with %d KiB reads and posix_fadvise(SEQUENTIAL)\n", LARGE_SIZE >> 10);
+    printf("  -m             mmap the input files instead of reading them\n");
+    printf("  -t chunk_size  tree hash: hash chunk_size byte chunks in parallel, then hash the digests\n");
+    printf("  -B             also hash with the default path and report GB/s for both on stderr\n");
     printf("Supported hash algorithms:");
     do {
         name = av_hash_names(i);
@@ -54,81 +87,360 @@ static void usage(void)
     } while(name);
     printf("\n");
 }
-static void finish(void)
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/* drop the inputs from the page cache so each -B pass reads from the disk */
+static void evict_cache(void)
+{
+    int i;
+    for (i = 0; i < nb_jobs; i++) {
+        int fd = open(jobs[i].file, O_RDONLY);
+        if (fd == -1)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+static void finish(struct AVHashContext *hash, FileJob *job)
 {
     char res[2 * AV_HASH_MAX_SIZE + 4];
-    printf("%s=", av_hash_get_name(hash));
+    av_strlcatf(job->result, sizeof(job->result), "%s%s=",
+                tree_chunk ? "tree-" : "", av_hash_get_name(hash));
     if (out_b64) {
         av_hash_final_b64(hash, res, sizeof(res));
-        printf("b64:%s", res);
+        av_strlcatf(job->result, sizeof(job->result), "b64:%s", res);
     } else {
         av_hash_final_hex(hash, res, sizeof(res));
-        printf("0x%s", res);
+        av_strlcatf(job->result, sizeof(job->result), "0x%s", res);
+    }
+}
+static void update_mapped(struct AVHashContext *hash, const uint8_t *data, int64_t size)
+{
+    while (size > 0) {
+        int len = size > MAP_SLICE ? MAP_SLICE : size;
+        av_hash_update(hash, data, len);
+        data += len;
+        size -= len;
     }
 }
-static int check(char *file)
+/* Hash [offset, offset + size) of fd with pread, so chunks can be read concurrently. */
+static int update_range(struct AVHashContext *hash, int fd, int64_t offset, int64_t size,
+                        uint8_t *buffer, int buffer_size)
 {
-    uint8_t buffer[SIZE];
+    while (size > 0) {
+        ssize_t len = pread(fd, buffer, size > buffer_size ? buffer_size : size, offset);
+        if (len < 0)
+            return errno;
+        if (!len)
+            break;
+        av_hash_update(hash, buffer, len);
+        offset += len;
+        size -= len;
+    }
+    return 0;
+}
+static int hash_fd(struct AVHashContext *hash, int fd, FileJob *job)
+{
+    uint8_t small[SIZE];
+    uint8_t *buffer = small;
+    int buffer_size = SIZE;
+    struct stat st;
+    if (read_mode == READ_MMAP && fd && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            madvise(data, st.st_size, MADV_WILLNEED);
+            update_mapped(hash, data, st.st_size);
+            munmap(data, st.st_size);
+            job->bytes += st.st_size;
+            return 0;
+        }
+        /* fall back to reading */
+    }
+    if (read_mode != READ_SMALL) {
+        buffer = av_malloc(LARGE_SIZE);
+        if (!buffer)
+            return ENOMEM;
+        buffer_size = LARGE_SIZE;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    for (;;) {
+        int size = read(fd, buffer, buffer_size);
+        if (size < 0) {
+            int err = errno;
+            if (buffer != small)
+                av_free(buffer);
+            return err;
+        } else if(!size)
+            break;
+        av_hash_update(hash, buffer, size);
+        job->bytes += size;
+    }
+    if (buffer != small)
+        av_free(buffer);
+    return 0;
+}
+typedef struct TreeContext {
+    int fd;
+    uint8_t *data;
+    int64_t size;
+    int nb_chunks;
+    int next_chunk;
+    int digest_size;
+    uint8_t *digests;
+    int err;
+    pthread_mutex_t mutex;
+} TreeContext;
+static TreeContext tree;
+static void *tree_worker(void *arg)
+{
+    struct AVHashContext *hash = arg;
+    uint8_t *buffer = NULL;
+    int chunk, err = 0;
+    if (!tree.data && !(buffer = av_malloc(LARGE_SIZE)))
+        err = ENOMEM;
+    for (;;) {
+        int64_t offset, size;
+        pthread_mutex_lock(&tree.mutex);
+        if (err && !tree.err)
+            tree.err = err;
+        chunk = tree.err ? tree.nb_chunks : tree.next_chunk++;
+        pthread_mutex_unlock(&tree.mutex);
+        if (chunk >= tree.nb_chunks)
+            break;
+        offset = chunk * tree_chunk;
+        size = FFMIN(tree_chunk, tree.size - offset);
+        av_hash_init(hash);
+        if (tree.data)
+            update_mapped(hash, tree.data + offset, size);
+        else
+            err = update_range(hash, tree.fd, offset, size, buffer, LARGE_SIZE);
+        av_hash_final_bin(hash, tree.digests + (int64_t) chunk * tree.digest_size, tree.digest_size);
+    }
+    av_free(buffer);
+    return NULL;
+}
+/* Hash every chunk of the file on nb_threads threads, then hash the concatenated digests. */
+static int tree_hash_fd(int fd, FileJob *job)
+{
+    pthread_t threads[MAX_THREADS];
+    struct stat st;
+    int i, started, ret;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+        return ESPIPE;
+    memset(&tree, 0, sizeof(tree));
+    pthread_mutex_init(&tree.mutex, NULL);
+    tree.fd = fd;
+    tree.size = st.st_size;
+    tree.nb_chunks = (st.st_size + tree_chunk - 1) / tree_chunk;
+    tree.digest_size = av_hash_get_size(hashes[0]);
+    tree.digests = av_malloc_array(FFMAX(tree.nb_chunks, 1), tree.digest_size);
+    if (!tree.digests)
+        return ENOMEM;
+    if (read_mode == READ_MMAP && st.st_size > 0) {
+        tree.data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (tree.data == MAP_FAILED)
+            tree.data = NULL;
+        else
+            madvise(tree.data, st.st_size, MADV_WILLNEED);
+    }
+    if (!tree.data)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    for (started = 0; started < nb_threads; started++) {
+        if (pthread_create(&threads[started], NULL, tree_worker, hashes[started]))
+            break;
+    }
+    if (!started)
+        tree.err = EAGAIN;
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    av_hash_init(hashes[0]);
+    av_hash_update(hashes[0], tree.digests, tree.nb_chunks * tree.digest_size);
+    if (tree.data)
+        munmap(tree.data, st.st_size);
+    av_freep(&tree.digests);
+    pthread_mutex_destroy(&tree.mutex);
+    ret = tree.err;
+    if (!ret)
+        job->bytes += st.st_size;
+    return ret;
+}
+static int check(struct AVHashContext *hash, FileJob *job)
+{
+    char *file = job->file;
     int fd, flags = O_RDONLY;
-    int ret = 0;
+    int ret = 0, err;
 #ifdef O_BINARY
     flags |= O_BINARY;
 #endif
+    job->result[0] = 0;
     if (file) fd = open(file, flags);
     else      fd = 0;
     if (fd == -1) {
-        printf("%s=OPEN-FAILED: %s:", av_hash_get_name(hash), strerror(errno));
+        av_strlcatf(job->result, sizeof(job->result), "%s=OPEN-FAILED: %s:",
+                    av_hash_get_name(hash), strerror(errno));
         ret = 1;
         goto end;
     }
     av_hash_init(hash);
-    for (;;) {
-        int size = read(fd, buffer, SIZE);
-        if (size < 0) {
-            int err = errno;
-            close(fd);
-            finish();
-            printf("+READ-FAILED: %s", strerror(err));
-            ret = 2;
-            goto end;
-        } else if(!size)
-            break;
-        av_hash_update(hash, buffer, size);
-    }
+    err = tree_chunk ? tree_hash_fd(fd, job) : hash_fd(hash, fd, job);
     close(fd);
-    finish();
+    finish(hash, job);
+    if (err) {
+        av_strlcatf(job->result, sizeof(job->result), "+READ-FAILED: %s", strerror(err));
+        ret = 2;
+    }
     end:
     if (file)
-        printf(" *%s", file);
-    printf("\n");
+        av_strlcatf(job->result, sizeof(job->result), " *%s", file);
     return ret;
 }
+static void *file_worker(void *arg)
+{
+    struct AVHashContext *hash = arg;
+    for (;;) {
+        int i;
+        pthread_mutex_lock(&job_mutex);
+        i = next_job++;
+        pthread_mutex_unlock(&job_mutex);
+        if (i >= nb_jobs)
+            break;
+        jobs[i].ret = check(hash, &jobs[i]);
+    }
+    return NULL;
+}
+/* Hash every job, several files at a time unless tree hashing; returns the total bytes hashed. */
+static int64_t run_jobs(void)
+{
+    pthread_t threads[MAX_THREADS];
+    int64_t bytes = 0;
+    int i, started = 0;
+    next_job = 0;
+    for (i = 0; i < nb_jobs; i++)
+        jobs[i].bytes = 0;
+    if (tree_chunk || nb_threads == 1 || nb_jobs == 1) {
+        for (i = 0; i < nb_jobs; i++)
+            jobs[i].ret = check(hashes[0], &jobs[i]);
+    } else {
+        for (started = 0; started < FFMIN(nb_threads, nb_jobs); started++) {
+            if (pthread_create(&threads[started], NULL, file_worker, hashes[started]))
+                break;
+        }
+        /* the calling thread picks up the rest if no thread could be started */
+        if (!started)
+            file_worker(hashes[0]);
+        for (i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    }
+    for (i = 0; i < nb_jobs; i++)
+        bytes += jobs[i].bytes;
+    return bytes;
+}
 int main(int argc, char **argv)
 {
-    int i;
-    int ret = 0;
-    const char *hash_name;
+    int i, opt;
+    int ret = 0, bench = 0;
+    double start, elapsed;
+    int64_t bytes;
+    while ((opt = getopt(argc, argv, "+j:rmt:B")) != -1) {
+        switch (opt) {
+            case 'j':
+                nb_threads = atoi(optarg);
+                if (nb_threads <= 0)
+                    nb_threads = av_cpu_count();
+                nb_threads = FFMIN(nb_threads, MAX_THREADS);
+                break;
+            case 'r':
+                read_mode = READ_LARGE;
+                break;
+            case 'm':
+                read_mode = READ_MMAP;
+                break;
+            case 't':
+                tree_chunk = strtoll(optarg, NULL, 0);
+                if (tree_chunk <= 0) {
+                    printf("Invalid chunk size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                bench = 1;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
     if (argc == 1) {
         usage();
         return 0;
     }
+    if (bench && argc < 3) {
+        printf("-B needs input files, stdin can only be read once\n");
+        return 1;
+    }
     hash_name = argv[1];
     out_b64 = av_strstart(hash_name, "b64:", &hash_name);
-    if ((ret = av_hash_alloc(&hash, hash_name)) < 0) {
-        switch(ret) {
-            case AVERROR(EINVAL):
-                printf("Invalid hash type: %s\n", hash_name);
-                break;
-            case AVERROR(ENOMEM):
-                printf("%s\n", strerror(errno));
-                break;
+    for (i = 0; i < nb_threads; i++) {
+        if ((ret = av_hash_alloc(&hashes[i], hash_name)) < 0) {
+            switch(ret) {
+                case AVERROR(EINVAL):
+                    printf("Invalid hash type: %s\n", hash_name);
+                    break;
+                case AVERROR(ENOMEM):
+                    printf("%s\n", strerror(errno));
+                    break;
+            }
+            ret = 1;
+            goto end;
         }
-        return 1;
+    }
+    nb_jobs = argc < 3 ? 1 : argc - 2;
+    jobs = av_mallocz_array(nb_jobs, sizeof(*jobs));
+    if (!jobs) {
+        ret = 1;
+        goto end;
     }
     for (i = 2; i < argc; i++)
-        ret |= check(argv[i]);
-    if (argc < 3)
-        ret |= check(NULL);
-    av_hash_freep(&hash);
+        jobs[i - 2].file = argv[i];
+    if (bench) {
+        enum ReadMode mode = read_mode;
+        int threads = nb_threads;
+        int64_t chunk = tree_chunk;
+        read_mode = READ_SMALL;
+        nb_threads = 1;
+        tree_chunk = 0;
+        evict_cache();
+        start = now_seconds();
+        bytes = run_jobs();
+        elapsed = now_seconds() - start;
+        fprintf(stderr, "default: %.3f GB in %.3fs, %.3f GB/s\n", bytes / 1e9, elapsed, bytes / 1e9 / elapsed);
+        read_mode = mode;
+        nb_threads = threads;
+        tree_chunk = chunk;
+        evict_cache();
+    }
+    start = now_seconds();
+    bytes = run_jobs();
+    elapsed = now_seconds() - start;
+    for (i = 0; i < nb_jobs; i++) {
+        printf("%s\n", jobs[i].result);
+        ret |= jobs[i].ret;
+    }
+    if (bench)
+        fprintf(stderr, "selected: %.3f GB in %.3fs, %.3f GB/s (%d threads, %s%s)\n",
+                bytes / 1e9, elapsed, bytes / 1e9 / elapsed, nb_threads,
+                read_mode == READ_MMAP ? "mmap" : read_mode == READ_LARGE ? "large reads" : "64 KiB reads",
+                tree_chunk ? ", tree" : "");
+    end:
+    for (i = 0; i < nb_threads; i++)
+        av_hash_freep(&hashes[i]);
+    av_freep(&jobs);
     return ret;
 }
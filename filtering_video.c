@@ -24,12 +24,21 @@
  * @file
  * API example for decoding and filtering
  * @example filtering_video.c
+ *
+ * With -b the example runs in throughput mode instead: there is no display
+ * and no sleep, decoding runs on its own thread and hands frames to the
+ * filtering thread through a bounded queue, and the graph uses slice
+ * threading. The frames/sec of every filter chain given on the command line
+ * (or of a standard set: scale, overlay, yadif, hqdn3d) is reported.
  */
 #define _XOPEN_SOURCE 600 /* for usleep */
 
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavfilter/buffersink.h>
@@ -48,6 +57,21 @@ AVFilterGraph *filter_graph;
 static int video_stream_index = -1;
 static int64_t last_pts = AV_NOPTS_VALUE;
 
+#define FRAME_QUEUE_SIZE 16
+static const char *benchmark_filters[] = {
+        "scale=1280:720",
+        "split[main][tmp];[tmp]scale=iw/4:ih/4[pip];[main][pip]overlay=16:16",
+        "yadif",
+        "hqdn3d",
+};
+static int benchmark;
+static int filter_threads;
+/* decoded frames waiting for the filter thread, NULL marks the end of the stream */
+static AVFrame *frame_queue[FRAME_QUEUE_SIZE];
+static int frame_queue_head, frame_queue_count, frame_queue_abort;
+static pthread_mutex_t frame_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_queue_cond = PTHREAD_COND_INITIALIZER;
+
 static int open_input_file(const char *filename) {
     int ret;
     AVCodec *dec;
@@ -71,6 +95,8 @@ static int open_input_file(const char *filename) {
     if (!dec_ctx)
         return AVERROR(ENOMEM);
     avcodec_parameters_to_context(dec_ctx, fmt_ctx->streams[video_stream_index]->codecpar);
+    if (benchmark)
+        dec_ctx->thread_count = 0;
     /* init the video decoder */
     if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot open video decoder\n");
@@ -93,6 +119,8 @@ static int init_filters(const char *filters_descr) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
+    /* slice threading for the filters that support it, 0 lets libavfilter pick */
+    filter_graph->nb_threads = filter_threads;
     /* buffer video source: the decoded frames from the decoder will be inserted here. */
     snprintf(args, sizeof(args),
              "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
@@ -112,8 +140,10 @@ static int init_filters(const char *filters_descr) {
         av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
         goto end;
     }
-    ret = av_opt_set_int_list(buffersink_ctx, "pix_fmts", pix_fmts,
-                              AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
+    /* the benchmark measures the chain itself, without a conversion to gray */
+    if (!benchmark)
+        ret = av_opt_set_int_list(buffersink_ctx, "pix_fmts", pix_fmts,
+                                  AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot set output pixel format\n");
         goto end;
@@ -186,15 +216,207 @@ static void display_frame(const AVFrame *frame, AVRational time_base) {
     fflush(stdout);
 }
 
+static int frame_queue_put(AVFrame *frame) {
+    pthread_mutex_lock(&frame_queue_mutex);
+    while (frame_queue_count == FRAME_QUEUE_SIZE && !frame_queue_abort)
+        pthread_cond_wait(&frame_queue_cond, &frame_queue_mutex);
+    if (frame_queue_abort) {
+        pthread_mutex_unlock(&frame_queue_mutex);
+        av_frame_free(&frame);
+        return AVERROR_EXIT;
+    }
+    frame_queue[(frame_queue_head + frame_queue_count) % FRAME_QUEUE_SIZE] = frame;
+    frame_queue_count++;
+    pthread_cond_signal(&frame_queue_cond);
+    pthread_mutex_unlock(&frame_queue_mutex);
+    return 0;
+}
+
+static AVFrame *frame_queue_get(void) {
+    AVFrame *frame;
+    pthread_mutex_lock(&frame_queue_mutex);
+    while (!frame_queue_count)
+        pthread_cond_wait(&frame_queue_cond, &frame_queue_mutex);
+    frame = frame_queue[frame_queue_head];
+    frame_queue_head = (frame_queue_head + 1) % FRAME_QUEUE_SIZE;
+    frame_queue_count--;
+    pthread_cond_signal(&frame_queue_cond);
+    pthread_mutex_unlock(&frame_queue_mutex);
+    return frame;
+}
+
+/* Stop the decode thread and drop the frames it queued. */
+static void frame_queue_stop(void) {
+    pthread_mutex_lock(&frame_queue_mutex);
+    frame_queue_abort = 1;
+    while (frame_queue_count) {
+        av_frame_free(&frame_queue[frame_queue_head]);
+        frame_queue_head = (frame_queue_head + 1) % FRAME_QUEUE_SIZE;
+        frame_queue_count--;
+    }
+    pthread_cond_broadcast(&frame_queue_cond);
+    pthread_mutex_unlock(&frame_queue_mutex);
+}
+
+static int decode_and_queue(const AVPacket *packet) {
+    int ret = avcodec_send_packet(dec_ctx, packet);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Error while sending a packet to the decoder\n");
+        return ret;
+    }
+    while (ret >= 0) {
+        AVFrame *frame = av_frame_alloc();
+        if (!frame)
+            return AVERROR(ENOMEM);
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            av_frame_free(&frame);
+            return 0;
+        } else if (ret < 0) {
+            av_frame_free(&frame);
+            av_log(NULL, AV_LOG_ERROR, "Error while receiving a frame from the decoder\n");
+            return ret;
+        }
+        frame->pts = frame->best_effort_timestamp;
+        ret = frame_queue_put(frame);
+    }
+    return ret;
+}
+
+static void *decode_thread(void *arg) {
+    AVPacket packet;
+    int ret = 0;
+    while (ret >= 0 && av_read_frame(fmt_ctx, &packet) >= 0) {
+        if (packet.stream_index == video_stream_index)
+            ret = decode_and_queue(&packet);
+        av_packet_unref(&packet);
+    }
+    /* flush the decoder */
+    if (ret >= 0)
+        decode_and_queue(NULL);
+    frame_queue_put(NULL);
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Pull every frame the graph has ready; returns the number of frames or a negative error. */
+static int drain_filter(AVFrame *filt_frame) {
+    int ret, nb_frames = 0;
+    while (1) {
+        ret = av_buffersink_get_frame(buffersink_ctx, filt_frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return nb_frames;
+        if (ret < 0)
+            return ret;
+        nb_frames++;
+        av_frame_unref(filt_frame);
+    }
+}
+
+/* Decode filename on one thread, run it through filters_descr on this one and report frames/sec. */
+static int run_benchmark(const char *filename, const char *filters_descr) {
+    pthread_t decoder;
+    AVFrame *frame, *filt_frame;
+    double start, elapsed, filter_time = 0, t;
+    int64_t nb_in = 0, nb_out = 0;
+    int ret, started = 0;
+    filt_frame = av_frame_alloc();
+    if (!filt_frame)
+        return AVERROR(ENOMEM);
+    if ((ret = open_input_file(filename)) < 0)
+        goto end;
+    if ((ret = init_filters(filters_descr)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot init filter chain '%s'\n", filters_descr);
+        goto end;
+    }
+    frame_queue_abort = 0;
+    if (pthread_create(&decoder, NULL, decode_thread, NULL)) {
+        ret = AVERROR(EAGAIN);
+        goto end;
+    }
+    started = 1;
+    start = now_seconds();
+    while ((frame = frame_queue_get())) {
+        nb_in++;
+        t = now_seconds();
+        ret = av_buffersrc_add_frame_flags(buffersrc_ctx, frame, 0);
+        av_frame_free(&frame);
+        if (ret >= 0)
+            ret = drain_filter(filt_frame);
+        filter_time += now_seconds() - t;
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error while filtering\n");
+            goto end;
+        }
+        nb_out += ret;
+    }
+    /* flush the graph */
+    t = now_seconds();
+    ret = av_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0);
+    if (ret >= 0)
+        ret = drain_filter(filt_frame);
+    filter_time += now_seconds() - t;
+    if (ret < 0)
+        goto end;
+    nb_out += ret;
+    elapsed = now_seconds() - start;
+    printf("%-72s in:%6"PRId64" out:%6"PRId64" pipeline:%8.1f fps filter only:%8.1f fps\n",
+           filters_descr, nb_in, nb_out, nb_out / elapsed, filter_time > 0 ? nb_out / filter_time : 0);
+    ret = 0;
+    end:
+    if (started) {
+        frame_queue_stop();
+        pthread_join(decoder, NULL);
+    }
+    avfilter_graph_free(&filter_graph);
+    avcodec_free_context(&dec_ctx);
+    avformat_close_input(&fmt_ctx);
+    av_frame_free(&filt_frame);
+    return ret;
+}
+
 int main(int argc, char **argv) {
     int ret;
     AVPacket packet;
     AVFrame *frame;
     AVFrame *filt_frame;
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s file\n", argv[0]);
+    int i;
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        benchmark = 1;
+        argv++;
+        argc--;
+        if (argc > 2 && !strcmp(argv[1], "-t")) {
+            filter_threads = atoi(argv[2]);
+            argv += 2;
+            argc -= 2;
+        }
+    }
+    if (argc < 2 || (!benchmark && argc != 2)) {
+        fprintf(stderr, "Usage: %s file\n"
+                        "       %s -b [-t filter_threads] file [filter_chain]...\n", argv[0], argv[0]);
         exit(1);
     }
+    if (benchmark) {
+        ret = 0;
+        printf("filter threads: %d (0 = auto)\n", filter_threads);
+        if (argc > 2) {
+            for (i = 2; i < argc && ret >= 0; i++)
+                ret = run_benchmark(argv[1], argv[i]);
+        } else {
+            for (i = 0; i < FF_ARRAY_ELEMS(benchmark_filters) && ret >= 0; i++)
+                ret = run_benchmark(argv[1], benchmark_filters[i]);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+            exit(1);
+        }
+        exit(0);
+    }
     frame = av_frame_alloc();
     filt_frame = av_frame_alloc();
     if (!frame || !filt_frame) {
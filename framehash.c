@@ -0,0 +1,423 @@
+/**
+ * @file
+ * Per-frame checksums of decoded audio and video, framemd5 style.
+ *
+ * @example framehash.c
+ * This example decodes every audio and video stream of the input and prints
+ * one line per decoded frame:
+ *
+ *     stream_index, best effort timestamp, size, hash(plane 0), hash(plane 1), ...
+ *
+ * The planes of a frame are hashed in parallel by a pool of worker threads,
+ * each owning its own hash context. Up to MAX_FRAMES_IN_FLIGHT frames are
+ * queued while the main thread keeps decoding, and lines are printed strictly
+ * in decode order, so the output is identical for any number of threads.
+ *
+ * Only the visible bytes of every row are hashed (linesize padding is
+ * skipped), which keeps the result independent of the decoder's alignment.
+ *
+ * Besides every algorithm of av_hash_names() (md5, murmur3, crc32, ...) the
+ * tool provides crc32c, which uses the SSE4.2 crc32 instruction when the CPU
+ * has it and a table driven implementation otherwise.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libavutil/hash.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#include <libavformat/avformat.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_SSE42 1
+#else
+#define HAVE_CRC32C_SSE42 0
+#endif
+
+#define MAX_THREADS          64
+#define MAX_PLANES           64
+#define MAX_FRAMES_IN_FLIGHT 32
+#define CRC32C_NAME          "crc32c"
+
+typedef struct FrameSlot {
+    AVFrame *frame;
+    int stream_index;
+    int nb_planes;
+    /* planes not hashed yet */
+    int pending;
+    uint8_t digest[MAX_PLANES][AV_HASH_MAX_SIZE];
+} FrameSlot;
+
+typedef struct HashJob {
+    FrameSlot *slot;
+    int plane;
+} HashJob;
+
+static AVFormatContext *fmt_ctx = NULL;
+static AVCodecContext **dec_ctx = NULL;
+/* streams when the decoders were opened; AVFMTCTX_NOHEADER inputs can add streams later */
+static int nb_dec_ctx;
+static const char *hash_name = NULL;
+static int use_crc32c;
+static int digest_size;
+
+static FrameSlot slots[MAX_FRAMES_IN_FLIGHT];
+/* slots[head] is the oldest frame, nb_slots frames are in flight */
+static int slot_head, nb_slots;
+static HashJob jobs[MAX_FRAMES_IN_FLIGHT * MAX_PLANES];
+static int job_head, nb_jobs;
+static int quit;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int64_t nb_frames, nb_bytes;
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init_table(void) {
+    uint32_t i, j, c;
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+}
+
+static uint32_t crc32c_c(uint32_t crc, const uint8_t *buf, size_t size) {
+    while (size--)
+        crc = crc32c_table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t size) {
+    uint64_t c = crc;
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+        c = _mm_crc32_u64(c, v);
+        buf += 8;
+        size -= 8;
+    }
+    crc = (uint32_t) c;
+    while (size--)
+        crc = _mm_crc32_u8(crc, *buf++);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t *buf, size_t size) = crc32c_c;
+
+static void crc32c_init(void) {
+    crc32c_init_table();
+#if HAVE_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_update = crc32c_sse42;
+#endif
+}
+
+/* Visible row size, row count and stride of one plane of a frame. */
+static void plane_geometry(const AVFrame *frame, int plane, int *row_size, int *rows, int *stride) {
+    if (frame->width > 0) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+        int linesizes[4];
+        av_image_fill_linesizes(linesizes, frame->format, frame->width);
+        *row_size = linesizes[plane];
+        *rows = frame->height;
+        *stride = frame->linesize[plane];
+        if ((plane == 1 || plane == 2) && (desc->flags & AV_PIX_FMT_FLAG_PLANAR))
+            *rows = -((-frame->height) >> desc->log2_chroma_h);
+    } else {
+        int planar = av_sample_fmt_is_planar(frame->format);
+        *row_size = frame->nb_samples * av_get_bytes_per_sample(frame->format) *
+                    (planar ? 1 : frame->channels);
+        *rows = 1;
+        *stride = frame->linesize[0];
+    }
+}
+
+static int count_planes(const AVFrame *frame) {
+    if (frame->width > 0)
+        return av_pix_fmt_count_planes(frame->format);
+    return av_sample_fmt_is_planar(frame->format) ? frame->channels : 1;
+}
+
+static void hash_plane(struct AVHashContext *hash, FrameSlot *slot, int plane) {
+    const AVFrame *frame = slot->frame;
+    const uint8_t *data = frame->extended_data[plane];
+    int row_size, rows, stride, y;
+    plane_geometry(frame, plane, &row_size, &rows, &stride);
+    if (use_crc32c) {
+        uint32_t crc = 0xFFFFFFFF;
+        for (y = 0; y < rows; y++)
+            crc = crc32c_update(crc, data + (ptrdiff_t) y * stride, row_size);
+        crc ^= 0xFFFFFFFF;
+        slot->digest[plane][0] = crc >> 24;
+        slot->digest[plane][1] = crc >> 16;
+        slot->digest[plane][2] = crc >> 8;
+        slot->digest[plane][3] = crc;
+    } else {
+        av_hash_init(hash);
+        for (y = 0; y < rows; y++)
+            av_hash_update(hash, data + (ptrdiff_t) y * stride, row_size);
+        av_hash_final(hash, slot->digest[plane]);
+    }
+}
+
+static void *hash_worker(void *arg) {
+    struct AVHashContext *hash = arg;
+    HashJob job;
+    for (;;) {
+        pthread_mutex_lock(&mutex);
+        while (!nb_jobs && !quit)
+            pthread_cond_wait(&job_cond, &mutex);
+        if (!nb_jobs) {
+            pthread_mutex_unlock(&mutex);
+            break;
+        }
+        job = jobs[job_head];
+        job_head = (job_head + 1) % FF_ARRAY_ELEMS(jobs);
+        nb_jobs--;
+        pthread_mutex_unlock(&mutex);
+
+        hash_plane(hash, job.slot, job.plane);
+
+        pthread_mutex_lock(&mutex);
+        if (!--job.slot->pending)
+            pthread_cond_signal(&done_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+/* Print and release a completed slot; called with the mutex held. */
+static void print_slot(FrameSlot *slot) {
+    int i, j, size = 0, row_size, rows, stride;
+    for (i = 0; i < slot->nb_planes; i++) {
+        plane_geometry(slot->frame, i, &row_size, &rows, &stride);
+        size += row_size * rows;
+    }
+    printf("%d, %10"PRId64", %10d", slot->stream_index, slot->frame->best_effort_timestamp, size);
+    for (i = 0; i < slot->nb_planes; i++) {
+        printf(", ");
+        for (j = 0; j < digest_size; j++)
+            printf("%02x", slot->digest[i][j]);
+    }
+    printf("\n");
+    nb_frames++;
+    nb_bytes += size;
+    av_frame_free(&slot->frame);
+}
+
+/* Print every finished frame at the head of the ring; block until at most max_slots stay in flight. */
+static void drain_slots(int max_slots) {
+    pthread_mutex_lock(&mutex);
+    while (nb_slots > 0) {
+        FrameSlot *slot = &slots[slot_head];
+        if (slot->pending) {
+            if (nb_slots <= max_slots)
+                break;
+            pthread_cond_wait(&done_cond, &mutex);
+            continue;
+        }
+        print_slot(slot);
+        slot_head = (slot_head + 1) % MAX_FRAMES_IN_FLIGHT;
+        nb_slots--;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static int submit_frame(AVFrame *frame, int stream_index) {
+    FrameSlot *slot;
+    int i, nb_planes = count_planes(frame);
+    if (nb_planes > MAX_PLANES) {
+        fprintf(stderr, "Too many planes in frame: %d\n", nb_planes);
+        return AVERROR(EINVAL);
+    }
+    drain_slots(MAX_FRAMES_IN_FLIGHT - 1);
+    pthread_mutex_lock(&mutex);
+    slot = &slots[(slot_head + nb_slots) % MAX_FRAMES_IN_FLIGHT];
+    slot->frame = av_frame_clone(frame);
+    if (!slot->frame) {
+        pthread_mutex_unlock(&mutex);
+        return AVERROR(ENOMEM);
+    }
+    slot->stream_index = stream_index;
+    slot->nb_planes = nb_planes;
+    slot->pending = nb_planes;
+    nb_slots++;
+    for (i = 0; i < nb_planes; i++) {
+        HashJob *job = &jobs[(job_head + nb_jobs) % FF_ARRAY_ELEMS(jobs)];
+        job->slot = slot;
+        job->plane = i;
+        nb_jobs++;
+    }
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+static int decode_packet(AVCodecContext *dec, const AVPacket *pkt, AVFrame *frame, int stream_index) {
+    int ret = avcodec_send_packet(dec, pkt);
+    if (ret < 0) {
+        fprintf(stderr, "Error submitting a packet for decoding (%s)\n", av_err2str(ret));
+        return ret;
+    }
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(dec, frame);
+        if (ret < 0) {
+            if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
+                return 0;
+            fprintf(stderr, "Error during decoding (%s)\n", av_err2str(ret));
+            return ret;
+        }
+        ret = submit_frame(frame, stream_index);
+        av_frame_unref(frame);
+    }
+    return ret;
+}
+
+static int open_decoders(void) {
+    int i, ret, nb_decoders = 0;
+    dec_ctx = av_mallocz_array(fmt_ctx->nb_streams, sizeof(*dec_ctx));
+    if (!dec_ctx)
+        return AVERROR(ENOMEM);
+    nb_dec_ctx = fmt_ctx->nb_streams;
+    for (i = 0; i < nb_dec_ctx; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        AVCodec *dec;
+        if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+            st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+            continue;
+        dec = avcodec_find_decoder(st->codecpar->codec_id);
+        if (!dec) {
+            fprintf(stderr, "Failed to find decoder for stream #%d\n", i);
+            continue;
+        }
+        dec_ctx[i] = avcodec_alloc_context3(dec);
+        if (!dec_ctx[i])
+            return AVERROR(ENOMEM);
+        if ((ret = avcodec_parameters_to_context(dec_ctx[i], st->codecpar)) < 0)
+            return ret;
+        /* let the decoder use every core, the hash workers mostly wait on it */
+        dec_ctx[i]->thread_count = 0;
+        if ((ret = avcodec_open2(dec_ctx[i], dec, NULL)) < 0) {
+            fprintf(stderr, "Failed to open decoder for stream #%d\n", i);
+            return ret;
+        }
+        nb_decoders++;
+    }
+    return nb_decoders ? 0 : AVERROR_STREAM_NOT_FOUND;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    pthread_t threads[MAX_THREADS];
+    struct AVHashContext *hashes[MAX_THREADS] = {NULL};
+    AVPacket pkt;
+    AVFrame *frame = NULL;
+    double start, elapsed;
+    int nb_threads = 4, i, ret = 0, started = 0;
+    const char *src_filename;
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+        nb_threads = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3 || nb_threads < 1 || nb_threads > MAX_THREADS) {
+        fprintf(stderr, "usage: %s [-t threads] algorithm input_file\n"
+                        "Decode every audio and video stream and print a checksum of every plane of every frame.\n"
+                        "algorithm is " CRC32C_NAME " or one of the av_hash algorithms (md5, murmur3, crc32, ...).\n",
+                argv[0]);
+        exit(1);
+    }
+    hash_name = argv[1];
+    src_filename = argv[2];
+    use_crc32c = !strcmp(hash_name, CRC32C_NAME);
+    if (use_crc32c) {
+        crc32c_init();
+        digest_size = 4;
+    }
+    for (i = 0; i < nb_threads && !use_crc32c; i++) {
+        if ((ret = av_hash_alloc(&hashes[i], hash_name)) < 0) {
+            fprintf(stderr, "Invalid hash type: %s\n", hash_name);
+            goto end;
+        }
+        digest_size = av_hash_get_size(hashes[i]);
+    }
+    if ((ret = avformat_open_input(&fmt_ctx, src_filename, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open source file %s\n", src_filename);
+        goto end;
+    }
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Could not find stream information\n");
+        goto end;
+    }
+    if ((ret = open_decoders()) < 0) {
+        fprintf(stderr, "Could not open any audio or video decoder\n");
+        goto end;
+    }
+    frame = av_frame_alloc();
+    if (!frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (started = 0; started < nb_threads; started++) {
+        if (pthread_create(&threads[started], NULL, hash_worker, hashes[started])) {
+            fprintf(stderr, "Could not create hash thread\n");
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+    printf("#hash: %s\n", hash_name);
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    start = now_seconds();
+    while (av_read_frame(fmt_ctx, &pkt) >= 0) {
+        if (pkt.stream_index < nb_dec_ctx && dec_ctx[pkt.stream_index])
+            ret = decode_packet(dec_ctx[pkt.stream_index], &pkt, frame, pkt.stream_index);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            break;
+    }
+    /* flush the decoders */
+    for (i = 0; i < nb_dec_ctx && ret >= 0; i++) {
+        if (dec_ctx[i])
+            ret = decode_packet(dec_ctx[i], NULL, frame, i);
+    }
+    drain_slots(0);
+    elapsed = now_seconds() - start;
+    fprintf(stderr, "%"PRId64" frames, %.1f MB hashed in %.3fs: %.1f fps, %.1f MB/s (%d threads)\n",
+            nb_frames, nb_bytes / 1e6, elapsed, nb_frames / elapsed, nb_bytes / 1e6 / elapsed, nb_threads);
+    end:
+    pthread_mutex_lock(&mutex);
+    quit = 1;
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&mutex);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    /* frames still in flight after an error */
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        av_frame_free(&slots[i].frame);
+    for (i = 0; i < nb_threads; i++)
+        av_hash_freep(&hashes[i]);
+    if (dec_ctx) {
+        for (i = 0; i < nb_dec_ctx; i++)
+            avcodec_free_context(&dec_ctx[i]);
+    }
+    av_freep(&dec_ctx);
+    avformat_close_input(&fmt_ctx);
+    av_frame_free(&frame);
+    return ret < 0;
+}
@@ -0,0 +1,787 @@
+/**
+ * @file
+ * Deterministic benchmark corpus generator.
+ *
+ * @example gen_corpus.c
+ * Based on muxing.c: every file of the corpus is the synthetic picture and
+ * tone of muxing.c, encoded with the parameters of one spec
+ *
+ *     s=WxH,r=fps,g=gop,bf=b_frames,c:v=encoder,c:a=encoder,ac=channels,t=seconds,f=extension,threads=n
+ *
+ * Keys that are left out keep their defaults; with no spec at all a small
+ * default matrix over MP4, MKV, TS, AVI and a raw H.264 stream is written.
+ *
+ * To make the files identical on every machine the encoders run with a fixed
+ * thread count and AV_CODEC_FLAG_BITEXACT, the muxer with AVFMT_FLAG_BITEXACT,
+ * and keyframes are forced every gop frames. Each file gets a manifest next
+ * to it, <file>.json, describing what a demux and decode of the file yields:
+ * packet and frame counts per stream, the md5 of all packet data and the md5
+ * of all decoded frames (visible bytes only, like framehash), and the md5 of
+ * the file itself. Benchmarks check their output against it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libavutil/avassert.h>
+#include <libavutil/avstring.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/hash.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
+#define STREAM_PIX_FMT    AV_PIX_FMT_YUV420P /* default pix_fmt */
+#define SCALE_FLAGS SWS_BICUBIC
+#define MAX_PATH 1024
+#define HASH_NAME "md5"
+
+typedef struct CorpusSpec {
+    int width, height;
+    int fps;
+    int gop;
+    int b_frames;
+    /* encoder names, NULL for the default codecs of the container */
+    const char *video_codec;
+    const char *audio_codec;
+    /* 0 leaves the audio stream out */
+    int channels;
+    double duration;
+    /* file extension, which also selects the container */
+    const char *format;
+    int threads;
+} CorpusSpec;
+
+// a wrapper around a single output AVStream
+typedef struct OutputStream {
+    AVStream *st;
+    AVCodecContext *enc;
+    /* pts of the next frame that will be generated */
+    int64_t next_pts;
+    int samples_count;
+    AVFrame *frame;
+    AVFrame *tmp_frame;
+    float t, tincr, tincr2;
+    struct SwsContext *sws_ctx;
+    struct SwrContext *swr_ctx;
+    double duration;
+    int finished;
+} OutputStream;
+
+static const char *default_specs[] = {
+    "s=640x360,r=25,g=50,bf=0,f=mp4",
+    "s=1280x720,r=30,g=60,bf=2,f=mkv",
+    "s=1920x1080,r=25,g=25,bf=2,c:v=libx264,c:a=aac,f=ts",
+    "s=1280x720,r=25,g=12,bf=0,c:v=mpeg4,f=avi",
+    "s=1280x720,r=30,g=60,bf=2,ac=0,f=h264",
+};
+
+static void set_default_spec(CorpusSpec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    spec->width = 352;
+    spec->height = 288;
+    spec->fps = 25;
+    spec->gop = 12;
+    spec->channels = 2;
+    spec->duration = 10.0;
+    spec->format = "mp4";
+    spec->threads = 1;
+}
+
+/* Parse "key=value,..." on top of the defaults. Returns 0 or a negative value on a bad spec. */
+static int parse_spec(CorpusSpec *spec, char *str)
+{
+    char *saveptr = NULL, *token;
+    set_default_spec(spec);
+    for (token = strtok_r(str, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(token, '=');
+        if (!value)
+            return -1;
+        *value++ = 0;
+        if (!strcmp(token, "s")) {
+            if (sscanf(value, "%dx%d", &spec->width, &spec->height) != 2)
+                return -1;
+        } else if (!strcmp(token, "r")) {
+            spec->fps = atoi(value);
+        } else if (!strcmp(token, "g")) {
+            spec->gop = atoi(value);
+        } else if (!strcmp(token, "bf")) {
+            spec->b_frames = atoi(value);
+        } else if (!strcmp(token, "c:v")) {
+            spec->video_codec = value;
+        } else if (!strcmp(token, "c:a")) {
+            spec->audio_codec = value;
+        } else if (!strcmp(token, "ac")) {
+            spec->channels = atoi(value);
+        } else if (!strcmp(token, "t")) {
+            spec->duration = atof(value);
+        } else if (!strcmp(token, "f")) {
+            spec->format = value;
+        } else if (!strcmp(token, "threads")) {
+            spec->threads = atoi(value);
+        } else {
+            return -1;
+        }
+    }
+    /* Resolution must be a multiple of two. */
+    if (spec->width <= 0 || spec->height <= 0 || (spec->width | spec->height) & 1 ||
+        spec->fps <= 0 || spec->gop <= 0 || spec->b_frames < 0 || spec->channels < 0 ||
+        spec->duration <= 0 || spec->threads <= 0)
+        return -1;
+    return 0;
+}
+
+static AVCodec *find_encoder(const char *name, enum AVCodecID codec_id)
+{
+    AVCodec *codec = name ? avcodec_find_encoder_by_name(name) : avcodec_find_encoder(codec_id);
+    if (!codec) {
+        fprintf(stderr, "Could not find encoder for '%s'\n",
+                name ? name : avcodec_get_name(codec_id));
+        exit(1);
+    }
+    return codec;
+}
+
+/* Add an output stream. */
+static void add_stream(OutputStream *ost, AVFormatContext *oc,
+                       AVCodec *codec, const CorpusSpec *spec)
+{
+    AVCodecContext *c;
+    uint64_t channel_layout;
+    int i;
+    ost->st = avformat_new_stream(oc, NULL);
+    if (!ost->st) {
+        fprintf(stderr, "Could not allocate stream\n");
+        exit(1);
+    }
+    ost->st->id = oc->nb_streams-1;
+    ost->duration = spec->duration;
+    c = avcodec_alloc_context3(codec);
+    if (!c) {
+        fprintf(stderr, "Could not alloc an encoding context\n");
+        exit(1);
+    }
+    ost->enc = c;
+    /* the output of frame or slice threaded encoders depends on the thread count */
+    c->thread_count = spec->threads;
+    c->flags |= AV_CODEC_FLAG_BITEXACT;
+    switch (codec->type) {
+        case AVMEDIA_TYPE_AUDIO:
+            c->sample_fmt  = codec->sample_fmts ?
+                             codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+            c->bit_rate    = 32000 * spec->channels;
+            c->sample_rate = 44100;
+            if (codec->supported_samplerates) {
+                c->sample_rate = codec->supported_samplerates[0];
+                for (i = 0; codec->supported_samplerates[i]; i++) {
+                    if (codec->supported_samplerates[i] == 44100)
+                        c->sample_rate = 44100;
+                }
+            }
+            channel_layout = av_get_default_channel_layout(spec->channels);
+            c->channel_layout = channel_layout;
+            if (codec->channel_layouts) {
+                c->channel_layout = codec->channel_layouts[0];
+                for (i = 0; codec->channel_layouts[i]; i++) {
+                    if (codec->channel_layouts[i] == channel_layout)
+                        c->channel_layout = channel_layout;
+                }
+                if (c->channel_layout != channel_layout)
+                    fprintf(stderr, "%s does not support %d channels, using %d\n", codec->name,
+                            spec->channels, av_get_channel_layout_nb_channels(c->channel_layout));
+            }
+            c->channels        = av_get_channel_layout_nb_channels(c->channel_layout);
+            ost->st->time_base = (AVRational){ 1, c->sample_rate };
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            c->codec_id = codec->id;
+            /* about 0.1 bit per pixel */
+            c->bit_rate = (int64_t) spec->width * spec->height * spec->fps / 10;
+            c->width    = spec->width;
+            c->height   = spec->height;
+            ost->st->time_base = (AVRational){ 1, spec->fps };
+            c->time_base       = ost->st->time_base;
+            c->framerate       = (AVRational){ spec->fps, 1 };
+            /* get_video_frame() forces a keyframe every gop frames, the encoder must not add any */
+            c->gop_size      = spec->gop;
+            c->keyint_min    = spec->gop;
+            c->max_b_frames  = spec->b_frames;
+            c->pix_fmt       = STREAM_PIX_FMT;
+            if (c->codec_id == AV_CODEC_ID_MPEG1VIDEO) {
+                /* Needed to avoid using macroblocks in which some coeffs overflow.
+                 * This does not happen with normal video, it just happens here as
+                 * the motion of the chroma plane does not match the luma plane. */
+                c->mb_decision = 2;
+            }
+            break;
+        default:
+            break;
+    }
+    /* Some formats want stream headers to be separate. */
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+        c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+}
+/**************************************************************/
+/* audio output */
+static AVFrame *alloc_audio_frame(enum AVSampleFormat sample_fmt,
+                                  uint64_t channel_layout,
+                                  int sample_rate, int nb_samples)
+{
+    AVFrame *frame = av_frame_alloc();
+    int ret;
+    if (!frame) {
+        fprintf(stderr, "Error allocating an audio frame\n");
+        exit(1);
+    }
+    frame->format = sample_fmt;
+    frame->channel_layout = channel_layout;
+    frame->sample_rate = sample_rate;
+    frame->nb_samples = nb_samples;
+    if (nb_samples) {
+        ret = av_frame_get_buffer(frame, 0);
+        if (ret < 0) {
+            fprintf(stderr, "Error allocating an audio buffer\n");
+            exit(1);
+        }
+    }
+    return frame;
+}
+static void open_audio(AVCodec *codec, OutputStream *ost)
+{
+    AVCodecContext *c;
+    int nb_samples;
+    int ret;
+    c = ost->enc;
+    /* open it */
+    ret = avcodec_open2(c, codec, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Could not open audio codec: %s\n", av_err2str(ret));
+        exit(1);
+    }
+    /* init signal generator */
+    ost->t     = 0;
+    ost->tincr = 2 * M_PI * 110.0 / c->sample_rate;
+    /* increment frequency by 110 Hz per second */
+    ost->tincr2 = 2 * M_PI * 110.0 / c->sample_rate / c->sample_rate;
+    if (c->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)
+        nb_samples = 10000;
+    else
+        nb_samples = c->frame_size;
+    ost->frame     = alloc_audio_frame(c->sample_fmt, c->channel_layout,
+                                       c->sample_rate, nb_samples);
+    ost->tmp_frame = alloc_audio_frame(AV_SAMPLE_FMT_S16, c->channel_layout,
+                                       c->sample_rate, nb_samples);
+    /* copy the stream parameters to the muxer */
+    ret = avcodec_parameters_from_context(ost->st->codecpar, c);
+    if (ret < 0) {
+        fprintf(stderr, "Could not copy the stream parameters\n");
+        exit(1);
+    }
+    /* create resampler context */
+    ost->swr_ctx = swr_alloc();
+    if (!ost->swr_ctx) {
+        fprintf(stderr, "Could not allocate resampler context\n");
+        exit(1);
+    }
+    /* set options */
+    av_opt_set_int       (ost->swr_ctx, "in_channel_count",   c->channels,       0);
+    av_opt_set_int       (ost->swr_ctx, "in_sample_rate",     c->sample_rate,    0);
+    av_opt_set_sample_fmt(ost->swr_ctx, "in_sample_fmt",      AV_SAMPLE_FMT_S16, 0);
+    av_opt_set_int       (ost->swr_ctx, "out_channel_count",  c->channels,       0);
+    av_opt_set_int       (ost->swr_ctx, "out_sample_rate",    c->sample_rate,    0);
+    av_opt_set_sample_fmt(ost->swr_ctx, "out_sample_fmt",     c->sample_fmt,     0);
+    /* initialize the resampling context */
+    if ((ret = swr_init(ost->swr_ctx)) < 0) {
+        fprintf(stderr, "Failed to initialize the resampling context\n");
+        exit(1);
+    }
+}
+/* Prepare a 16 bit dummy audio frame of 'frame_size' samples and
+ * 'nb_channels' channels. */
+static AVFrame *get_audio_frame(OutputStream *ost)
+{
+    AVFrame *frame = ost->tmp_frame;
+    int j, i, v;
+    int16_t *q = (int16_t*)frame->data[0];
+    /* check if we want to generate more frames */
+    if (av_compare_ts(ost->next_pts, ost->enc->time_base,
+                      llrint(ost->duration * 1000), (AVRational){ 1, 1000 }) >= 0)
+        return NULL;
+    for (j = 0; j <frame->nb_samples; j++) {
+        v = (int)(sin(ost->t) * 10000);
+        for (i = 0; i < ost->enc->channels; i++)
+            *q++ = v;
+        ost->t     += ost->tincr;
+        ost->tincr += ost->tincr2;
+    }
+    frame->pts = ost->next_pts;
+    ost->next_pts  += frame->nb_samples;
+    return frame;
+}
+/**************************************************************/
+/* video output */
+static AVFrame *alloc_picture(enum AVPixelFormat pix_fmt, int width, int height)
+{
+    AVFrame *picture;
+    int ret;
+    picture = av_frame_alloc();
+    if (!picture)
+        return NULL;
+    picture->format = pix_fmt;
+    picture->width  = width;
+    picture->height = height;
+    /* allocate the buffers for the frame data */
+    ret = av_frame_get_buffer(picture, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not allocate frame data.\n");
+        exit(1);
+    }
+    return picture;
+}
+static void open_video(AVCodec *codec, OutputStream *ost)
+{
+    int ret;
+    AVCodecContext *c = ost->enc;
+    /* open the codec */
+    ret = avcodec_open2(c, codec, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Could not open video codec: %s\n", av_err2str(ret));
+        exit(1);
+    }
+    /* allocate and init a re-usable frame */
+    ost->frame = alloc_picture(c->pix_fmt, c->width, c->height);
+    if (!ost->frame) {
+        fprintf(stderr, "Could not allocate video frame\n");
+        exit(1);
+    }
+    /* If the output format is not YUV420P, then a temporary YUV420P
+     * picture is needed too. It is then converted to the required
+     * output format. */
+    ost->tmp_frame = NULL;
+    if (c->pix_fmt != AV_PIX_FMT_YUV420P) {
+        ost->tmp_frame = alloc_picture(AV_PIX_FMT_YUV420P, c->width, c->height);
+        if (!ost->tmp_frame) {
+            fprintf(stderr, "Could not allocate temporary picture\n");
+            exit(1);
+        }
+    }
+    /* copy the stream parameters to the muxer */
+    ret = avcodec_parameters_from_context(ost->st->codecpar, c);
+    if (ret < 0) {
+        fprintf(stderr, "Could not copy the stream parameters\n");
+        exit(1);
+    }
+}
+/* Prepare a dummy image. */
+static void fill_yuv_image(AVFrame *pict, int frame_index,
+                           int width, int height)
+{
+    int x, y, i;
+    i = frame_index;
+    /* Y */
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            pict->data[0][y * pict->linesize[0] + x] = x + y + i * 3;
+    /* Cb and Cr */
+    for (y = 0; y < height / 2; y++) {
+        for (x = 0; x < width / 2; x++) {
+            pict->data[1][y * pict->linesize[1] + x] = 128 + y + i * 2;
+            pict->data[2][y * pict->linesize[2] + x] = 64 + x + i * 5;
+        }
+    }
+}
+static AVFrame *get_video_frame(OutputStream *ost)
+{
+    AVCodecContext *c = ost->enc;
+    /* check if we want to generate more frames */
+    if (av_compare_ts(ost->next_pts, c->time_base,
+                      llrint(ost->duration * 1000), (AVRational){ 1, 1000 }) >= 0)
+        return NULL;
+    /* when we pass a frame to the encoder, it may keep a reference to it
+     * internally; make sure we do not overwrite it here */
+    if (av_frame_make_writable(ost->frame) < 0)
+        exit(1);
+    if (c->pix_fmt != AV_PIX_FMT_YUV420P) {
+        /* as we only generate a YUV420P picture, we must convert it
+         * to the codec pixel format if needed */
+        if (!ost->sws_ctx) {
+            ost->sws_ctx = sws_getContext(c->width, c->height,
+                                          AV_PIX_FMT_YUV420P,
+                                          c->width, c->height,
+                                          c->pix_fmt,
+                                          SCALE_FLAGS | SWS_BITEXACT, NULL, NULL, NULL);
+            if (!ost->sws_ctx) {
+                fprintf(stderr,
+                        "Could not initialize the conversion context\n");
+                exit(1);
+            }
+        }
+        fill_yuv_image(ost->tmp_frame, ost->next_pts, c->width, c->height);
+        sws_scale(ost->sws_ctx, (const uint8_t * const *) ost->tmp_frame->data,
+                  ost->tmp_frame->linesize, 0, c->height, ost->frame->data,
+                  ost->frame->linesize);
+    } else {
+        fill_yuv_image(ost->frame, ost->next_pts, c->width, c->height);
+    }
+    /* a fixed GOP, whatever scene cut detection the encoder does */
+    ost->frame->pict_type = ost->next_pts % c->gop_size ? AV_PICTURE_TYPE_NONE : AV_PICTURE_TYPE_I;
+    ost->frame->pts = ost->next_pts++;
+    return ost->frame;
+}
+/*
+ * encode one frame and send it to the muxer
+ * return 1 when encoding is finished, 0 otherwise
+ */
+static int write_frame(AVFormatContext *oc, OutputStream *ost, AVFrame *frame)
+{
+    AVCodecContext *c = ost->enc;
+    int ret;
+    ret = avcodec_send_frame(c, frame);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending a frame to the encoder: %s\n", av_err2str(ret));
+        exit(1);
+    }
+    while (ret >= 0) {
+        AVPacket pkt = { 0 };
+        ret = avcodec_receive_packet(c, &pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+        else if (ret < 0) {
+            fprintf(stderr, "Error encoding a frame: %s\n", av_err2str(ret));
+            exit(1);
+        }
+        /* rescale output packet timestamp values from codec to stream timebase */
+        av_packet_rescale_ts(&pkt, c->time_base, ost->st->time_base);
+        pkt.stream_index = ost->st->index;
+        ret = av_interleaved_write_frame(oc, &pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error while writing output packet: %s\n", av_err2str(ret));
+            exit(1);
+        }
+    }
+    return ret == AVERROR_EOF ? 1 : 0;
+}
+static int write_audio_frame(AVFormatContext *oc, OutputStream *ost)
+{
+    AVCodecContext *c = ost->enc;
+    AVFrame *frame = get_audio_frame(ost);
+    int ret;
+    if (frame) {
+        /* the sample rate does not change, so every input frame gives one output frame */
+        ret = av_frame_make_writable(ost->frame);
+        if (ret < 0)
+            exit(1);
+        ret = swr_convert(ost->swr_ctx,
+                          ost->frame->data, ost->frame->nb_samples,
+                          (const uint8_t **)frame->data, frame->nb_samples);
+        if (ret < 0) {
+            fprintf(stderr, "Error while converting\n");
+            exit(1);
+        }
+        av_assert0(ret == frame->nb_samples);
+        frame = ost->frame;
+        frame->pts = av_rescale_q(ost->samples_count, (AVRational){1, c->sample_rate}, c->time_base);
+        ost->samples_count += ret;
+    }
+    return write_frame(oc, ost, frame);
+}
+static void close_stream(OutputStream *ost)
+{
+    avcodec_free_context(&ost->enc);
+    av_frame_free(&ost->frame);
+    av_frame_free(&ost->tmp_frame);
+    sws_freeContext(ost->sws_ctx);
+    swr_free(&ost->swr_ctx);
+}
+/* Encode one spec into filename. */
+static void generate(const char *filename, const CorpusSpec *spec)
+{
+    OutputStream video_st = { 0 }, audio_st = { 0 };
+    AVFormatContext *oc;
+    AVCodec *video_codec = NULL, *audio_codec = NULL;
+    int have_video = 0, have_audio = 0;
+    int ret;
+    avformat_alloc_output_context2(&oc, NULL, NULL, filename);
+    if (!oc) {
+        fprintf(stderr, "Could not deduce output format from '%s'\n", filename);
+        exit(1);
+    }
+    /* no library versions in the headers */
+    oc->flags |= AVFMT_FLAG_BITEXACT;
+    if (spec->video_codec || oc->oformat->video_codec != AV_CODEC_ID_NONE) {
+        video_codec = find_encoder(spec->video_codec, oc->oformat->video_codec);
+        add_stream(&video_st, oc, video_codec, spec);
+        have_video = 1;
+    }
+    if (spec->channels && (spec->audio_codec || oc->oformat->audio_codec != AV_CODEC_ID_NONE)) {
+        audio_codec = find_encoder(spec->audio_codec, oc->oformat->audio_codec);
+        add_stream(&audio_st, oc, audio_codec, spec);
+        have_audio = 1;
+    }
+    if (have_video)
+        open_video(video_codec, &video_st);
+    if (have_audio)
+        open_audio(audio_codec, &audio_st);
+    if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&oc->pb, filename, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            fprintf(stderr, "Could not open '%s': %s\n", filename, av_err2str(ret));
+            exit(1);
+        }
+    }
+    ret = avformat_write_header(oc, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred when opening output file: %s\n", av_err2str(ret));
+        exit(1);
+    }
+    video_st.finished = !have_video;
+    audio_st.finished = !have_audio;
+    while (!video_st.finished || !audio_st.finished) {
+        /* select the stream to encode */
+        if (!video_st.finished &&
+            (audio_st.finished || av_compare_ts(video_st.next_pts, video_st.enc->time_base,
+                                                audio_st.next_pts, audio_st.enc->time_base) <= 0))
+            video_st.finished = write_frame(oc, &video_st, get_video_frame(&video_st));
+        else
+            audio_st.finished = write_audio_frame(oc, &audio_st);
+    }
+    av_write_trailer(oc);
+    if (have_video)
+        close_stream(&video_st);
+    if (have_audio)
+        close_stream(&audio_st);
+    if (!(oc->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+}
+/**************************************************************/
+/* manifest */
+typedef struct StreamSummary {
+    AVCodecContext *dec;
+    struct AVHashContext *packet_hash;
+    struct AVHashContext *frame_hash;
+    int64_t packets, keyframes, frames, samples;
+} StreamSummary;
+
+/* Hash the visible bytes of a decoded frame, linesize padding is skipped. */
+static void hash_frame(struct AVHashContext *hash, const AVFrame *frame)
+{
+    int plane, y;
+    if (frame->width) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+        int row_size[4];
+        av_image_fill_linesizes(row_size, frame->format, frame->width);
+        for (plane = 0; plane < 4 && frame->data[plane]; plane++) {
+            int h = frame->height;
+            if (plane == 1 || plane == 2)
+                h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
+            if (desc->flags & AV_PIX_FMT_FLAG_PAL && plane == 1)
+                break;
+            for (y = 0; y < h; y++)
+                av_hash_update(hash, frame->data[plane] + (ptrdiff_t) y * frame->linesize[plane],
+                               row_size[plane]);
+        }
+    } else {
+        int planar = av_sample_fmt_is_planar(frame->format);
+        int size = frame->nb_samples * av_get_bytes_per_sample(frame->format) *
+                   (planar ? 1 : frame->channels);
+        for (plane = 0; plane < (planar ? frame->channels : 1); plane++)
+            av_hash_update(hash, frame->extended_data[plane], size);
+    }
+}
+
+static void decode_summary(StreamSummary *summary, AVPacket *pkt, AVFrame *frame)
+{
+    int ret = avcodec_send_packet(summary->dec, pkt);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending a packet for decoding: %s\n", av_err2str(ret));
+        exit(1);
+    }
+    while (1) {
+        ret = avcodec_receive_frame(summary->dec, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return;
+        if (ret < 0) {
+            fprintf(stderr, "Error during decoding: %s\n", av_err2str(ret));
+            exit(1);
+        }
+        summary->frames++;
+        summary->samples += frame->nb_samples;
+        hash_frame(summary->frame_hash, frame);
+        av_frame_unref(frame);
+    }
+}
+
+static void hash_file(const char *filename, char *hex, int hex_size)
+{
+    struct AVHashContext *hash;
+    uint8_t buf[65536];
+    size_t n;
+    FILE *f = fopen(filename, "rb");
+    if (!f || av_hash_alloc(&hash, HASH_NAME) < 0) {
+        fprintf(stderr, "Could not hash '%s'\n", filename);
+        exit(1);
+    }
+    av_hash_init(hash);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        av_hash_update(hash, buf, n);
+    av_hash_final_hex(hash, (uint8_t *) hex, hex_size);
+    av_hash_freep(&hash);
+    fclose(f);
+}
+
+/* Demux and decode filename and write what was found to <filename>.json. */
+static void write_manifest(const char *filename, const char *name, const CorpusSpec *spec)
+{
+    AVFormatContext *ic = NULL;
+    StreamSummary *summaries;
+    AVPacket pkt = { 0 };
+    AVFrame *frame = av_frame_alloc();
+    char path[MAX_PATH], hex[2 * AV_HASH_MAX_SIZE + 1];
+    FILE *out;
+    int64_t size;
+    unsigned i;
+    int ret;
+    if (!frame || (ret = avformat_open_input(&ic, filename, NULL, NULL)) < 0 ||
+        (ret = avformat_find_stream_info(ic, NULL)) < 0) {
+        fprintf(stderr, "Could not read back '%s'\n", filename);
+        exit(1);
+    }
+    summaries = av_mallocz_array(ic->nb_streams, sizeof(*summaries));
+    if (!summaries)
+        exit(1);
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+        summaries[i].dec = avcodec_alloc_context3(codec);
+        if (!codec || !summaries[i].dec ||
+            avcodec_parameters_to_context(summaries[i].dec, st->codecpar) < 0 ||
+            avcodec_open2(summaries[i].dec, codec, NULL) < 0 ||
+            av_hash_alloc(&summaries[i].packet_hash, HASH_NAME) < 0 ||
+            av_hash_alloc(&summaries[i].frame_hash, HASH_NAME) < 0) {
+            fprintf(stderr, "Could not open a decoder for stream %u of '%s'\n", i, filename);
+            exit(1);
+        }
+        summaries[i].dec->pkt_timebase = st->time_base;
+        av_hash_init(summaries[i].packet_hash);
+        av_hash_init(summaries[i].frame_hash);
+    }
+    while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+        StreamSummary *summary = &summaries[pkt.stream_index];
+        summary->packets++;
+        summary->keyframes += !!(pkt.flags & AV_PKT_FLAG_KEY);
+        av_hash_update(summary->packet_hash, pkt.data, pkt.size);
+        decode_summary(summary, &pkt, frame);
+        av_packet_unref(&pkt);
+    }
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Error reading '%s': %s\n", filename, av_err2str(ret));
+        exit(1);
+    }
+    snprintf(path, sizeof(path), "%s.json", filename);
+    out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open '%s'\n", path);
+        exit(1);
+    }
+    size = avio_size(ic->pb);
+    hash_file(filename, hex, sizeof(hex));
+    fprintf(out, "{\n  \"file\": \"%s\",\n  \"format\": \"%s\",\n  \"size\": %"PRId64",\n"
+                 "  \"duration\": %.6f,\n  \"%s\": \"%s\",\n",
+            name, ic->iformat->name, size, ic->duration / (double) AV_TIME_BASE, HASH_NAME, hex);
+    fprintf(out, "  \"params\": {\"width\": %d, \"height\": %d, \"fps\": %d, \"gop\": %d, \"b_frames\": %d, "
+                 "\"video_codec\": \"%s\", \"audio_codec\": \"%s\", \"channels\": %d, \"duration\": %g, "
+                 "\"threads\": %d},\n  \"streams\": [",
+            spec->width, spec->height, spec->fps, spec->gop, spec->b_frames,
+            spec->video_codec ? spec->video_codec : "default", spec->audio_codec ? spec->audio_codec : "default",
+            spec->channels, spec->duration, spec->threads);
+    for (i = 0; i < ic->nb_streams; i++) {
+        StreamSummary *summary = &summaries[i];
+        enum AVMediaType type = ic->streams[i]->codecpar->codec_type;
+        /* drain the decoder */
+        decode_summary(summary, NULL, frame);
+        fprintf(out, "%s\n    {\"index\": %u, \"type\": \"%s\", \"codec\": \"%s\", \"packets\": %"PRId64
+                     ", \"keyframes\": %"PRId64", \"frames\": %"PRId64,
+                i ? "," : "", i, av_get_media_type_string(type),
+                avcodec_get_name(ic->streams[i]->codecpar->codec_id),
+                summary->packets, summary->keyframes, summary->frames);
+        if (type == AVMEDIA_TYPE_AUDIO)
+            fprintf(out, ", \"samples\": %"PRId64, summary->samples);
+        av_hash_final_hex(summary->packet_hash, (uint8_t *) hex, sizeof(hex));
+        fprintf(out, ", \"packet_%s\": \"%s\"", HASH_NAME, hex);
+        av_hash_final_hex(summary->frame_hash, (uint8_t *) hex, sizeof(hex));
+        fprintf(out, ", \"frame_%s\": \"%s\"}", HASH_NAME, hex);
+        avcodec_free_context(&summary->dec);
+        av_hash_freep(&summary->packet_hash);
+        av_hash_freep(&summary->frame_hash);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    av_free(summaries);
+    av_frame_free(&frame);
+    avformat_close_input(&ic);
+}
+/* <video encoder>_<W>x<H>_<fps>fps_g<gop>_bf<b>_<channels>ch_<t>s.<ext> */
+static void spec_name(char *name, int size, const CorpusSpec *spec)
+{
+    AVOutputFormat *fmt;
+    char probe[64];
+    const char *video = spec->video_codec;
+    snprintf(probe, sizeof(probe), "probe.%s", spec->format);
+    fmt = av_guess_format(NULL, probe, NULL);
+    if (!fmt) {
+        fprintf(stderr, "Unknown container '%s'\n", spec->format);
+        exit(1);
+    }
+    if (!video)
+        video = avcodec_get_name(fmt->video_codec);
+    snprintf(name, size, "%s_%dx%d_%dfps_g%d_bf%d_%dch_%gs.%s", video, spec->width, spec->height,
+             spec->fps, spec->gop, spec->b_frames,
+             fmt->audio_codec != AV_CODEC_ID_NONE || spec->audio_codec ? spec->channels : 0,
+             spec->duration, spec->format);
+}
+int main(int argc, char **argv)
+{
+    const char *dir;
+    char **specs;
+    int nb_specs, i;
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s output_dir [spec ...]\n"
+                        "spec: s=WxH,r=fps,g=gop,bf=b_frames,c:v=encoder,c:a=encoder,ac=channels,"
+                        "t=seconds,f=extension,threads=n\n"
+                        "Without a spec the default corpus is written.\n", argv[0]);
+        return 1;
+    }
+    dir = argv[1];
+    if (argc > 2) {
+        specs = argv + 2;
+        nb_specs = argc - 2;
+    } else {
+        specs = (char **) default_specs;
+        nb_specs = FF_ARRAY_ELEMS(default_specs);
+    }
+    for (i = 0; i < nb_specs; i++) {
+        CorpusSpec spec;
+        char *str = av_strdup(specs[i]);
+        char name[256], filename[MAX_PATH];
+        int64_t start;
+        if (!str || parse_spec(&spec, str) < 0) {
+            fprintf(stderr, "Invalid spec '%s'\n", specs[i]);
+            return 1;
+        }
+        spec_name(name, sizeof(name), &spec);
+        snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+        start = av_gettime_relative();
+        generate(filename, &spec);
+        write_manifest(filename, name, &spec);
+        fprintf(stderr, "%s: %.3fs\n", name, (av_gettime_relative() - start) / 1e6);
+        /* the codec names of the spec point into str */
+        av_free(str);
+    }
+    return 0;
+}
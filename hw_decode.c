@@ -29,8 +29,19 @@
  * @example hw_decode.c
  * This example shows how to do HW-accelerated decoding with output
  * frames from the HW video surfaces.
+ *
+ * With the device type "sw" the same tool decodes on the CPU only, which
+ * makes it usable as a decode throughput baseline on hosts without a GPU.
+ * In both cases the decoded frames are reused between iterations, the raw
+ * output is copied into buffers from an AVBufferPool, and a writer thread
+ * batches them into writev() calls. The decode rate is printed at the end.
  */
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/pixdesc.h>
@@ -38,9 +49,20 @@
 #include <libavutil/opt.h>
 #include <libavutil/avassert.h>
 #include <libavutil/imgutils.h>
+#define WRITE_QUEUE_SIZE 32
+#define WRITE_BATCH_SIZE (4 << 20)
 static AVBufferRef *hw_device_ctx = NULL;
-static enum AVPixelFormat hw_pix_fmt;
+static enum AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
 static FILE *output_file = NULL;
+static AVFrame *frame = NULL, *sw_frame = NULL;
+static AVBufferPool *buffer_pool = NULL;
+static int pool_buffer_size;
+static int64_t nb_frames;
+/* raw frames waiting for the writer thread */
+static AVBufferRef *write_queue[WRITE_QUEUE_SIZE];
+static int write_head, write_count, write_eof, write_error;
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
 static int hw_decoder_init(AVCodecContext *ctx, const enum AVHWDeviceType type)
 {
     int err = 0;
@@ -63,11 +85,89 @@ static enum AVPixelFormat get_hw_format(AVCodecContext *ctx,
     fprintf(stderr, "Failed to get HW surface format.\n");
     return AV_PIX_FMT_NONE;
 }
+/* Hand a filled buffer to the writer thread; blocks while the queue is full. */
+static int queue_write(AVBufferRef *buf)
+{
+    int ret;
+    pthread_mutex_lock(&write_mutex);
+    while (write_count == WRITE_QUEUE_SIZE && !write_error)
+        pthread_cond_wait(&write_cond, &write_mutex);
+    ret = write_error;
+    if (!ret) {
+        write_queue[(write_head + write_count) % WRITE_QUEUE_SIZE] = buf;
+        write_count++;
+        pthread_cond_broadcast(&write_cond);
+    } else {
+        av_buffer_unref(&buf);
+    }
+    pthread_mutex_unlock(&write_mutex);
+    return ret;
+}
+static int write_all(int fd, struct iovec *iov, int nb_iov)
+{
+    while (nb_iov > 0) {
+        ssize_t n = writev(fd, iov, nb_iov);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        while (nb_iov > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            nb_iov--;
+        }
+        if (nb_iov > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+/* Drain the queue in batches of up to WRITE_BATCH_SIZE bytes, one writev() per batch. */
+static void *writer_thread(void *arg)
+{
+    int fd = fileno(output_file);
+    AVBufferRef *batch[WRITE_QUEUE_SIZE];
+    struct iovec iov[WRITE_QUEUE_SIZE];
+    int i, n, ret;
+    for (;;) {
+        size_t bytes = 0;
+        pthread_mutex_lock(&write_mutex);
+        while (!write_count && !write_eof)
+            pthread_cond_wait(&write_cond, &write_mutex);
+        if (!write_count) {
+            pthread_mutex_unlock(&write_mutex);
+            break;
+        }
+        for (n = 0; write_count && bytes < WRITE_BATCH_SIZE; n++) {
+            batch[n] = write_queue[write_head];
+            write_head = (write_head + 1) % WRITE_QUEUE_SIZE;
+            write_count--;
+            iov[n].iov_base = batch[n]->data;
+            iov[n].iov_len = batch[n]->size;
+            bytes += batch[n]->size;
+        }
+        pthread_cond_broadcast(&write_cond);
+        pthread_mutex_unlock(&write_mutex);
+        ret = write_all(fd, iov, n);
+        for (i = 0; i < n; i++)
+            av_buffer_unref(&batch[i]);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to dump raw data.\n");
+            pthread_mutex_lock(&write_mutex);
+            write_error = ret;
+            pthread_cond_broadcast(&write_cond);
+            pthread_mutex_unlock(&write_mutex);
+            break;
+        }
+    }
+    return NULL;
+}
 static int decode_write(AVCodecContext *avctx, AVPacket *packet)
 {
-    AVFrame *frame = NULL, *sw_frame = NULL;
     AVFrame *tmp_frame = NULL;
-    uint8_t *buffer = NULL;
+    AVBufferRef *buffer = NULL;
     int size;
     int ret = 0;
     ret = avcodec_send_packet(avctx, packet);
@@ -76,15 +176,8 @@ static int decode_write(AVCodecContext *avctx, AVPacket *packet)
         return ret;
     }
     while (1) {
-        if (!(frame = av_frame_alloc()) || !(sw_frame = av_frame_alloc())) {
-            fprintf(stderr, "Can not alloc frame\n");
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
         ret = avcodec_receive_frame(avctx, frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            av_frame_free(&frame);
-            av_frame_free(&sw_frame);
             return 0;
         } else if (ret < 0) {
             fprintf(stderr, "Error while decoding\n");
@@ -101,32 +194,42 @@ static int decode_write(AVCodecContext *avctx, AVPacket *packet)
             tmp_frame = frame;
         size = av_image_get_buffer_size(tmp_frame->format, tmp_frame->width,
                                         tmp_frame->height, 1);
-        buffer = av_malloc(size);
+        /* the pool only hands out buffers of one size, start a new one when the frame size changes */
+        if (size != pool_buffer_size) {
+            av_buffer_pool_uninit(&buffer_pool);
+            buffer_pool = av_buffer_pool_init(size, NULL);
+            pool_buffer_size = size;
+        }
+        buffer = buffer_pool ? av_buffer_pool_get(buffer_pool) : NULL;
         if (!buffer) {
             fprintf(stderr, "Can not alloc buffer\n");
             ret = AVERROR(ENOMEM);
             goto fail;
         }
-        ret = av_image_copy_to_buffer(buffer, size,
+        ret = av_image_copy_to_buffer(buffer->data, size,
                                       (const uint8_t * const *)tmp_frame->data,
                                       (const int *)tmp_frame->linesize, tmp_frame->format,
                                       tmp_frame->width, tmp_frame->height, 1);
         if (ret < 0) {
             fprintf(stderr, "Can not copy image to buffer\n");
+            av_buffer_unref(&buffer);
             goto fail;
         }
-        if ((ret = fwrite(buffer, 1, size, output_file)) < 0) {
-            fprintf(stderr, "Failed to dump raw data.\n");
-            goto fail;
-        }
+        ret = queue_write(buffer);
+        nb_frames++;
         fail:
-        av_frame_free(&frame);
-        av_frame_free(&sw_frame);
-        av_freep(&buffer);
+        av_frame_unref(frame);
+        av_frame_unref(sw_frame);
         if (ret < 0)
             return ret;
     }
 }
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 int main(int argc, char *argv[])
 {
     AVFormatContext *input_ctx = NULL;
@@ -135,14 +238,18 @@ int main(int argc, char *argv[])
     AVCodecContext *decoder_ctx = NULL;
     AVCodec *decoder = NULL;
     AVPacket packet;
-    enum AVHWDeviceType type;
-    int i;
+    enum AVHWDeviceType type = AV_HWDEVICE_TYPE_NONE;
+    pthread_t writer;
+    double start, elapsed;
+    int i, software;
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <device type> <input file> <output file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <device type|sw> <input file> <output file>\n", argv[0]);
         return -1;
     }
-    type = av_hwdevice_find_type_by_name(argv[1]);
-    if (type == AV_HWDEVICE_TYPE_NONE) {
+    software = !strcmp(argv[1], "sw");
+    if (!software)
+        type = av_hwdevice_find_type_by_name(argv[1]);
+    if (!software && type == AV_HWDEVICE_TYPE_NONE) {
         fprintf(stderr, "Device type %s is not supported.\n", argv[1]);
         fprintf(stderr, "Available device types:");
         while((type = av_hwdevice_iterate_types(type)) != AV_HWDEVICE_TYPE_NONE)
@@ -166,7 +273,7 @@ int main(int argc, char *argv[])
         return -1;
     }
     video_stream = ret;
-    for (i = 0;; i++) {
+    for (i = 0; !software; i++) {
         const AVCodecHWConfig *config = avcodec_get_hw_config(decoder, i);
         if (!config) {
             fprintf(stderr, "Decoder %s does not support device type %s.\n",
@@ -184,15 +291,32 @@ int main(int argc, char *argv[])
     video = input_ctx->streams[video_stream];
     if (avcodec_parameters_to_context(decoder_ctx, video->codecpar) < 0)
         return -1;
-    decoder_ctx->get_format  = get_hw_format;
-    if (hw_decoder_init(decoder_ctx, type) < 0)
-        return -1;
+    if (software) {
+        decoder_ctx->thread_count = 0;
+    } else {
+        decoder_ctx->get_format  = get_hw_format;
+        if (hw_decoder_init(decoder_ctx, type) < 0)
+            return -1;
+    }
     if ((ret = avcodec_open2(decoder_ctx, decoder, NULL)) < 0) {
         fprintf(stderr, "Failed to open codec for stream #%u\n", video_stream);
         return -1;
     }
     /* open the file to dump raw data */
     output_file = fopen(argv[3], "w+b");
+    if (!output_file) {
+        fprintf(stderr, "Could not open destination file %s\n", argv[3]);
+        return -1;
+    }
+    if (!(frame = av_frame_alloc()) || !(sw_frame = av_frame_alloc())) {
+        fprintf(stderr, "Can not alloc frame\n");
+        return -1;
+    }
+    if (pthread_create(&writer, NULL, writer_thread, NULL)) {
+        fprintf(stderr, "Can not create writer thread\n");
+        return -1;
+    }
+    start = now_seconds();
     /* actual decoding and dump the raw data */
     while (ret >= 0) {
         if ((ret = av_read_frame(input_ctx, &packet)) < 0)
@@ -206,6 +330,18 @@ int main(int argc, char *argv[])
     packet.size = 0;
     ret = decode_write(decoder_ctx, &packet);
     av_packet_unref(&packet);
+    pthread_mutex_lock(&write_mutex);
+    write_eof = 1;
+    pthread_cond_broadcast(&write_cond);
+    pthread_mutex_unlock(&write_mutex);
+    pthread_join(writer, NULL);
+    elapsed = now_seconds() - start;
+    fprintf(stderr, "%s decode: %"PRId64" frames in %.3fs, %.1f fps\n",
+            software ? "software" : av_hwdevice_get_type_name(type),
+            nb_frames, elapsed, nb_frames / elapsed);
+    av_frame_free(&frame);
+    av_frame_free(&sw_frame);
+    av_buffer_pool_uninit(&buffer_pool);
     if (output_file)
         fclose(output_file);
     avcodec_free_context(&decoder_ctx);
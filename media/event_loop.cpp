@@ -0,0 +1,260 @@
+//
+// EventLoop, see event_loop.h. epoll and eventfd on Linux, poll and a pipe elsewhere.
+//
+
+#include "event_loop.h"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+namespace media {
+
+// timers with the same deadline run in the order they were scheduled
+bool EventLoop::later(const Timer &a, const Timer &b) {
+    return a.deadline > b.deadline || (a.deadline == b.deadline && a.id > b.id);
+}
+
+EventLoop::EventLoop() : head(new Node()), wakePending(false), nextTimerId(1), running(false), wakeupCount(0),
+                         pollFd(-1), wakeFd(-1), wakeWriteFd(-1) {
+    head.load()->next.store(nullptr);
+    tail = head.load();
+#ifdef __linux__
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    auto fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (pollFd < 0 || fd < 0 || epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    wakeFd = fd;
+    wakeWriteFd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) < 0)
+        return;
+    for (auto fd : fds)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    wakeFd = fds[0];
+    wakeWriteFd = fds[1];
+#endif
+}
+
+EventLoop::~EventLoop() {
+    while (tail != nullptr) {
+        auto next = tail->next.load();
+        delete tail;
+        tail = next;
+    }
+    if (wakeWriteFd >= 0 && wakeWriteFd != wakeFd)
+        close(wakeWriteFd);
+    if (wakeFd >= 0)
+        close(wakeFd);
+    if (pollFd >= 0)
+        close(pollFd);
+}
+
+void EventLoop::push(Node *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto prev = head.exchange(node, std::memory_order_acq_rel);
+    // until this store run() sees the queue end at prev, wakeUp() comes after it
+    prev->next.store(node, std::memory_order_release);
+}
+
+void EventLoop::post(Task task) {
+    auto node = new Node();
+    node->task = std::move(task);
+    push(node);
+    wakeUp();
+}
+
+EventLoop::TimerId EventLoop::schedule(int64_t delay, Task task) {
+    auto id = nextTimerId++;
+    auto deadline = av_gettime_relative() + delay;
+    // the heap belongs to the loop thread, the deadline is taken here so the hand-over does not delay it
+    auto shared = std::make_shared<Task>(std::move(task));
+    post([this, deadline, id, shared] {
+        timers.push_back(Timer{deadline, id, std::move(*shared)});
+        std::push_heap(timers.begin(), timers.end(), later);
+    });
+    return id;
+}
+
+void EventLoop::cancel(TimerId id) {
+    post([this, id] {
+        auto it = std::find_if(timers.begin(), timers.end(), [id](const Timer &timer) { return timer.id == id; });
+        if (it == timers.end())
+            return;
+        *it = std::move(timers.back());
+        timers.pop_back();
+        std::make_heap(timers.begin(), timers.end(), later);
+    });
+}
+
+void EventLoop::watch(int fd, int events, WatchCallback callback) {
+    post([this, fd, events, callback] {
+        auto &entry = watches[fd];
+        entry.events = events;
+        entry.callback = callback;
+        entry.alwaysReady = false;
+#ifdef __linux__
+        epoll_event event = {};
+        event.events = (events & Readable ? EPOLLIN : 0) | (events & Writable ? EPOLLOUT : 0);
+        event.data.fd = fd;
+        if (epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            if (errno == EEXIST)
+                epoll_ctl(pollFd, EPOLL_CTL_MOD, fd, &event);
+            else if (errno == EPERM)
+                entry.alwaysReady = true;
+        }
+#endif
+    });
+}
+
+void EventLoop::unwatch(int fd) {
+    post([this, fd] {
+        if (watches.erase(fd) == 0)
+            return;
+#ifdef __linux__
+        epoll_ctl(pollFd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    });
+}
+
+void EventLoop::stop() {
+    post([this] { running = false; });
+}
+
+void EventLoop::wakeUp() {
+    // one write per sleep is enough, run() clears the flag before it drains the queue
+    if (wakePending.exchange(true))
+        return;
+    uint64_t one = 1;
+    auto ret = write(wakeWriteFd, &one, sizeof(one));
+    (void) ret;
+}
+
+void EventLoop::drainWakeFd() {
+    uint64_t buf[8];
+    while (read(wakeFd, buf, sizeof(buf)) > 0) {
+    }
+    wakePending.store(false);
+}
+
+bool EventLoop::runPosted() {
+    // only what was posted so far, a task that posts itself again runs on the next round
+    auto last = head.load(std::memory_order_acquire);
+    auto ran = false;
+    while (running && tail != last) {
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            break;
+        auto task = std::move(next->task);
+        next->task = nullptr;
+        delete tail;
+        tail = next;
+        task();
+        ran = true;
+    }
+    return ran;
+}
+
+void EventLoop::runTimers() {
+    auto now = av_gettime_relative();
+    while (running && !timers.empty() && timers.front().deadline <= now) {
+        std::pop_heap(timers.begin(), timers.end(), later);
+        auto task = std::move(timers.back().task);
+        timers.pop_back();
+        task();
+    }
+}
+
+int EventLoop::nextTimeout() const {
+    if (timers.empty())
+        return -1;
+    auto delay = timers.front().deadline - av_gettime_relative();
+    if (delay <= 0)
+        return 0;
+    return static_cast<int>(std::min<int64_t>((delay + 999) / 1000, INT_MAX));
+}
+
+void EventLoop::wait(int timeout) {
+    std::vector<std::pair<int, int>> ready;
+    for (auto &entry : watches) {
+        if (entry.second.alwaysReady) {
+            ready.emplace_back(entry.first, entry.second.events & (Readable | Writable));
+            timeout = 0;
+        }
+    }
+#ifdef __linux__
+    epoll_event events[32];
+    auto n = epoll_wait(pollFd, events, 32, timeout);
+    wakeupCount++;
+    for (int i = 0; i < n; i++) {
+        auto fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            drainWakeFd();
+            continue;
+        }
+        ready.emplace_back(fd, (events[i].events & EPOLLIN ? Readable : 0) |
+                               (events[i].events & EPOLLOUT ? Writable : 0) |
+                               (events[i].events & (EPOLLERR | EPOLLHUP) ? Error : 0));
+    }
+#else
+    std::vector<pollfd> fds;
+    fds.push_back(pollfd{wakeFd, POLLIN, 0});
+    for (auto &entry : watches) {
+        if (!entry.second.alwaysReady)
+            fds.push_back(pollfd{entry.first, static_cast<short>((entry.second.events & Readable ? POLLIN : 0) |
+                                                                  (entry.second.events & Writable ? POLLOUT : 0)), 0});
+    }
+    auto n = poll(fds.data(), fds.size(), timeout);
+    wakeupCount++;
+    if (n > 0 && fds[0].revents)
+        drainWakeFd();
+    for (size_t i = 1; n > 0 && i < fds.size(); i++) {
+        if (fds[i].revents)
+            ready.emplace_back(fds[i].fd, (fds[i].revents & POLLIN ? Readable : 0) |
+                                          (fds[i].revents & POLLOUT ? Writable : 0) |
+                                          (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL) ? Error : 0));
+    }
+#endif
+    for (auto &fd : ready) {
+        auto it = watches.find(fd.first);
+        if (!running || it == watches.end())
+            continue;
+        // the callback may unwatch its own fd
+        auto callback = it->second.callback;
+        callback(fd.second);
+    }
+}
+
+void EventLoop::run() {
+    running = true;
+    while (running) {
+        runPosted();
+        runTimers();
+        if (!running)
+            break;
+        wait(tail->next.load(std::memory_order_acquire) ? 0 : nextTimeout());
+    }
+}
+
+}
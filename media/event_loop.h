@@ -0,0 +1,122 @@
+//
+// A single threaded task loop: immediate tasks from any thread, timers and fd watches,
+// all dispatched on the thread that calls run(). The same idea as pushing function
+// pointers through SDL_PushEvent in sdl_timer.cpp, without SDL and without a timer thread.
+//
+
+#ifndef LEARNFFMPEG_EVENT_LOOP_H
+#define LEARNFFMPEG_EVENT_LOOP_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace media {
+
+class EventLoop {
+public:
+    using Task = std::function<void()>;
+    // called with the Readable/Writable bits that are ready, Error when the fd hung up or failed
+    using WatchCallback = std::function<void(int events)>;
+    using TimerId = uint64_t;
+
+    enum {
+        Readable = 1,
+        Writable = 2,
+        Error = 4,
+    };
+
+    EventLoop();
+
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // false when the epoll/eventfd (or poll/pipe) setup failed in the constructor
+    bool valid() const { return wakeFd >= 0; }
+
+    // Run task on the loop thread. Lock free, may be called from any thread, including from a task.
+    void post(Task task);
+
+    // Run task once delay microseconds have passed. Any thread.
+    TimerId schedule(int64_t delay, Task task);
+
+    // A timer that already ran or was cancelled is ignored. Any thread.
+    void cancel(TimerId id);
+
+    // Call callback on the loop thread whenever fd is ready for events. Any thread, one watch per fd.
+    void watch(int fd, int events, WatchCallback callback);
+
+    void unwatch(int fd);
+
+    // Dispatch until stop(). Blocks in epoll_wait() while there is nothing to do.
+    void run();
+
+    // Make run() return after the task that is running. Any thread.
+    void stop();
+
+    // times run() woke up from epoll_wait(), to check that an idle loop really sleeps
+    int64_t wakeups() const { return wakeupCount.load(); }
+
+private:
+    struct Node {
+        std::atomic<Node *> next;
+        Task task;
+    };
+
+    struct Timer {
+        int64_t deadline;
+        TimerId id;
+        Task task;
+    };
+
+    struct Watch {
+        int events;
+        WatchCallback callback;
+        // regular files cannot be added to epoll, they are always ready
+        bool alwaysReady;
+    };
+
+    // the std::push_heap/pop_heap ordering that keeps the earliest deadline at the front
+    static bool later(const Timer &a, const Timer &b);
+
+    void push(Node *node);
+
+    bool runPosted();
+
+    void runTimers();
+
+    // milliseconds until the first timer, -1 without timers
+    int nextTimeout() const;
+
+    void wait(int timeout);
+
+    void wakeUp();
+
+    void drainWakeFd();
+
+    // Vyukov's intrusive MPSC queue: producers swap head, only run() reads from tail.
+    std::atomic<Node *> head;
+    Node *tail;
+    std::atomic<bool> wakePending;
+    std::atomic<TimerId> nextTimerId;
+
+    // owned by the loop thread, timers is a heap ordered by later()
+    std::vector<Timer> timers;
+    std::unordered_map<int, Watch> watches;
+    bool running;
+    std::atomic<int64_t> wakeupCount;
+
+    int pollFd;
+    int wakeFd;
+    // the write end of the wake pipe where there is no eventfd
+    int wakeWriteFd;
+};
+
+}
+
+#endif //LEARNFFMPEG_EVENT_LOOP_H
@@ -0,0 +1,161 @@
+//
+// Non-template parts of the media library, see media.h.
+//
+
+#include "media.h"
+
+extern "C" {
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+#include <libavutil/time.h>
+}
+
+namespace media {
+
+std::string errorString(int errCode) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_make_error_string(buf, AV_ERROR_MAX_STRING_SIZE, errCode);
+    return buf;
+}
+
+void fastStartOptions(AVDictionary **options) {
+    av_dict_set_int(options, "probesize", FAST_START_PROBE_SIZE, 0);
+    av_dict_set_int(options, "analyzeduration", FAST_START_ANALYZE_DURATION, 0);
+}
+
+int InputFormat::open(const std::string &url, AVDictionary **options, bool findStreamInfo) {
+    avformat_close_input(&context);
+    auto ret = avformat_open_input(&context, url.c_str(), nullptr, options);
+    if (ret < 0)
+        return ret;
+    if (findStreamInfo) {
+        ret = avformat_find_stream_info(context, nullptr);
+        if (ret < 0)
+            avformat_close_input(&context);
+    }
+    return ret;
+}
+
+int InputFormat::findBestStream(AVMediaType type) const {
+    return av_find_best_stream(context, type, -1, -1, nullptr, 0);
+}
+
+int CodecContext::openDecoder(const AVStream *stream, int threads, AVDictionary **options) {
+    return openDecoder(stream->codecpar, stream->time_base, threads, options);
+}
+
+int CodecContext::openDecoder(const AVCodecParameters *parameters, AVRational timeBase, int threads,
+                              AVDictionary **options) {
+    auto codec = avcodec_find_decoder(parameters->codec_id);
+    if (codec == nullptr)
+        return AVERROR_DECODER_NOT_FOUND;
+    avcodec_free_context(&context);
+    context = avcodec_alloc_context3(codec);
+    if (context == nullptr)
+        return AVERROR(ENOMEM);
+    auto ret = avcodec_parameters_to_context(context, parameters);
+    if (ret < 0)
+        return ret;
+    context->pkt_timebase = timeBase;
+    context->thread_count = threads;
+    return avcodec_open2(context, codec, options);
+}
+
+int CodecContext::openDecoder(const AVCodec *codec, AVDictionary **options) {
+    avcodec_free_context(&context);
+    context = avcodec_alloc_context3(codec);
+    if (context == nullptr)
+        return AVERROR(ENOMEM);
+    return avcodec_open2(context, codec, options);
+}
+
+int VideoFilterGraph::configure(const AVFrame *frame, AVRational timeBase, const std::string &description,
+                                int threads) {
+    const AVFilter *bufferFilter = avfilter_get_by_name("buffer");
+    const AVFilter *bufferSinkFilter = avfilter_get_by_name("buffersink");
+    AVFilterContext *bufferSrcFilterCtx = nullptr;
+    AVFilterContext *bufferSinkFilterCtx = nullptr;
+    AVFilterInOut *inputs = avfilter_inout_alloc();
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    auto newGraph = avfilter_graph_alloc();
+    char args[512];
+    int ret;
+    if (inputs == nullptr || outputs == nullptr || newGraph == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    newGraph->nb_threads = threads;
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             frame->width,
+             frame->height,
+             frame->format,
+             timeBase.num,
+             timeBase.den,
+             frame->sample_aspect_ratio.num,
+             frame->sample_aspect_ratio.den ? frame->sample_aspect_ratio.den : 1);
+    ret = avfilter_graph_create_filter(&bufferSrcFilterCtx, bufferFilter, "in", args, nullptr, newGraph);
+    if (ret < 0)
+        goto end;
+    ret = avfilter_graph_create_filter(&bufferSinkFilterCtx, bufferSinkFilter, "out", "", nullptr, newGraph);
+    if (ret < 0)
+        goto end;
+
+    outputs->filter_ctx = bufferSrcFilterCtx;
+    outputs->name = av_strdup("in");
+    outputs->next = nullptr;
+    outputs->pad_idx = 0;
+
+    inputs->filter_ctx = bufferSinkFilterCtx;
+    inputs->name = av_strdup("out");
+    inputs->next = nullptr;
+    inputs->pad_idx = 0;
+
+    ret = avfilter_graph_parse_ptr(newGraph, description.c_str(), &inputs, &outputs, nullptr);
+    if (ret < 0)
+        goto end;
+    ret = avfilter_graph_config(newGraph, nullptr);
+    if (ret < 0)
+        goto end;
+    avfilter_graph_free(&graph);
+    graph = newGraph;
+    newGraph = nullptr;
+    bufferSrc = bufferSrcFilterCtx;
+    bufferSink = bufferSinkFilterCtx;
+    currentDescription = description;
+    width = frame->width;
+    height = frame->height;
+    format = frame->format;
+    sar = frame->sample_aspect_ratio;
+    end:
+    avfilter_graph_free(&newGraph);
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    return ret;
+}
+
+bool VideoFilterGraph::matches(const AVFrame *frame) const {
+    return graph != nullptr &&
+           frame->width == width &&
+           frame->height == height &&
+           frame->format == format &&
+           av_cmp_q(frame->sample_aspect_ratio, sar) == 0;
+}
+
+int VideoFilterGraph::push(Frame *frame) {
+    auto start = av_gettime_relative();
+    auto ret = frame ? av_buffersrc_add_frame_flags(bufferSrc, frame->get(), AV_BUFFERSRC_FLAG_KEEP_REF)
+                     : av_buffersrc_add_frame(bufferSrc, nullptr);
+    filterTime += av_gettime_relative() - start;
+    return ret;
+}
+
+int VideoFilterGraph::pull(Frame &frame) {
+    auto start = av_gettime_relative();
+    auto ret = av_buffersink_get_frame(bufferSink, frame.get());
+    filterTime += av_gettime_relative() - start;
+    if (ret >= 0)
+        filteredFrames++;
+    return ret;
+}
+
+}
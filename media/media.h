@@ -0,0 +1,343 @@
+//
+// Shared building blocks for the C++ tools: RAII owners for the libav* objects,
+// the stage interfaces a playback or transcode pipeline is made of, and the
+// bounded queue that connects two stages running on different threads.
+//
+
+#ifndef LEARNFFMPEG_MEDIA_H
+#define LEARNFFMPEG_MEDIA_H
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavutil/avutil.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// a fast start probes at most this many bytes and microseconds of input, the defaults are 5 MB and 5 s
+#define FAST_START_PROBE_SIZE 32768
+#define FAST_START_ANALYZE_DURATION 100000
+
+namespace media {
+
+std::string errorString(int errCode);
+
+/**
+ * Put probesize and analyzeduration into options for InputFormat::open(), so that probing the
+ * format and avformat_find_stream_info() stop after FAST_START_PROBE_SIZE bytes or
+ * FAST_START_ANALYZE_DURATION. Parameters the probe leaves unset, e.g. the sample format of an
+ * audio stream it saw no packet of, have to be taken from the first decoded frame instead.
+ */
+void fastStartOptions(AVDictionary **options);
+
+class Packet {
+public:
+    Packet() : packet(av_packet_alloc()) {}
+
+    ~Packet() { av_packet_free(&packet); }
+
+    Packet(Packet &&other) noexcept : packet(other.packet) { other.packet = nullptr; }
+
+    Packet &operator=(Packet &&other) noexcept {
+        std::swap(packet, other.packet);
+        return *this;
+    }
+
+    Packet(const Packet &) = delete;
+
+    Packet &operator=(const Packet &) = delete;
+
+    // false when the allocation failed or the packet was moved from
+    explicit operator bool() const { return packet != nullptr; }
+
+    AVPacket *get() const { return packet; }
+
+    AVPacket *operator->() const { return packet; }
+
+    void unref() { av_packet_unref(packet); }
+
+    /**
+     * A packet without data, what avcodec_send_packet() takes as the request to drain.
+     * A producer puts one into a queue after the last packet of a stream, the consumer
+     * drains its decoder on it and passes the end on. A moved-from Packet holds no
+     * AVPacket at all and counts as one too.
+     */
+    bool isFlush() const { return packet == nullptr || (packet->data == nullptr && packet->side_data_elems == 0); }
+
+private:
+    AVPacket *packet;
+};
+
+class Frame {
+public:
+    Frame() : frame(av_frame_alloc()) {}
+
+    ~Frame() { av_frame_free(&frame); }
+
+    Frame(Frame &&other) noexcept : frame(other.frame) { other.frame = nullptr; }
+
+    Frame &operator=(Frame &&other) noexcept {
+        std::swap(frame, other.frame);
+        return *this;
+    }
+
+    Frame(const Frame &) = delete;
+
+    Frame &operator=(const Frame &) = delete;
+
+    explicit operator bool() const { return frame != nullptr; }
+
+    AVFrame *get() const { return frame; }
+
+    AVFrame *operator->() const { return frame; }
+
+    void unref() { av_frame_unref(frame); }
+
+private:
+    AVFrame *frame;
+};
+
+class InputFormat {
+public:
+    InputFormat() : context(nullptr) {}
+
+    ~InputFormat() { avformat_close_input(&context); }
+
+    InputFormat(const InputFormat &) = delete;
+
+    InputFormat &operator=(const InputFormat &) = delete;
+
+    int open(const std::string &url, AVDictionary **options = nullptr, bool findStreamInfo = true);
+
+    // the stream index or a negative error, see av_find_best_stream()
+    int findBestStream(AVMediaType type) const;
+
+    int read(Packet &packet) { return av_read_frame(context, packet.get()); }
+
+    AVStream *stream(int index) const { return context->streams[index]; }
+
+    AVFormatContext *get() const { return context; }
+
+    AVFormatContext *operator->() const { return context; }
+
+private:
+    AVFormatContext *context;
+};
+
+class CodecContext {
+public:
+    CodecContext() : context(nullptr) {}
+
+    ~CodecContext() { avcodec_free_context(&context); }
+
+    CodecContext(const CodecContext &) = delete;
+
+    CodecContext &operator=(const CodecContext &) = delete;
+
+    // a decoder for stream, threads 0 lets libavcodec decide
+    int openDecoder(const AVStream *stream, int threads = 0, AVDictionary **options = nullptr);
+
+    // a decoder for parameters that did not come from a demuxer
+    int openDecoder(const AVCodecParameters *parameters, AVRational timeBase, int threads = 0,
+                    AVDictionary **options = nullptr);
+
+    // a decoder without container parameters, e.g. for a parser fed elementary stream
+    int openDecoder(const AVCodec *codec, AVDictionary **options = nullptr);
+
+    AVCodecContext *get() const { return context; }
+
+    AVCodecContext *operator->() const { return context; }
+
+private:
+    AVCodecContext *context;
+};
+
+// send(nullptr) or a flush packet starts draining. receive() returns AVERROR(EAGAIN)
+// when it needs more input and AVERROR_EOF once drained.
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+
+    virtual int send(const Packet *packet) = 0;
+
+    virtual int receive(Frame &frame) = 0;
+};
+
+// Same contract as Decoder, with frames on both sides. push(nullptr) marks the end.
+class Filter {
+public:
+    virtual ~Filter() = default;
+
+    virtual int push(Frame *frame) = 0;
+
+    virtual int pull(Frame &frame) = 0;
+};
+
+class StreamDecoder : public Decoder {
+public:
+    int open(const AVStream *stream, int threads = 0) { return codec.openDecoder(stream, threads); }
+
+    int open(const AVCodecParameters *parameters, AVRational timeBase, int threads = 0) {
+        return codec.openDecoder(parameters, timeBase, threads);
+    }
+
+    int send(const Packet *packet) override {
+        return avcodec_send_packet(codec.get(), packet && !packet->isFlush() ? packet->get() : nullptr);
+    }
+
+    int receive(Frame &frame) override { return avcodec_receive_frame(codec.get(), frame.get()); }
+
+    AVCodecContext *context() const { return codec.get(); }
+
+private:
+    CodecContext codec;
+};
+
+// buffer -> description -> buffersink, rebuilt when the input frames change.
+class VideoFilterGraph : public Filter {
+public:
+    VideoFilterGraph() : graph(nullptr), bufferSrc(nullptr), bufferSink(nullptr), width(0), height(0),
+                         format(AV_PIX_FMT_NONE), sar(AVRational{0, 1}), filteredFrames(0), filterTime(0) {}
+
+    ~VideoFilterGraph() override { avfilter_graph_free(&graph); }
+
+    VideoFilterGraph(const VideoFilterGraph &) = delete;
+
+    VideoFilterGraph &operator=(const VideoFilterGraph &) = delete;
+
+    /**
+     * Build a graph for description whose buffersrc matches frame.
+     * The current graph is only replaced once the new one configured successfully.
+     */
+    int configure(const AVFrame *frame, AVRational timeBase, const std::string &description, int threads = 0);
+
+    // whether frame can go into the current graph without rebuilding it
+    bool matches(const AVFrame *frame) const;
+
+    bool configured() const { return graph != nullptr; }
+
+    int push(Frame *frame) override;
+
+    int pull(Frame &frame) override;
+
+    void reset() { avfilter_graph_free(&graph); }
+
+    AVFilterGraph *get() const { return graph; }
+
+    const std::string &description() const { return currentDescription; }
+
+    // frames pulled and time spent inside the graph in microseconds since the last resetStats()
+    int64_t frames() const { return filteredFrames; }
+
+    int64_t time() const { return filterTime; }
+
+    void resetStats() {
+        filteredFrames = 0;
+        filterTime = 0;
+    }
+
+private:
+    AVFilterGraph *graph;
+    AVFilterContext *bufferSrc;
+    AVFilterContext *bufferSink;
+    std::string currentDescription;
+    int width;
+    int height;
+    int format;
+    AVRational sar;
+    int64_t filteredFrames;
+    int64_t filterTime;
+};
+
+/**
+ * A FIFO between two threads holding at most capacity items. push() blocks while
+ * it is full and pop() while it is empty, until abort() wakes both sides for good.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), aborted(false) {}
+
+    BoundedQueue(const BoundedQueue &) = delete;
+
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // false once the queue was aborted, item is left untouched then
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return aborted || items.size() < capacity; });
+        if (aborted)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool tryPush(T &&item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (aborted || items.size() >= capacity)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // false once the queue was aborted
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return aborted || !items.empty(); });
+        if (aborted)
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    bool tryPop(T &item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (aborted || items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.clear();
+        notFull.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+
+private:
+    const size_t capacity;
+    bool aborted;
+    std::deque<T> items;
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+}
+
+#endif //LEARNFFMPEG_MEDIA_H
@@ -0,0 +1,83 @@
+//
+// ThreadPool, see thread_pool.h.
+//
+
+#include "thread_pool.h"
+
+namespace media {
+
+// the pool and the index of the worker running on this thread, to keep submit() local
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int threads) : pending(0), nextWorker(0), stealCount(0), stopping(false) {
+    if (threads < 1)
+        threads = 1;
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(new Worker());
+    for (int i = 0; i < threads; i++)
+        this->threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::submit(Task task) {
+    auto index = currentPool == this ? currentWorker : static_cast<int>(nextWorker++ % workers.size());
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::take(int index, Task &task) {
+    auto count = static_cast<int>(workers.size());
+    for (int i = 0; i < count; i++) {
+        auto &worker = *workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty())
+            continue;
+        if (i == 0) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        } else {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            stealCount++;
+        }
+        pending--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(int index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        // pending is counted before the task is in a deque, so this may come back once for nothing
+        wake.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+}
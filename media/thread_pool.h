@@ -0,0 +1,69 @@
+//
+// A fixed size work-stealing thread pool, shared by many pipelines so that the
+// number of threads does not grow with the number of pipelines.
+//
+
+#ifndef LEARNFFMPEG_THREAD_POOL_H
+#define LEARNFFMPEG_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace media {
+
+/**
+ * Every worker has its own deque. submit() from a worker appends to that worker's deque,
+ * from any other thread to the next deque round robin. Workers take from the front of
+ * their own deque, so tasks run first in first out, and steal from the back of the others
+ * before they go to sleep. Tasks still queued when the pool is destroyed are dropped.
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(int threads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task);
+
+    int size() const { return static_cast<int>(threads.size()); }
+
+    // tasks a worker took from another worker's deque
+    int64_t steals() const { return stealCount.load(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(int index);
+
+    bool take(int index, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    // queued tasks, changed under sleepMutex when it grows so that no wakeup is lost
+    std::atomic<int64_t> pending;
+    std::atomic<unsigned> nextWorker;
+    std::atomic<int64_t> stealCount;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+}
+
+#endif //LEARNFFMPEG_THREAD_POOL_H
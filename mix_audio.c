@@ -0,0 +1,366 @@
+/**
+ * @file
+ * N-input real-time audio mixer, built on the setup used by filter_audio.c.
+ *
+ * @example mix_audio.c
+ * This example synthesizes up to MAX_INPUTS "live" PCM sources, each with its
+ * own sample rate, sample format and channel layout, and mixes them into one
+ * 48 kHz stereo float stream.
+ *
+ * The per-input chain is:
+ * (source) -> swr (resample once) -> jitter buffer -> mixer -> (output)
+ *
+ * swr: Every input is converted exactly once, straight to the mix format, so
+ *      the mixer only ever sees interleaved float at the output rate.
+ * jitter buffer: An AVAudioFifo per input. Sources deliver bursty chunks
+ *      (nothing, one or two periods per tick); an input only starts playing
+ *      once JITTER_PREFILL periods are buffered, and anything above
+ *      JITTER_MAX periods is dropped, which bounds the latency of every input
+ *      to JITTER_MAX * PERIOD_SAMPLES.
+ * mixer: Sums all ready inputs into a float accumulator (SSE when available)
+ *        and clips the result once per period.
+ *
+ * The program runs the mixer for N = 1, 2, 4, ... max_inputs and reports the
+ * CPU time spent per input, together with the MD5 of the mixed output so runs
+ * can be compared.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define OUTPUT_SAMPLERATE     48000
+#define OUTPUT_FORMAT         AV_SAMPLE_FMT_FLT
+#define OUTPUT_CHANNEL_LAYOUT AV_CH_LAYOUT_STEREO
+#define OUTPUT_CHANNELS       2
+/* 10 ms mixing period */
+#define PERIOD_SAMPLES (OUTPUT_SAMPLERATE / 100)
+#define JITTER_PREFILL 2
+#define JITTER_MAX     8
+#define MAX_INPUTS     64
+
+typedef struct MixInput {
+    int sample_rate;
+    uint64_t channel_layout;
+    int channels;
+    enum AVSampleFormat sample_fmt;
+    /* most samples the source produces per mixing period, 220 or 221 at 22050 Hz */
+    int chunk_samples;
+    /* chunks produced so far, chunk n holds the samples from n / 100 s to (n + 1) / 100 s */
+    int64_t chunks;
+    double t, freq;
+    uint32_t seed;
+
+    struct SwrContext *swr;
+    AVAudioFifo *fifo;
+    uint8_t **src_data;
+    int src_linesize;
+    uint8_t **dst_data;
+    int dst_linesize;
+    int dst_max_samples;
+
+    int primed;
+    int64_t underruns;
+    int64_t dropped_samples;
+} MixInput;
+
+static const int input_rates[] = {8000, 16000, 22050, 32000, 44100, 48000};
+static const uint64_t input_layouts[] = {AV_CH_LAYOUT_MONO, AV_CH_LAYOUT_STEREO, AV_CH_LAYOUT_5POINT0};
+static const enum AVSampleFormat input_formats[] = {AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP};
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Deterministic burst pattern: 0, 1, 1 or 2 chunks per tick, 1 on average. */
+static int next_burst(MixInput *in) {
+    in->seed = in->seed * 1664525 + 1013904223;
+    switch ((in->seed >> 16) & 3) {
+        case 0:
+            return 0;
+        case 3:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static int init_input(MixInput *in, int index) {
+    int ret;
+    in->sample_rate = input_rates[index % FF_ARRAY_ELEMS(input_rates)];
+    in->channel_layout = input_layouts[index % FF_ARRAY_ELEMS(input_layouts)];
+    in->channels = av_get_channel_layout_nb_channels(in->channel_layout);
+    in->sample_fmt = input_formats[index % FF_ARRAY_ELEMS(input_formats)];
+    in->chunk_samples = (in->sample_rate + 99) / 100;
+    in->freq = 220.0 + 20.0 * index;
+    in->seed = index + 1;
+    in->swr = swr_alloc_set_opts(NULL,
+                                 OUTPUT_CHANNEL_LAYOUT, OUTPUT_FORMAT, OUTPUT_SAMPLERATE,
+                                 in->channel_layout, in->sample_fmt, in->sample_rate,
+                                 0, NULL);
+    if (!in->swr) {
+        fprintf(stderr, "Could not allocate resampler context\n");
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = swr_init(in->swr)) < 0) {
+        fprintf(stderr, "Failed to initialize the resampling context\n");
+        return ret;
+    }
+    in->fifo = av_audio_fifo_alloc(OUTPUT_FORMAT, OUTPUT_CHANNELS, (JITTER_MAX + 2) * PERIOD_SAMPLES);
+    if (!in->fifo) {
+        fprintf(stderr, "Could not allocate jitter buffer\n");
+        return AVERROR(ENOMEM);
+    }
+    /* a burst is at most two chunks */
+    ret = av_samples_alloc_array_and_samples(&in->src_data, &in->src_linesize, in->channels,
+                                             2 * in->chunk_samples, in->sample_fmt, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not allocate source samples\n");
+        return ret;
+    }
+    in->dst_max_samples = av_rescale_rnd(2 * in->chunk_samples + 64, OUTPUT_SAMPLERATE,
+                                         in->sample_rate, AV_ROUND_UP);
+    ret = av_samples_alloc_array_and_samples(&in->dst_data, &in->dst_linesize, OUTPUT_CHANNELS,
+                                             in->dst_max_samples, OUTPUT_FORMAT, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not allocate destination samples\n");
+        return ret;
+    }
+    return 0;
+}
+
+static void free_input(MixInput *in) {
+    swr_free(&in->swr);
+    if (in->fifo)
+        av_audio_fifo_free(in->fifo);
+    in->fifo = NULL;
+    if (in->src_data)
+        av_freep(&in->src_data[0]);
+    av_freep(&in->src_data);
+    if (in->dst_data)
+        av_freep(&in->dst_data[0]);
+    av_freep(&in->dst_data);
+}
+
+/* Synthesize nb_samples of a sine tone in the input's native format. */
+static void fill_input(MixInput *in, int nb_samples) {
+    double tincr = 1.0 / in->sample_rate;
+    const double c = 2 * M_PI * in->freq;
+    int i, j;
+    for (i = 0; i < nb_samples; i++) {
+        double v = 0.5 * sin(c * in->t);
+        if (in->sample_fmt == AV_SAMPLE_FMT_S16) {
+            int16_t *dst = (int16_t *) in->src_data[0] + i * in->channels;
+            for (j = 0; j < in->channels; j++)
+                dst[j] = (int16_t) (v * 32767);
+        } else {
+            for (j = 0; j < in->channels; j++)
+                ((float *) in->src_data[j])[i] = (float) v;
+        }
+        in->t += tincr;
+    }
+}
+
+/* Deliver one tick worth of input: resample it and push it into the jitter buffer. */
+static int feed_input(MixInput *in) {
+    int burst = next_burst(in);
+    int nb_samples = av_rescale(in->chunks + burst, in->sample_rate, 100) -
+                     av_rescale(in->chunks, in->sample_rate, 100);
+    int ret, excess;
+    in->chunks += burst;
+    if (!nb_samples)
+        return 0;
+    fill_input(in, nb_samples);
+    ret = swr_convert(in->swr, in->dst_data, in->dst_max_samples,
+                      (const uint8_t **) in->src_data, nb_samples);
+    if (ret < 0) {
+        fprintf(stderr, "Error while converting\n");
+        return ret;
+    }
+    if (ret > 0 && (ret = av_audio_fifo_write(in->fifo, (void **) in->dst_data, ret)) < 0)
+        return ret;
+    /* bounded latency: drop the oldest samples beyond the jitter window */
+    excess = av_audio_fifo_size(in->fifo) - JITTER_MAX * PERIOD_SAMPLES;
+    if (excess > 0) {
+        av_audio_fifo_drain(in->fifo, excess);
+        in->dropped_samples += excess;
+    }
+    return 0;
+}
+
+/* acc[i] += src[i] * gain */
+static void mix_accumulate(float *acc, const float *src, float gain, int n) {
+    int i = 0;
+#if defined(__SSE__)
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(acc + i);
+        __m128 s = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(acc + i, _mm_add_ps(a, _mm_mul_ps(s, g)));
+    }
+#endif
+    for (; i < n; i++)
+        acc[i] += src[i] * gain;
+}
+
+static void mix_clip(float *acc, int n) {
+    int i = 0;
+#if defined(__SSE__)
+    __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(acc + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), lo), hi));
+#endif
+    for (; i < n; i++)
+        acc[i] = acc[i] < -1.0f ? -1.0f : acc[i] > 1.0f ? 1.0f : acc[i];
+}
+
+/* Mix one period of every ready input into acc; returns the number of inputs mixed. */
+static int mix_period(MixInput *inputs, int nb_inputs, float *acc, float *scratch) {
+    const float gain = 1.0f / nb_inputs;
+    int i, mixed = 0;
+    memset(acc, 0, PERIOD_SAMPLES * OUTPUT_CHANNELS * sizeof(*acc));
+    for (i = 0; i < nb_inputs; i++) {
+        MixInput *in = &inputs[i];
+        int size = av_audio_fifo_size(in->fifo);
+        if (!in->primed) {
+            if (size < JITTER_PREFILL * PERIOD_SAMPLES)
+                continue;
+            in->primed = 1;
+        }
+        if (size < PERIOD_SAMPLES) {
+            /* underrun: play silence for this input and wait for a refill */
+            in->underruns++;
+            in->primed = 0;
+            continue;
+        }
+        av_audio_fifo_read(in->fifo, (void **) &scratch, PERIOD_SAMPLES);
+        mix_accumulate(acc, scratch, gain, PERIOD_SAMPLES * OUTPUT_CHANNELS);
+        mixed++;
+    }
+    mix_clip(acc, PERIOD_SAMPLES * OUTPUT_CHANNELS);
+    return mixed;
+}
+
+static int run_mixer(int nb_inputs, int nb_periods, FILE *out) {
+    MixInput *inputs;
+    struct AVMD5 *md5;
+    float *acc, *scratch;
+    uint8_t checksum[16];
+    double cpu_start, cpu_used, audio_seconds;
+    int64_t underruns = 0, dropped = 0;
+    int i, p, ret = 0;
+    inputs = av_mallocz_array(nb_inputs, sizeof(*inputs));
+    acc = av_malloc(PERIOD_SAMPLES * OUTPUT_CHANNELS * sizeof(*acc));
+    scratch = av_malloc(PERIOD_SAMPLES * OUTPUT_CHANNELS * sizeof(*scratch));
+    md5 = av_md5_alloc();
+    if (!inputs || !acc || !scratch || !md5) {
+        fprintf(stderr, "Error allocating the mixer\n");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_inputs; i++) {
+        if ((ret = init_input(&inputs[i], i)) < 0)
+            goto end;
+    }
+    av_md5_init(md5);
+    cpu_start = cpu_seconds();
+    for (p = 0; p < nb_periods; p++) {
+        for (i = 0; i < nb_inputs; i++) {
+            if ((ret = feed_input(&inputs[i])) < 0)
+                goto end;
+        }
+        mix_period(inputs, nb_inputs, acc, scratch);
+        av_md5_update(md5, (const uint8_t *) acc, PERIOD_SAMPLES * OUTPUT_CHANNELS * sizeof(*acc));
+        if (out)
+            fwrite(acc, sizeof(*acc), PERIOD_SAMPLES * OUTPUT_CHANNELS, out);
+    }
+    cpu_used = cpu_seconds() - cpu_start;
+    av_md5_final(md5, checksum);
+    for (i = 0; i < nb_inputs; i++) {
+        underruns += inputs[i].underruns;
+        dropped += inputs[i].dropped_samples;
+    }
+    audio_seconds = (double) nb_periods * PERIOD_SAMPLES / OUTPUT_SAMPLERATE;
+    fprintf(stdout, "inputs:%2d cpu:%8.3fms/s per-input:%7.3fms/s (%.3f%% core) "
+                    "underruns:%"PRId64" dropped:%"PRId64" md5:0x",
+            nb_inputs, 1000 * cpu_used / audio_seconds, 1000 * cpu_used / audio_seconds / nb_inputs,
+            100 * cpu_used / audio_seconds / nb_inputs, underruns, dropped);
+    for (i = 0; i < sizeof(checksum); i++)
+        fprintf(stdout, "%02X", checksum[i]);
+    fprintf(stdout, "\n");
+    end:
+    if (inputs) {
+        for (i = 0; i < nb_inputs; i++)
+            free_input(&inputs[i]);
+    }
+    av_freep(&inputs);
+    av_freep(&acc);
+    av_freep(&scratch);
+    av_freep(&md5);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    char errstr[1024];
+    FILE *out = NULL;
+    float duration;
+    int err = 0, nb_periods, max_inputs = MAX_INPUTS, n;
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <duration> [max_inputs] [output_file]\n"
+                        "Mixes 1, 2, 4, ... max_inputs synthetic live sources and reports the CPU cost per input.\n"
+                        "The largest mix is written to output_file as f32le 48000 Hz stereo.\n",
+                argv[0]);
+        return 1;
+    }
+    duration = atof(argv[1]);
+    nb_periods = duration * OUTPUT_SAMPLERATE / PERIOD_SAMPLES;
+    if (nb_periods <= 0) {
+        fprintf(stderr, "Invalid duration: %s\n", argv[1]);
+        return 1;
+    }
+    if (argc > 2)
+        max_inputs = atoi(argv[2]);
+    if (max_inputs <= 0 || max_inputs > MAX_INPUTS) {
+        fprintf(stderr, "max_inputs must be in [1, %d]\n", MAX_INPUTS);
+        return 1;
+    }
+    fprintf(stdout, "period:%dms latency bound:%dms\n",
+            1000 * PERIOD_SAMPLES / OUTPUT_SAMPLERATE, 1000 * JITTER_MAX * PERIOD_SAMPLES / OUTPUT_SAMPLERATE);
+    for (n = 1;; n *= 2) {
+        if (n > max_inputs)
+            n = max_inputs;
+        if (n == max_inputs && argc > 3) {
+            out = fopen(argv[3], "wb");
+            if (!out) {
+                fprintf(stderr, "Could not open destination file %s\n", argv[3]);
+                return 1;
+            }
+        }
+        err = run_mixer(n, nb_periods, out);
+        if (err < 0)
+            break;
+        if (n == max_inputs)
+            break;
+    }
+    if (out)
+        fclose(out);
+    if (err < 0) {
+        av_strerror(err, errstr, sizeof(errstr));
+        fprintf(stderr, "%s\n", errstr);
+        return 1;
+    }
+    return 0;
+}
@@ -26,7 +26,13 @@
  * Output a media file in any supported libavformat format. The default
  * codecs are used.
  * @example muxing.c
+ *
+ * With -parallel every stream is encoded by its own thread into a bounded
+ * per-stream packet queue, and the main thread feeds the muxer the queued
+ * packet with the lowest dts once every unfinished stream has one queued.
+ * -audio_tracks adds more audio streams, each with its own tone.
  */
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,6 +41,7 @@
 #include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/time.h>
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
@@ -43,8 +50,12 @@
 #define STREAM_FRAME_RATE 25 /* 25 images/s */
 #define STREAM_PIX_FMT    AV_PIX_FMT_YUV420P /* default pix_fmt */
 #define SCALE_FLAGS SWS_BICUBIC
+#define MAX_AUDIO_TRACKS 8
+/* packets an encoder thread may run ahead of the muxer */
+#define MAX_STREAM_PACKETS 32
 // a wrapper around a single output AVStream
 typedef struct OutputStream {
+    AVFormatContext *oc;
     AVStream *st;
     AVCodecContext *enc;
     /* pts of the next frame that will be generated */
@@ -55,7 +66,19 @@ typedef struct OutputStream {
     float t, tincr, tincr2;
     struct SwsContext *sws_ctx;
     struct SwrContext *swr_ctx;
+    /* -parallel: encoded packets waiting for the interleaver, guarded by queue_mutex */
+    pthread_t thread;
+    AVPacket *queue[MAX_STREAM_PACKETS];
+    int queue_head, queue_count;
+    int finished;
+    int64_t stalls;
+    /* microseconds spent generating and encoding, and blocked on a full queue */
+    int64_t encode_time, wait_time;
 } OutputStream;
+static int parallel = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t packet_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
 static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt)
 {
     AVRational *time_base = &fmt_ctx->streams[pkt->stream_index]->time_base;
@@ -65,9 +88,32 @@ static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt)
            av_ts2str(pkt->duration), av_ts2timestr(pkt->duration, time_base),
            pkt->stream_index);
 }
-static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
-                       AVStream *st, AVFrame *frame)
+/* Hand an encoded packet to the interleaver, blocking while the stream is MAX_STREAM_PACKETS ahead. */
+static void queue_packet(OutputStream *ost, AVPacket *pkt)
 {
+    AVPacket *queued = av_packet_alloc();
+    int64_t start;
+    if (!queued) {
+        fprintf(stderr, "Could not allocate a packet\n");
+        exit(1);
+    }
+    av_packet_move_ref(queued, pkt);
+    pthread_mutex_lock(&queue_mutex);
+    if (ost->queue_count == MAX_STREAM_PACKETS) {
+        ost->stalls++;
+        start = av_gettime_relative();
+        while (ost->queue_count == MAX_STREAM_PACKETS)
+            pthread_cond_wait(&space_cond, &queue_mutex);
+        ost->wait_time += av_gettime_relative() - start;
+    }
+    ost->queue[(ost->queue_head + ost->queue_count++) % MAX_STREAM_PACKETS] = queued;
+    pthread_cond_signal(&packet_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+static int write_frame(AVFormatContext *fmt_ctx, OutputStream *ost, AVFrame *frame)
+{
+    AVCodecContext *c = ost->enc;
+    AVStream *st = ost->st;
     int ret;
     // send the frame to the encoder
     ret = avcodec_send_frame(c, frame);
@@ -88,6 +134,10 @@ static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
         /* rescale output packet timestamp values from codec to stream timebase */
         av_packet_rescale_ts(&pkt, c->time_base, st->time_base);
         pkt.stream_index = st->index;
+        if (parallel) {
+            queue_packet(ost, &pkt);
+            continue;
+        }
         /* Write the compressed frame to the media file. */
         log_packet(fmt_ctx, &pkt);
         ret = av_interleaved_write_frame(fmt_ctx, &pkt);
@@ -119,6 +169,7 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
         exit(1);
     }
     ost->st->id = oc->nb_streams-1;
+    ost->oc = oc;
     c = avcodec_alloc_context3(*codec);
     if (!c) {
         fprintf(stderr, "Could not alloc an encoding context\n");
@@ -207,7 +258,7 @@ static AVFrame *alloc_audio_frame(enum AVSampleFormat sample_fmt,
     }
     return frame;
 }
-static void open_audio(AVFormatContext *oc, AVCodec *codec, OutputStream *ost, AVDictionary *opt_arg)
+static void open_audio(AVFormatContext *oc, AVCodec *codec, OutputStream *ost, int track, AVDictionary *opt_arg)
 {
     AVCodecContext *c;
     int nb_samples;
@@ -222,9 +273,9 @@ static void open_audio(AVFormatContext *oc, AVCodec *codec, OutputStream *ost, A
         fprintf(stderr, "Could not open audio codec: %s\n", av_err2str(ret));
         exit(1);
     }
-    /* init signal generator */
+    /* init signal generator, every track starts one octave higher */
     ost->t     = 0;
-    ost->tincr = 2 * M_PI * 110.0 / c->sample_rate;
+    ost->tincr = 2 * M_PI * 110.0 * (1 << track) / c->sample_rate;
     /* increment frequency by 110 Hz per second */
     ost->tincr2 = 2 * M_PI * 110.0 / c->sample_rate / c->sample_rate;
     if (c->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)
@@ -319,7 +370,7 @@ static int write_audio_frame(AVFormatContext *oc, OutputStream *ost)
         frame->pts = av_rescale_q(ost->samples_count, (AVRational){1, c->sample_rate}, c->time_base);
         ost->samples_count += dst_nb_samples;
     }
-    return write_frame(oc, c, ost->st, frame);
+    return write_frame(oc, ost, frame);
 }
 /**************************************************************/
 /* video output */
@@ -438,7 +489,74 @@ static AVFrame *get_video_frame(OutputStream *ost)
  */
 static int write_video_frame(AVFormatContext *oc, OutputStream *ost)
 {
-    return write_frame(oc, ost->enc, ost->st, get_video_frame(ost));
+    return write_frame(oc, ost, get_video_frame(ost));
+}
+/* encode one frame of any stream, return 1 when encoding is finished */
+static int write_stream_frame(OutputStream *ost)
+{
+    int64_t start = av_gettime_relative();
+    int64_t wait_time = ost->wait_time;
+    int ret = ost->enc->codec_type == AVMEDIA_TYPE_VIDEO ?
+              write_video_frame(ost->oc, ost) : write_audio_frame(ost->oc, ost);
+    ost->encode_time += av_gettime_relative() - start - (ost->wait_time - wait_time);
+    return ret;
+}
+static void *encode_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    while (!write_stream_frame(ost))
+        ;
+    pthread_mutex_lock(&queue_mutex);
+    ost->finished = 1;
+    pthread_cond_signal(&packet_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+/*
+ * Feed the muxer from the encoder threads in dts order: wait until every
+ * unfinished stream has a packet queued, then write the earliest one.
+ */
+static void interleave_packets(AVFormatContext *oc, OutputStream *streams, int nb_streams)
+{
+    int i, ret;
+    pthread_mutex_lock(&queue_mutex);
+    while (1) {
+        OutputStream *next = NULL;
+        AVPacket *pkt;
+        int waiting = 0;
+        for (i = 0; i < nb_streams; i++) {
+            OutputStream *ost = &streams[i];
+            AVPacket *head;
+            if (!ost->queue_count) {
+                waiting |= !ost->finished;
+                continue;
+            }
+            head = ost->queue[ost->queue_head];
+            if (!next || av_compare_ts(head->dts, ost->st->time_base,
+                                       next->queue[next->queue_head]->dts, next->st->time_base) < 0)
+                next = ost;
+        }
+        if (waiting) {
+            pthread_cond_wait(&packet_cond, &queue_mutex);
+            continue;
+        }
+        if (!next)
+            break;
+        pkt = next->queue[next->queue_head];
+        next->queue_head = (next->queue_head + 1) % MAX_STREAM_PACKETS;
+        next->queue_count--;
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&queue_mutex);
+        log_packet(oc, pkt);
+        ret = av_interleaved_write_frame(oc, pkt);
+        av_packet_free(&pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error while writing output packet: %s\n", av_err2str(ret));
+            exit(1);
+        }
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
 }
 static void close_stream(AVFormatContext *oc, OutputStream *ost)
 {
@@ -452,30 +570,39 @@ static void close_stream(AVFormatContext *oc, OutputStream *ost)
 /* media file output */
 int main(int argc, char **argv)
 {
-    OutputStream video_st = { 0 }, audio_st = { 0 };
+    OutputStream streams[1 + MAX_AUDIO_TRACKS] = { 0 };
+    int nb_streams = 0;
     const char *filename;
     AVOutputFormat *fmt;
     AVFormatContext *oc;
     AVCodec *audio_codec, *video_codec;
     int ret;
     int have_video = 0, have_audio = 0;
-    int encode_video = 0, encode_audio = 0;
+    int audio_tracks = 1;
     AVDictionary *opt = NULL;
     int i;
+    int64_t start, elapsed, encode_time = 0;
     if (argc < 2) {
-        printf("usage: %s output_file\n"
+        printf("usage: %s output_file [-parallel] [-audio_tracks n]\n"
                "API example program to output a media file with libavformat.\n"
                "This program generates a synthetic audio and video stream, encodes and\n"
                "muxes them into a file named output_file.\n"
                "The output format is automatically guessed according to the file extension.\n"
                "Raw images can also be output by using '%%d' in the filename.\n"
+               "-parallel encodes every stream on its own thread.\n"
                "\n", argv[0]);
         return 1;
     }
     filename = argv[1];
-    for (i = 2; i+1 < argc; i+=2) {
-        if (!strcmp(argv[i], "-flags") || !strcmp(argv[i], "-fflags"))
+    for (i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "-parallel")) {
+            parallel = 1;
+        } else if (i + 1 < argc && !strcmp(argv[i], "-audio_tracks")) {
+            audio_tracks = av_clip(atoi(argv[++i]), 1, MAX_AUDIO_TRACKS);
+        } else if (i + 1 < argc && (!strcmp(argv[i], "-flags") || !strcmp(argv[i], "-fflags"))) {
             av_dict_set(&opt, argv[i]+1, argv[i+1], 0);
+            i++;
+        }
     }
     /* allocate the output media context */
     avformat_alloc_output_context2(&oc, NULL, NULL, filename);
@@ -489,21 +616,22 @@ int main(int argc, char **argv)
     /* Add the audio and video streams using the default format codecs
      * and initialize the codecs. */
     if (fmt->video_codec != AV_CODEC_ID_NONE) {
-        add_stream(&video_st, oc, &video_codec, fmt->video_codec);
+        add_stream(&streams[nb_streams++], oc, &video_codec, fmt->video_codec);
         have_video = 1;
-        encode_video = 1;
     }
     if (fmt->audio_codec != AV_CODEC_ID_NONE) {
-        add_stream(&audio_st, oc, &audio_codec, fmt->audio_codec);
+        for (i = 0; i < audio_tracks; i++)
+            add_stream(&streams[nb_streams++], oc, &audio_codec, fmt->audio_codec);
         have_audio = 1;
-        encode_audio = 1;
     }
     /* Now that all the parameters are set, we can open the audio and
      * video codecs and allocate the necessary encode buffers. */
-    if (have_video)
-        open_video(oc, video_codec, &video_st, opt);
-    if (have_audio)
-        open_audio(oc, audio_codec, &audio_st, opt);
+    for (i = 0; i < nb_streams; i++) {
+        if (have_video && i == 0)
+            open_video(oc, video_codec, &streams[i], opt);
+        else if (have_audio)
+            open_audio(oc, audio_codec, &streams[i], i - have_video, opt);
+    }
     av_dump_format(oc, 0, filename, 1);
     /* open the output file, if needed */
     if (!(fmt->flags & AVFMT_NOFILE)) {
@@ -521,30 +649,56 @@ int main(int argc, char **argv)
                 av_err2str(ret));
         return 1;
     }
-    while (encode_video || encode_audio) {
-        /* select the stream to encode */
-        if (encode_video &&
-            (!encode_audio || av_compare_ts(video_st.next_pts, video_st.enc->time_base,
-                                            audio_st.next_pts, audio_st.enc->time_base) <= 0)) {
-            encode_video = !write_video_frame(oc, &video_st);
-        } else {
-            encode_audio = !write_audio_frame(oc, &audio_st);
+    start = av_gettime_relative();
+    if (parallel) {
+        for (i = 0; i < nb_streams; i++) {
+            if (pthread_create(&streams[i].thread, NULL, encode_thread, &streams[i])) {
+                fprintf(stderr, "Could not start encoder thread\n");
+                exit(1);
+            }
+        }
+        interleave_packets(oc, streams, nb_streams);
+        for (i = 0; i < nb_streams; i++)
+            pthread_join(streams[i].thread, NULL);
+    } else {
+        while (1) {
+            /* select the stream to encode */
+            OutputStream *next = NULL;
+            for (i = 0; i < nb_streams; i++) {
+                OutputStream *ost = &streams[i];
+                if (!ost->finished &&
+                    (!next || av_compare_ts(ost->next_pts, ost->enc->time_base,
+                                            next->next_pts, next->enc->time_base) < 0))
+                    next = ost;
+            }
+            if (!next)
+                break;
+            next->finished = write_stream_frame(next);
         }
     }
+    elapsed = av_gettime_relative() - start;
     /* Write the trailer, if any. The trailer must be written before you
      * close the CodecContexts open when you wrote the header; otherwise
      * av_write_trailer() may try to use memory that was freed on
      * av_codec_close(). */
     av_write_trailer(oc);
+    for (i = 0; i < nb_streams; i++) {
+        OutputStream *ost = &streams[i];
+        fprintf(stderr, "stream %d (%s): encode %.3fs, blocked %.3fs on a full queue %"PRId64" times\n",
+                i, avcodec_get_name(ost->enc->codec_id), ost->encode_time / 1e6,
+                ost->wait_time / 1e6, ost->stalls);
+        encode_time += ost->encode_time;
+    }
+    fprintf(stderr, "%s: %d streams in %.3fs, %.3fs of encoding, %.2fx\n",
+            parallel ? "parallel" : "serial", nb_streams, elapsed / 1e6,
+            encode_time / 1e6, elapsed ? (double) encode_time / elapsed : 0);
     /* Close each codec. */
-    if (have_video)
-        close_stream(oc, &video_st);
-    if (have_audio)
-        close_stream(oc, &audio_st);
+    for (i = 0; i < nb_streams; i++)
+        close_stream(oc, &streams[i]);
     if (!(fmt->flags & AVFMT_NOFILE))
         /* Close the output file. */
         avio_closep(&oc->pb);
     /* free the stream */
     avformat_free_context(oc);
     return 0;
-}
\ No newline at end of file
+}
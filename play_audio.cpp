@@ -9,95 +9,23 @@ extern "C" {
 #include <SDL2/SDL.h>
 }
 
+#include "media/media.h"
+
 #include <iostream>
 #include <thread>
 
 #define SDL_AUDIO_BUFFER_SIZE 4096
 #define MAX_AUDIO_FRAME_SIZE 192000
 #define SFM_REFRESH_EVENT  (SDL_USEREVENT + 1)
-int quit = 0;
+// the audio decoder is drained, audio_callback() only has silence left
+#define SFM_EOS_EVENT  (SDL_USEREVENT + 2)
+// audio packets waiting for the audio callback, the read loop blocks beyond this
+#define PACKET_QUEUE_MAX_SIZE 256
 using namespace std;
 
-typedef struct {
-    AVPacketList *first_pkt, *last_pkt;
-    int nb_packets;
-    int size;
-    SDL_mutex *mutex;
-    SDL_cond *cond;
-} PacketQueue;
-
-PacketQueue packetQueue;
+media::BoundedQueue<media::Packet> packetQueue(PACKET_QUEUE_MAX_SIZE);
 SwrContext *swrContext = nullptr;
 
-void init_queue(PacketQueue *pqueue) {
-    memset(pqueue, 0, sizeof(PacketQueue));
-    packetQueue.mutex = SDL_CreateMutex();
-    packetQueue.cond = SDL_CreateCond();
-}
-
-int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
-
-    AVPacketList *pkt1;
-    if (av_dup_packet(pkt) < 0) {
-        return -1;
-    }
-    pkt1 = static_cast<AVPacketList *>(av_malloc(sizeof(AVPacketList)));
-    if (!pkt1)
-        return -1;
-    pkt1->pkt = *pkt;
-    pkt1->next = NULL;
-
-
-    SDL_LockMutex(q->mutex);
-
-    if (!q->last_pkt)
-        q->first_pkt = pkt1;
-    else
-        q->last_pkt->next = pkt1;
-    q->last_pkt = pkt1;
-    q->nb_packets++;
-    q->size += pkt1->pkt.size;
-    SDL_CondSignal(q->cond);
-
-    SDL_UnlockMutex(q->mutex);
-    return 0;
-}
-
-static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block) {
-    AVPacketList *pkt1;
-    int ret;
-
-    SDL_LockMutex(q->mutex);
-
-    for (;;) {
-
-        if (quit) {
-            ret = -1;
-            break;
-        }
-
-        pkt1 = q->first_pkt;
-        if (pkt1) {
-            q->first_pkt = pkt1->next;
-            if (!q->first_pkt)
-                q->last_pkt = NULL;
-            q->nb_packets--;
-            q->size -= pkt1->pkt.size;
-            *pkt = pkt1->pkt;
-            av_free(pkt1);
-            ret = 1;
-            break;
-        } else if (!block) {
-            ret = 0;
-            break;
-        } else {
-            SDL_CondWait(q->cond, q->mutex);
-        }
-    }
-    SDL_UnlockMutex(q->mutex);
-    return ret;
-}
-
 int init_swrcontext(AVCodecContext *codecCtx, SwrContext **swrContext) {
     *swrContext = swr_alloc();
     //
@@ -112,40 +40,47 @@ int init_swrcontext(AVCodecContext *codecCtx, SwrContext **swrContext) {
 
 int audio_decode_frame(AVCodecContext *audioCtx, uint8_t *audio_buf, int buf_size) {
     static int ret = -1;
-    auto packet = av_packet_alloc();
-    static AVFrame frame;
+    static media::Frame frame;
+    // set once the decoder returned AVERROR_EOF, the queue stays empty from then on and pop() would block forever
+    static bool drained = false;
+    if (drained)
+        return AVERROR_EOF;
     while (true) {
         while (ret >= 0) {
-            ret = avcodec_receive_frame(audioCtx, &frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            ret = avcodec_receive_frame(audioCtx, frame.get());
+            if (ret == AVERROR_EOF) {
+                // drained after the flush packet
+                drained = true;
+                return ret;
+            }
+            if (ret == AVERROR(EAGAIN))
                 break;
             else if (ret < 0) {
                 cerr << "Error during decoding" << endl;
                 exit(1);
             }
-            auto data_size = av_samples_get_buffer_size(nullptr, frame.channels, frame.nb_samples,
+            auto data_size = av_samples_get_buffer_size(nullptr, frame->channels, frame->nb_samples,
                                                         audioCtx->sample_fmt, 0);
             int convert_ret = swr_convert(swrContext,
                                           &audio_buf,
-                                          frame.nb_samples,
-                                          (const uint8_t **) frame.data,
-                                          frame.nb_samples);
+                                          frame->nb_samples,
+                                          (const uint8_t **) frame->data,
+                                          frame->nb_samples);
             if (convert_ret < 0) {
                 cerr << "failed in convert" << endl;
                 exit(1);
             }
             return data_size;
         }
-        if (packet->data) {
-            av_packet_unref(packet);
-        }
-        if (packet_queue_get(&packetQueue, packet, 1) < 0) {
+        media::Packet packet;
+        if (!packetQueue.pop(packet)) {
             return -1;
         }
-        ret = avcodec_send_packet(audioCtx, packet);
+        // the flush packet has no data, avcodec_send_packet() starts draining on it
+        ret = avcodec_send_packet(audioCtx, packet.get());
         if (ret < 0) {
             cerr << "failed in send packet error: " << AVERROR(ret) << endl;
-            break;
+            return ret;
         }
     }
 }
@@ -157,11 +92,18 @@ void audio_callback(void *userdata, Uint8 *stream, int len) {
     static uint8_t audio_buf[(MAX_AUDIO_FRAME_SIZE * 3) / 2];
     static unsigned int audio_buf_size = 0;
     static unsigned int audio_buf_index = 0;
+    static bool eos = false;
 
     while (len > 0) {
         if (audio_buf_index >= audio_buf_size) {
             /* We have already sent all our data; get more */
             audio_size = audio_decode_frame(aCodecCtx, audio_buf, sizeof(audio_buf));
+            if (audio_size == AVERROR_EOF && !eos) {
+                eos = true;
+                SDL_Event event;
+                event.type = SFM_EOS_EVENT;
+                SDL_PushEvent(&event);
+            }
             if (audio_size < 0) {
                 /* If error, output silence */
                 audio_buf_size = 1024; // arbitrary?
@@ -182,65 +124,37 @@ void audio_callback(void *userdata, Uint8 *stream, int len) {
 }
 
 int main(int argc, char **argv) {
-    AVFormatContext *formatCtx = nullptr;
-    auto ret = avformat_open_input(&formatCtx, argv[1], nullptr, nullptr);
+    media::InputFormat input;
+    auto ret = input.open(argv[1]);
     if (ret < 0) {
-        cerr << "failed in open input" << argv[1] << endl;
+        cerr << "failed in open input" << argv[1] << " error:" << media::errorString(ret) << endl;
         exit(1);
     }
-    ret = avformat_find_stream_info(formatCtx, nullptr);
-    if (ret < 0) {
-        cerr << "failed in find stream info" << endl;
+    av_dump_format(input.get(), 0, argv[1], 0);
+    auto audioStreamIndex = input.findBestStream(AVMEDIA_TYPE_AUDIO);
+    auto videoStreamIndex = input.findBestStream(AVMEDIA_TYPE_VIDEO);
+    if (audioStreamIndex < 0 || videoStreamIndex < 0) {
+        cerr << "failed in find audio and video stream" << endl;
         exit(1);
     }
-    av_dump_format(formatCtx, 0, argv[1], 0);
-    auto audioStreamIndex = -1, videoStreamIndex = -1;
-    AVCodecParameters *audioParameters = avcodec_parameters_alloc();
-    AVCodecParameters *videoParameters = avcodec_parameters_alloc();
-    for (int i = 0; i < formatCtx->nb_streams; ++i) {
-        if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            audioStreamIndex = i;
-            if (avcodec_parameters_copy(audioParameters, formatCtx->streams[i]->codecpar) < 0) {
-                cerr << "failed in copy parameter" << endl;
-                exit(1);
-            }
-        }
-        if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            videoStreamIndex = i;
-            if (avcodec_parameters_copy(videoParameters, formatCtx->streams[i]->codecpar) < 0) {
-                cerr << "failed in copy video parameter" << endl;
-            }
-        }
-    }
 
     // audio codec context
-    AVCodec *audioCodec = avcodec_find_decoder(audioParameters->codec_id);
-    // 注意 avcodec_alloc_context3 和 avcodec_open2 可以在一个位置传入 audioCodec,但是如果两个位置都传入的话需要两个 codec 相等
-    auto audioCodecCtx = avcodec_alloc_context3(nullptr);
-    ret = avcodec_parameters_to_context(audioCodecCtx, audioParameters);
-    if (ret < 0) {
-        cerr << "failed in audio Parameters to context" << endl;
-        exit(1);
-    }
-    ret = avcodec_open2(audioCodecCtx, audioCodec, nullptr);
+    media::StreamDecoder audioDecoder;
+    ret = audioDecoder.open(input.stream(audioStreamIndex));
     if (ret < 0) {
-        cerr << "failed in codec open" << endl;
+        cerr << "failed in audio codec open error:" << media::errorString(ret) << endl;
         exit(1);
     }
+    auto audioCodecCtx = audioDecoder.context();
 
     // video codec context
-    AVCodec *videoCodec = avcodec_find_decoder(videoParameters->codec_id);
-    auto videoCodecCtx = avcodec_alloc_context3(nullptr);
-    ret = avcodec_parameters_to_context(videoCodecCtx, videoParameters);
+    media::StreamDecoder videoDecoder;
+    ret = videoDecoder.open(input.stream(videoStreamIndex));
     if (ret < 0) {
-        cerr << "failed in audio Parametes to context" << endl;
-        exit(1);
-    }
-    ret = avcodec_open2(videoCodecCtx, videoCodec, nullptr);
-    if (ret < 0) {
-        cerr << "failed in video Parametes to context" << endl;
+        cerr << "failed in video codec open error:" << media::errorString(ret) << endl;
         exit(1);
     }
+    auto videoCodecCtx = videoDecoder.context();
 
     ret = SDL_Init(SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_VIDEO);
     if (ret < 0) {
@@ -265,9 +179,7 @@ int main(int argc, char **argv) {
         exit(1);
     }
     SDL_PauseAudio(0);
-    init_queue(&packetQueue);
     SDL_Event event;
-    AVPacket packet;
     auto srcWith = videoCodecCtx->width;
     auto srcHeight = videoCodecCtx->height;
     auto image_convert_context = sws_getContext(
@@ -281,8 +193,8 @@ int main(int argc, char **argv) {
             nullptr,
             nullptr,
             nullptr);
-    auto originFrame = av_frame_alloc();
-    auto YUVFrame = av_frame_alloc();
+    media::Frame originFrame;
+    media::Frame YUVFrame;
     auto outBUffer = (uint8_t *) av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, srcWith, srcHeight, 1));
     av_image_fill_arrays(YUVFrame->data, YUVFrame->linesize, outBUffer, AV_PIX_FMT_YUV420P, srcWith, srcHeight, 1);
     auto window = SDL_CreateWindow("player",
@@ -305,59 +217,81 @@ int main(int argc, char **argv) {
             SDL_TEXTUREACCESS_STREAMING,
             srcWith,
             srcHeight);
+    // receive and show what the video decoder has, after send(nullptr) until it is drained
+    auto showVideoFrames = [&]() {
+        while (videoDecoder.receive(originFrame) >= 0) {
+            sws_scale(
+                    image_convert_context,
+                    originFrame->data,
+                    originFrame->linesize,
+                    0,
+                    srcHeight,
+                    YUVFrame->data,
+                    YUVFrame->linesize);
+            SDL_UpdateYUVTexture(texture, nullptr, YUVFrame->data[0], YUVFrame->linesize[0], YUVFrame->data[1],
+                                 YUVFrame->linesize[1], YUVFrame->data[2], YUVFrame->linesize[2]);
+            SDL_RenderClear(render);
+            SDL_RenderCopy(render, texture, nullptr, nullptr);
+            SDL_RenderPresent(render);
+        }
+    };
     while (true) {
-        auto ret = av_read_frame(formatCtx, &packet);
-        if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) {
+        media::Packet packet;
+        auto ret = input.read(packet);
+        if (ret == AVERROR_EOF) {
             cout << "read frame finished" << endl;
-            this_thread::sleep_for(chrono::milliseconds(100));
+            break;
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            // 读循环在主线程上同时处理 SDL 事件,没有 EventLoop;FFmpeg 也不公开输入的 fd,只能稍后重试
+            SDL_Delay(10);
             continue;
         }
         if (ret < 0) {
             cerr << "failed in read packet" << endl;
             break;
         }
-        if (packet.stream_index == audioStreamIndex) {
-            packet_queue_put(&packetQueue, &packet);
+        if (packet->stream_index == audioStreamIndex) {
+            packetQueue.push(std::move(packet));
             continue;
         }
-        if (packet.stream_index == videoStreamIndex) {
-            auto result = avcodec_send_packet(videoCodecCtx, &packet);
-            if (result == AVERROR_EOF || result == AVERROR(EAGAIN)) {
-                break;
-            }
+        if (packet->stream_index == videoStreamIndex) {
+            auto result = videoDecoder.send(&packet);
             if (result < 0) {
                 cerr << "failed in send packet" << endl;
                 exit(1);
             }
-            do {
-                ret = avcodec_receive_frame(
-                        videoCodecCtx,
-                        originFrame);
-                if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) {
-                    break;
-                }
-                sws_scale(
-                        image_convert_context,
-                        originFrame->data,
-                        originFrame->linesize,
-                        0,
-                        srcHeight,
-                        YUVFrame->data,
-                        YUVFrame->linesize);
-                SDL_UpdateTexture(texture, nullptr, YUVFrame->data[0], YUVFrame->linesize[0]);
-                SDL_RenderClear(render);
-                SDL_RenderCopy(render, texture, nullptr, nullptr);
-                SDL_RenderPresent(render);
-            } while (ret >= 0);
-            av_packet_unref(&packet);
+            showVideoFrames();
         }
         SDL_PollEvent(&event);
         switch (event.type) {
             case SDL_QUIT:
+                packetQueue.abort();
                 SDL_Quit();
                 exit(0);
             default:
                 break;
         }
     }
-}
\ No newline at end of file
+    // end of stream: the flush packet drains the audio decoder behind the queued packets,
+    // the video decoder is drained here
+    packetQueue.push(media::Packet());
+    videoDecoder.send(nullptr);
+    showVideoFrames();
+    // 主线程阻塞在 SDL_WaitEvent 上直到退出;音频解码完以后关闭音频设备,之后空闲时不占 CPU
+    auto audioOpened = true;
+    while (SDL_WaitEvent(&event)) {
+        if (event.type == SFM_EOS_EVENT && audioOpened) {
+            SDL_CloseAudio();
+            audioOpened = false;
+            cout << "playback finished" << endl;
+        }
+        if (event.type == SDL_QUIT)
+            break;
+    }
+    packetQueue.abort();
+    if (audioOpened)
+        SDL_CloseAudio();
+    SDL_Quit();
+    return 0;
+}
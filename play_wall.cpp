@@ -0,0 +1,309 @@
+//
+// 在一个窗口中以宫格同时播放多路视频(监控墙),所有 session 共用 wall::Engine 的线程池;
+// 每个 tick 由 Compositor 并行把各路缩放进一张 YUV420P 大图,只上传一次纹理;-vsync 时跟随屏幕刷新合成.
+// -bench 时不开窗口,找出每个核能实时播放多少路.
+//
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+#include <SDL2/SDL.h>
+}
+
+#include "media/event_loop.h"
+#include "wall/wall.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#define FF_WALL_TICK_EVENT (SDL_USEREVENT)
+// a trial keeps up when at most this share of the tiles per tick is dropped or missing
+#define REALTIME_TOLERANCE 0.01
+#define MAX_BENCH_SESSIONS 512
+
+using namespace std;
+
+struct Trial {
+    int sessions;
+    bool realtime;
+    int threads;
+    double cpuLoad;
+    // average milliseconds per compose() call
+    double composeMs;
+    wall::SessionStats total;
+};
+
+static void usage(const char *name) {
+    cerr << "usage: " << name << " [-size WxH] [-fps n] [-vsync] [-io n] [-threads n] [-compose n] [-n copies] input...\n"
+         << "       " << name << " -bench [-fps n] [-seconds n] [-io n] [-threads n] [-compose n] input" << endl;
+    exit(1);
+}
+
+// threads of this process, -1 where there is no /proc
+static int count_threads() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0)
+            return atoi(line.c_str() + 8);
+    }
+    return -1;
+}
+
+static double cpu_seconds() {
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static AVFrame *alloc_mosaic(int width, int height) {
+    auto mosaic = av_frame_alloc();
+    mosaic->format = AV_PIX_FMT_YUV420P;
+    mosaic->width = width;
+    mosaic->height = height;
+    if (av_frame_get_buffer(mosaic, 0) < 0) {
+        cerr << "failed in alloc mosaic" << endl;
+        exit(1);
+    }
+    // black until a tile has its first frame
+    memset(mosaic->data[0], 16, mosaic->linesize[0] * height);
+    memset(mosaic->data[1], 128, mosaic->linesize[1] * (height / 2));
+    memset(mosaic->data[2], 128, mosaic->linesize[2] * (height / 2));
+    return mosaic;
+}
+
+// play sessions copies of input at fps for seconds on a 1080p mosaic without showing it
+static Trial run_trial(const string &input, int sessions, int fps, int seconds, int ioThreads, int decodeThreads,
+                       int composeThreads) {
+    Trial trial = {};
+    trial.sessions = sessions;
+    wall::Engine engine(ioThreads, decodeThreads, composeThreads);
+    for (int i = 0; i < sessions; i++) {
+        auto ret = engine.addSession(input, true);
+        if (ret < 0) {
+            cerr << "failed in open " << input << " error:" << media::errorString(ret) << endl;
+            exit(1);
+        }
+    }
+    auto mosaic = alloc_mosaic(1920, 1080);
+    engine.start();
+    if (!engine.waitReady(10 * 1000000LL)) {
+        av_frame_free(&mosaic);
+        return trial;
+    }
+    for (size_t i = 0; i < engine.size(); i++)
+        engine.session(i).resetStats();
+    engine.compositor().resetStats();
+    auto ticks = fps * seconds;
+    auto cpuStart = cpu_seconds();
+    auto start = av_gettime_relative();
+    for (int tick = 0; tick < ticks; tick++) {
+        auto wait = start + tick * 1000000LL / fps - av_gettime_relative();
+        if (wait > 0)
+            av_usleep(wait);
+        engine.compose(static_cast<double>(tick) / fps, mosaic);
+    }
+    auto elapsed = (av_gettime_relative() - start) / 1e6;
+    trial.cpuLoad = (cpu_seconds() - cpuStart) / elapsed;
+    trial.threads = count_threads();
+    trial.composeMs = engine.compositor().time() / 1000.0 / FFMAX(engine.compositor().calls(), 1);
+    for (size_t i = 0; i < engine.size(); i++) {
+        auto stats = engine.session(i).stats();
+        trial.total.decoded += stats.decoded;
+        trial.total.shown += stats.shown;
+        trial.total.dropped += stats.dropped;
+        trial.total.underruns += stats.underruns;
+    }
+    // the compositor itself falling behind shows up as elapsed running over
+    trial.realtime = trial.total.dropped + trial.total.underruns <= REALTIME_TOLERANCE * sessions * ticks &&
+                     elapsed <= seconds * (1 + REALTIME_TOLERANCE);
+    av_frame_free(&mosaic);
+    return trial;
+}
+
+static int bench(const string &input, int fps, int seconds, int ioThreads, int decodeThreads, int composeThreads) {
+    vector<Trial> trials;
+    auto run = [&](int sessions) {
+        auto trial = run_trial(input, sessions, fps, seconds, ioThreads, decodeThreads, composeThreads);
+        cerr << sessions << " sessions: " << (trial.realtime ? "realtime" : "behind") << ", shown "
+             << trial.total.shown << ", dropped " << trial.total.dropped << ", underruns " << trial.total.underruns
+             << ", compose " << trial.composeMs << " ms, cpu " << trial.cpuLoad * 100 << "%, threads " << trial.threads
+             << endl;
+        trials.push_back(trial);
+        return trial.realtime;
+    };
+    // double until a trial falls behind, then bisect between the last two
+    int good = 0, bad = 0;
+    for (int sessions = 1; sessions <= MAX_BENCH_SESSIONS; sessions *= 2) {
+        if (!run(sessions)) {
+            bad = sessions;
+            break;
+        }
+        good = sessions;
+    }
+    while (bad > 0 && bad - good > 1) {
+        auto sessions = (good + bad) / 2;
+        if (run(sessions))
+            good = sessions;
+        else
+            bad = sessions;
+    }
+    auto cpus = thread::hardware_concurrency();
+    cout << "{\n  \"input\": \"" << input << "\",\n  \"fps\": " << fps << ",\n  \"seconds\": " << seconds
+         << ",\n  \"num_cpus\": " << cpus << ",\n  \"io_threads\": " << ioThreads
+         << ",\n  \"decode_threads\": " << (decodeThreads > 0 ? decodeThreads : static_cast<int>(cpus))
+         << ",\n  \"compose_threads\": " << (composeThreads > 0 ? composeThreads : static_cast<int>(cpus))
+         << ",\n  \"max_sessions\": " << good << ",\n  \"sessions_per_core\": " << static_cast<double>(good) / cpus
+         << ",\n  \"trials\": [";
+    for (size_t i = 0; i < trials.size(); i++) {
+        auto &trial = trials[i];
+        cout << (i ? "," : "") << "\n    {\"sessions\": " << trial.sessions << ", \"realtime\": "
+             << (trial.realtime ? "true" : "false") << ", \"threads\": " << trial.threads << ", \"cpu_load\": "
+             << trial.cpuLoad << ", \"compose_ms\": " << trial.composeMs << ", \"decoded\": " << trial.total.decoded << ", \"shown\": " << trial.total.shown
+             << ", \"dropped\": " << trial.total.dropped << ", \"underruns\": " << trial.total.underruns << "}";
+    }
+    cout << "\n  ]\n}" << endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int width = 1920, height = 1080, fps = 30, seconds = 10, ioThreads = 2, decodeThreads = 0, composeThreads = 0;
+    int copies = 1;
+    bool benchmark = false, vsync = false;
+    vector<string> inputs;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-bench") {
+            benchmark = true;
+        } else if (arg == "-vsync") {
+            vsync = true;
+        } else if (arg == "-size" && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2)
+                usage(argv[0]);
+        } else if (arg == "-fps" && hasValue) {
+            fps = atoi(argv[++i]);
+        } else if (arg == "-seconds" && hasValue) {
+            seconds = atoi(argv[++i]);
+        } else if (arg == "-io" && hasValue) {
+            ioThreads = atoi(argv[++i]);
+        } else if (arg == "-threads" && hasValue) {
+            decodeThreads = atoi(argv[++i]);
+        } else if (arg == "-compose" && hasValue) {
+            composeThreads = atoi(argv[++i]);
+        } else if (arg == "-n" && hasValue) {
+            copies = atoi(argv[++i]);
+        } else if (arg[0] == '-') {
+            usage(argv[0]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty() || fps <= 0 || seconds <= 0 || copies <= 0 || (benchmark && inputs.size() != 1))
+        usage(argv[0]);
+    av_log_set_level(AV_LOG_ERROR);
+    if (benchmark)
+        return bench(inputs[0], fps, seconds, ioThreads, decodeThreads, composeThreads);
+
+    wall::Engine engine(ioThreads, decodeThreads, composeThreads);
+    for (auto &input : inputs) {
+        for (int i = 0; i < copies; i++) {
+            auto ret = engine.addSession(input, true);
+            if (ret < 0) {
+                cerr << "failed in open " << input << " error:" << media::errorString(ret) << endl;
+                return 1;
+            }
+        }
+    }
+    int tileWidth, tileHeight;
+    if (!wall::Compositor::tileSize(static_cast<int>(engine.size()), width, height, &tileWidth, &tileHeight)) {
+        cerr << engine.size() << " sessions do not fit on a " << width << "x" << height
+             << " wall, every tile needs at least 2x2 pixels" << endl;
+        return 1;
+    }
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
+        cerr << "failed in init sdl" << endl;
+        return 1;
+    }
+    auto window = SDL_CreateWindow("wall", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height,
+                                   SDL_WINDOW_OPENGL);
+    auto renderer = window ? SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0) : nullptr;
+    auto texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING,
+                                                width, height) : nullptr;
+    if (texture == nullptr) {
+        cerr << "failed in create window" << endl;
+        return 1;
+    }
+    auto mosaic = alloc_mosaic(width, height);
+    auto start = av_gettime_relative();
+    int64_t tick = 0;
+    // one compose and one texture upload per shown frame, however many sessions there are
+    auto show = [&](double time) {
+        engine.compose(time, mosaic);
+        SDL_UpdateYUVTexture(texture, nullptr, mosaic->data[0], mosaic->linesize[0], mosaic->data[1],
+                             mosaic->linesize[1], mosaic->data[2], mosaic->linesize[2]);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+        if (++tick % (fps * 10) == 0) {
+            wall::SessionStats total = {};
+            for (size_t i = 0; i < engine.size(); i++) {
+                auto stats = engine.session(i).stats();
+                total.shown += stats.shown;
+                total.dropped += stats.dropped;
+                total.underruns += stats.underruns;
+            }
+            auto &compositor = engine.compositor();
+            cerr << engine.size() << " sessions: shown " << total.shown << ", dropped " << total.dropped
+                 << ", underruns " << total.underruns << ", compose "
+                 << compositor.time() / 1000.0 / FFMAX(compositor.calls(), 1) << " ms on " << compositor.threads()
+                 << " threads, threads " << count_threads() << endl;
+            compositor.resetStats();
+        }
+    };
+    engine.start();
+    if (vsync) {
+        // SDL_RenderPresent() waits for the vertical blank, every refresh shows what is due by then
+        SDL_Event event;
+        auto running = true;
+        while (running) {
+            while (SDL_PollEvent(&event)) {
+                if (event.type == SDL_QUIT)
+                    running = false;
+            }
+            if (running)
+                show((av_gettime_relative() - start) / 1e6);
+        }
+        av_frame_free(&mosaic);
+        SDL_Quit();
+        return 0;
+    }
+    media::EventLoop loop;
+    thread loopThread([&loop] { loop.run(); });
+    // ticks are pushed to the main thread, which owns SDL
+    auto pushTick = [] {
+        SDL_Event event;
+        event.type = FF_WALL_TICK_EVENT;
+        SDL_PushEvent(&event);
+    };
+    loop.post(pushTick);
+    SDL_Event event;
+    while (SDL_WaitEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            break;
+        if (event.type != FF_WALL_TICK_EVENT)
+            continue;
+        show(static_cast<double>(tick) / fps);
+        loop.schedule(FFMAX(start + tick * 1000000 / fps - av_gettime_relative(), 0), pushTick);
+    }
+    loop.stop();
+    loopThread.join();
+    av_frame_free(&mosaic);
+    SDL_Quit();
+    return 0;
+}
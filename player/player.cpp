@@ -0,0 +1,675 @@
+#include "player.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+
+using namespace std;
+
+void queue_frame(VideoInfo *videoInfo, AVFrame *frame, double pts_clock) {
+    SDL_LockMutex(videoInfo->ringQMutex);
+    while (videoInfo->ringQSize == FRAME_RING_QUEUE_MAX_SIZE && !videoInfo->quit) {
+        SDL_CondWait(videoInfo->ringQCond, videoInfo->ringQMutex);
+    }
+    SDL_UnlockMutex(videoInfo->ringQMutex);
+    if (videoInfo->quit) {
+        // abort_playback() woke us up, nobody will show this frame any more
+        av_frame_free(&frame);
+        return;
+    }
+    auto ptsFrame = &videoInfo->frameRingQ[videoInfo->ringQWriteIndex];
+    /**
+     * 内存问题:谁申请谁释放
+     * 这里如何进行内存管理
+     */
+    ptsFrame->frame = frame;
+    ptsFrame->clock = pts_clock;
+    if (++videoInfo->ringQWriteIndex == FRAME_RING_QUEUE_MAX_SIZE) {
+        videoInfo->ringQWriteIndex = 0;
+    }
+    SDL_LockMutex(videoInfo->ringQMutex);
+    videoInfo->ringQSize++;
+    // the refresh timer only polls, but a consumer may also wait for the ring to fill
+    SDL_CondSignal(videoInfo->ringQCond);
+    SDL_UnlockMutex(videoInfo->ringQMutex);
+}
+
+void pop_frame(VideoInfo *videoInfo) {
+    if (++videoInfo->ringQReadIndex == FRAME_RING_QUEUE_MAX_SIZE) {
+        videoInfo->ringQReadIndex = 0;
+    }
+    SDL_LockMutex(videoInfo->ringQMutex);
+    videoInfo->ringQSize--;
+    SDL_CondSignal(videoInfo->ringQCond);
+    SDL_UnlockMutex(videoInfo->ringQMutex);
+}
+
+double syncing_video(VideoInfo *videoInfo, AVFrame *frame, double clock) {
+    if (clock > 0) {
+        videoInfo->videoClock = clock;
+    } else {
+        clock = videoInfo->videoClock;
+    }
+    auto framerate = videoInfo->videoDecoder.context()->framerate;
+    auto delay = av_q2d(av_inv_q(framerate));
+    // extra delay  = repeat_pict / (2*fps) = repeat_pict * time_base * 0.5;
+    auto extraDelay = frame->repeat_pict / (2 * av_q2d(framerate));
+    videoInfo->videoClock += (delay + extraDelay);
+    return clock;
+}
+
+void error_out(string msg, int errCode) {
+    char a[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_make_error_string(a, AV_ERROR_MAX_STRING_SIZE, errCode);
+    cerr << msg << "error:" << a << endl;
+    exit(1);
+}
+
+void notify_eos(VideoInfo *videoInfo) {
+    SDL_Event event;
+    event.type = FF_EOS_EVENT;
+    event.user.data1 = videoInfo;
+    SDL_PushEvent(&event);
+}
+
+void abort_playback(VideoInfo *videoInfo) {
+    SDL_LockMutex(videoInfo->ringQMutex);
+    videoInfo->quit = true;
+    SDL_CondBroadcast(videoInfo->ringQCond);
+    SDL_UnlockMutex(videoInfo->ringQMutex);
+    videoInfo->videoPacketList.abort();
+    videoInfo->audioPacketList.abort();
+}
+
+void print_filter_stats(VideoInfo *videoInfo) {
+    auto &filter = videoInfo->filter;
+    if (filter.frames() == 0 || !filter.configured())
+        return;
+    cerr << "filter \"" << filter.description() << "\": " << filter.frames() << " frames, "
+         << filter.time() / 1000.0 / filter.frames() << " ms/frame" << endl;
+    for (unsigned i = 0; i < filter.get()->nb_filters; ++i) {
+        auto filterCtx = filter.get()->filters[i];
+        cerr << "    " << filterCtx->name << " (" << filterCtx->filter->name << ")" << endl;
+    }
+    filter.resetStats();
+}
+
+int audio_decode_frame(VideoInfo *videoInfo, uint8_t *audio_buf, int buf_size) {
+    int ret;
+    auto timeBase = videoInfo->input.stream(videoInfo->audioIndex)->time_base;
+    for (;;) {
+        while (!videoInfo->audioNeedSendPacket) {
+            media::Frame frame;
+            ret = videoInfo->audioDecoder.receive(frame);
+            if (ret == AVERROR_EOF) {
+                // drained after the flush packet, the queue stays empty from now on
+                return ret;
+            }
+            if (ret == AVERROR(EAGAIN)) {
+                videoInfo->audioNeedSendPacket = true;
+                break;
+            }
+            videoInfo->audioClock = av_q2d(timeBase) * frame->pts;
+            if (videoInfo->resampleContext == nullptr) {
+                // from the frame rather than the stream parameters, which a fast start may not have probed
+                auto layout = frame->channel_layout ? frame->channel_layout
+                                                    : av_get_default_channel_layout(frame->channels);
+                videoInfo->resampleContext = swr_alloc_set_opts(
+                        nullptr,
+                        layout,
+                        AV_SAMPLE_FMT_FLT,
+                        frame->sample_rate,
+                        layout,
+                        static_cast<AVSampleFormat>(frame->format),
+                        frame->sample_rate,
+                        1,
+                        nullptr);
+                if (swr_init(videoInfo->resampleContext) < 0) {
+                    error_out("failed in init swr");
+                }
+            }
+            ret = swr_convert(videoInfo->resampleContext,
+                              &audio_buf,
+                              frame->nb_samples,
+                              (const uint8_t **) frame->data,
+                              frame->nb_samples);
+            if (ret < 0)
+                return ret;
+            return av_samples_get_buffer_size(nullptr, frame->channels, ret, AV_SAMPLE_FMT_FLT, 0);
+        }
+        media::Packet packet;
+        if (!videoInfo->audioPacketList.pop(packet))
+            return AVERROR_EXIT;
+        if (packet->pts != AV_NOPTS_VALUE)
+            videoInfo->audioClock = packet->pts * av_q2d(timeBase);
+        ret = videoInfo->audioDecoder.send(&packet);
+        if (ret < 0)
+            return ret;
+        videoInfo->audioNeedSendPacket = false;
+    }
+}
+
+double get_audio_clock(VideoInfo *videoInfo) {
+    auto audioClock = videoInfo->audioClock;
+    if (!videoInfo->audioOpened)
+        return audioClock;
+    auto leftBufferSize = videoInfo->audioBufferSize - videoInfo->audioBufferIndex;
+    auto audioCodecContext = videoInfo->audioDecoder.context();
+    auto bytesPerSecond = 0;
+    if (audioCodecContext) {
+        bytesPerSecond = audioCodecContext->sample_rate * audioCodecContext->channels * 4;
+    }
+    if (bytesPerSecond) {
+        audioClock -= (double) leftBufferSize / bytesPerSecond;
+    }
+    return audioClock;
+}
+
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+    auto videoInfo = static_cast<VideoInfo *>(userdata);
+    int len1, audio_size;
+    if (!videoInfo->audioOpened) {
+        // the demuxer has not opened the audio decoder yet, or there is no audio
+        memset(stream, 0, len);
+        return;
+    }
+    while (len > 0) {
+        if (videoInfo->audioBufferIndex >= videoInfo->audioBufferSize) {
+            /* We have already sent all our data; get more */
+            audio_size = audio_decode_frame(videoInfo, videoInfo->audioBuffer, sizeof(videoInfo->audioBuffer));
+            if (audio_size == AVERROR_EOF && !videoInfo->audioEnded) {
+                videoInfo->audioEnded = true;
+                notify_eos(videoInfo);
+            }
+            if (audio_size < 0) {
+                /* If error, output silence */
+                videoInfo->audioBufferSize = 1024; // arbitrary?
+                memset(videoInfo->audioBuffer, 0, videoInfo->audioBufferSize);
+            } else {
+                videoInfo->audioBufferSize = audio_size;
+            }
+            videoInfo->audioBufferIndex = 0;
+        }
+        len1 = videoInfo->audioBufferSize - videoInfo->audioBufferIndex;
+        if (len1 > len)
+            len1 = len;
+        memcpy(stream, (uint8_t *) videoInfo->audioBuffer + videoInfo->audioBufferIndex, len1);
+        len -= len1;
+        stream += len1;
+        videoInfo->audioBufferIndex += len1;
+    }
+}
+
+/**
+ * 在 delay 毫秒后让主线程刷新一帧.定时器在 eventLoop 的线程上到期,只负责 push FF_REFRESH_EVENT,
+ * SDL 的渲染仍然在主线程的 event loop 中完成(参考 sdl_timer.cpp).
+ * @param videoInfo
+ * @param delay milliseconds
+ */
+void scheduleRefresh(VideoInfo *videoInfo, int delay) {
+    videoInfo->eventLoop.schedule(delay * 1000LL, [videoInfo] {
+        SDL_Event event;
+        event.type = FF_REFRESH_EVENT;
+        event.user.data1 = videoInfo;
+        SDL_PushEvent(&event);
+    });
+}
+
+void print_startup_stats(VideoInfo *videoInfo) {
+    cerr << (videoInfo->fastStart ? "fast start" : "start") << ": first frame shown after "
+         << videoInfo->firstShownTime / 1000.0 << " ms (open and probe " << videoInfo->openTime / 1000.0 << " ms, "
+         << videoInfo->probeBytes << " bytes read; first video packet " << videoInfo->firstPacketTime / 1000.0
+         << " ms; first frame decoded " << videoInfo->firstFrameTime / 1000.0 << " ms)" << endl;
+}
+
+void print_upload_stats(VideoInfo *videoInfo) {
+    if (videoInfo->uploadFrames == 0)
+        return;
+    cerr << "upload " << videoInfo->textureWidth << "x" << videoInfo->textureHeight << ": "
+         << videoInfo->uploadFrames << " frames, " << videoInfo->uploadTime / 1000.0 / videoInfo->uploadFrames
+         << " ms/frame";
+    if (videoInfo->dirtyTiles && videoInfo->fullBytes > 0) {
+        cerr << ", " << videoInfo->skippedFrames << " unchanged, uploaded " << videoInfo->uploadBytes / 1048576.0
+             << " of " << videoInfo->fullBytes / 1048576.0 << " MB ("
+             << 100.0 * (videoInfo->fullBytes - videoInfo->uploadBytes) / videoInfo->fullBytes << "% saved)";
+    }
+    cerr << endl;
+    videoInfo->uploadFrames = 0;
+    videoInfo->uploadTime = 0;
+    videoInfo->skippedFrames = 0;
+    videoInfo->uploadBytes = 0;
+    videoInfo->fullBytes = 0;
+}
+
+// whether the width x height block at x, y of a plane is the same in both frames, x and y in plane samples
+static bool same_block(const AVFrame *a, const AVFrame *b, int plane, int x, int y, int width, int height) {
+    auto rowA = a->data[plane] + y * a->linesize[plane] + x;
+    auto rowB = b->data[plane] + y * b->linesize[plane] + x;
+    for (int i = 0; i < height; ++i) {
+        // memcmp is vectorized by libc and stops at the first difference
+        if (memcmp(rowA, rowB, width) != 0)
+            return false;
+        rowA += a->linesize[plane];
+        rowB += b->linesize[plane];
+    }
+    return true;
+}
+
+void find_dirty_tiles(const AVFrame *previous, const AVFrame *frame, vector<SDL_Rect> &rects) {
+    rects.clear();
+    auto width = frame->width, height = frame->height;
+    auto chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    for (int y = 0; y < height; y += DIRTY_TILE_SIZE) {
+        auto tileHeight = FFMIN(DIRTY_TILE_SIZE, height - y);
+        auto cy = y / 2, tileChromaHeight = FFMIN(DIRTY_TILE_SIZE / 2, chromaHeight - cy);
+        SDL_Rect run = {0, y, 0, tileHeight};
+        // one step past the last tile closes the run that reaches the right edge
+        for (int x = 0; x < width + DIRTY_TILE_SIZE; x += DIRTY_TILE_SIZE) {
+            auto dirty = false;
+            if (x < width) {
+                auto tileWidth = FFMIN(DIRTY_TILE_SIZE, width - x);
+                auto cx = x / 2, tileChromaWidth = FFMIN(DIRTY_TILE_SIZE / 2, chromaWidth - cx);
+                dirty = !same_block(previous, frame, 0, x, y, tileWidth, tileHeight) ||
+                        !same_block(previous, frame, 1, cx, cy, tileChromaWidth, tileChromaHeight) ||
+                        !same_block(previous, frame, 2, cx, cy, tileChromaWidth, tileChromaHeight);
+                if (dirty) {
+                    if (run.w == 0)
+                        run.x = x;
+                    run.w = x + tileWidth - run.x;
+                    continue;
+                }
+            }
+            if (run.w == 0)
+                continue;
+            // the same columns changed in the tile row above: grow that rect instead of adding one
+            auto merged = false;
+            for (auto &rect : rects) {
+                if (rect.x == run.x && rect.w == run.w && rect.y + rect.h == y) {
+                    rect.h += run.h;
+                    merged = true;
+                    break;
+                }
+            }
+            if (!merged)
+                rects.push_back(run);
+            run.w = 0;
+        }
+    }
+}
+
+void presentFrame(VideoInfo *videoInfo) {
+    if (videoInfo->texture == nullptr)
+        return;
+    SDL_RenderClear(videoInfo->renderer);
+    SDL_RenderCopy(videoInfo->renderer, videoInfo->texture, nullptr, nullptr);
+    SDL_RenderPresent(videoInfo->renderer);
+}
+
+void showFrame(VideoInfo *videoInfo) {
+    SDL_LockMutex(videoInfo->ringQMutex);
+    auto frame = &videoInfo->frameRingQ[videoInfo->ringQReadIndex];
+    auto yuv = frame->frame;
+    if (videoInfo->texture == nullptr || yuv->width != videoInfo->textureWidth ||
+        yuv->height != videoInfo->textureHeight) {
+        print_upload_stats(videoInfo);
+        if (videoInfo->texture != nullptr)
+            SDL_DestroyTexture(videoInfo->texture);
+        else if (videoInfo->window != nullptr)
+            SDL_SetWindowSize(videoInfo->window, yuv->width, yuv->height);
+        videoInfo->texture = SDL_CreateTexture(videoInfo->renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING,
+                                               yuv->width, yuv->height);
+        if (videoInfo->texture == nullptr)
+            error_out("failed in create texture");
+        videoInfo->textureWidth = yuv->width;
+        videoInfo->textureHeight = yuv->height;
+        // the renderer scales the texture to the window once per frame and keeps the aspect ratio
+        SDL_RenderSetLogicalSize(videoInfo->renderer, yuv->width, yuv->height);
+        // nothing in the new texture to compare against
+        videoInfo->lastShown.unref();
+    }
+    auto start = av_gettime_relative();
+    auto frameBytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, yuv->width, yuv->height, 1);
+    auto present = true;
+    videoInfo->uploadFrames++;
+    videoInfo->fullBytes += frameBytes;
+    if (videoInfo->dirtyTiles && videoInfo->lastShown->data[0] != nullptr) {
+        // the texture holds lastShown, only the tiles that differ from it go up
+        find_dirty_tiles(videoInfo->lastShown.get(), yuv, videoInfo->dirtyRects);
+        present = !videoInfo->dirtyRects.empty();
+        if (!present)
+            videoInfo->skippedFrames++;
+        for (auto &rect : videoInfo->dirtyRects) {
+            SDL_UpdateYUVTexture(videoInfo->texture, &rect,
+                                 yuv->data[0] + rect.y * yuv->linesize[0] + rect.x, yuv->linesize[0],
+                                 yuv->data[1] + rect.y / 2 * yuv->linesize[1] + rect.x / 2, yuv->linesize[1],
+                                 yuv->data[2] + rect.y / 2 * yuv->linesize[2] + rect.x / 2, yuv->linesize[2]);
+            videoInfo->uploadBytes += rect.w * rect.h + 2 * ((rect.w + 1) / 2) * ((rect.h + 1) / 2);
+        }
+    } else {
+        // straight from the frame, whatever padding the planes have
+        SDL_UpdateYUVTexture(videoInfo->texture, nullptr, yuv->data[0], yuv->linesize[0], yuv->data[1],
+                             yuv->linesize[1], yuv->data[2], yuv->linesize[2]);
+        videoInfo->uploadBytes += frameBytes;
+    }
+    videoInfo->uploadTime += av_gettime_relative() - start;
+    // an unchanged frame is not presented either, the window keeps showing the same picture
+    if (present)
+        presentFrame(videoInfo);
+    if (videoInfo->dirtyTiles) {
+        videoInfo->lastShown.unref();
+        av_frame_move_ref(videoInfo->lastShown.get(), yuv);
+    }
+//    av_frame_unref(frame); 不需要再调用这句话
+    av_frame_free(&frame->frame);
+    SDL_UnlockMutex(videoInfo->ringQMutex);
+}
+
+void videoRefreshTimer(void *data) {
+    auto videoInfo = static_cast<VideoInfo *>(data);
+    // read before the ring: once it is set the last frame is already in there
+    bool decodeFinished = videoInfo->videoDecodeFinished;
+    if (videoInfo->videoOpened && videoInfo->ringQSize > 0) {
+        auto PTSFrame = &videoInfo->frameRingQ[videoInfo->ringQReadIndex];
+        auto delay = PTSFrame->clock - videoInfo->frameLastPTSClock;
+
+        if (delay <= 0 || delay >= 1.0)
+            delay = videoInfo->frameLastDelay;
+
+        //save for next time
+        videoInfo->frameLastPTSClock = PTSFrame->clock;
+        videoInfo->frameLastDelay = delay;
+
+        auto clockDiff = PTSFrame->clock - get_audio_clock(videoInfo);
+        auto syncThreshold = delay > AV_SYNC_THRESHOLD ? delay : AV_SYNC_THRESHOLD;
+
+        if (abs(clockDiff) < AV_NO_SYNC_THRESHOLD) {
+            if (clockDiff < -syncThreshold) {
+                delay = 0;
+            } else if (clockDiff >= syncThreshold) {
+                delay *= 2;
+            }
+        }
+        videoInfo->timerClock += delay;
+        auto actualDelay = videoInfo->timerClock - av_gettime() / 1000000.0;
+        scheduleRefresh(videoInfo, actualDelay * 1000 + 0.5);
+        showFrame(videoInfo);
+        pop_frame(videoInfo);
+        if (videoInfo->firstShownTime == 0) {
+            videoInfo->firstShownTime = av_gettime_relative() - videoInfo->startTime;
+            print_startup_stats(videoInfo);
+        }
+        if (videoInfo->uploadFrames == UPLOAD_STATS_INTERVAL)
+            print_upload_stats(videoInfo);
+    } else if (decodeFinished) {
+        // the last frame was shown, stop refreshing
+        videoInfo->videoEnded = true;
+        notify_eos(videoInfo);
+    } else {
+        scheduleRefresh(videoInfo, videoInfo->videoOpened || videoInfo->fastStart ? 10 : 100);
+    }
+}
+
+/**
+ * Pull every frame the graph has ready and queue it for display.
+ * @return 0 once the graph needs more input, a negative error code otherwise
+ */
+int filter_output(VideoInfo *videoInfo, media::Frame &frame) {
+    int ret;
+    while (true) {
+        ret = videoInfo->filter.pull(frame);
+        if (AVERROR(EAGAIN) == ret || AVERROR_EOF == ret) {
+            return 0;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        auto scaledFrame = av_frame_alloc();
+        if (frame->format == AV_PIX_FMT_YUV420P) {
+            // the texture takes it as it is, no conversion and no copy
+            av_frame_move_ref(scaledFrame, frame.get());
+        } else {
+            // the graph output, not the decoder, decides the size and the format
+            videoInfo->swsContext = sws_getCachedContext(videoInfo->swsContext,
+                                                         frame->width, frame->height,
+                                                         static_cast<AVPixelFormat>(frame->format),
+                                                         frame->width, frame->height, AV_PIX_FMT_YUV420P,
+                                                         SWS_BICUBIC, nullptr, nullptr, nullptr);
+            scaledFrame->format = AV_PIX_FMT_YUV420P;
+            scaledFrame->width = frame->width;
+            scaledFrame->height = frame->height;
+            if (videoInfo->swsContext == nullptr || (ret = av_frame_get_buffer(scaledFrame, 0)) < 0) {
+                av_frame_free(&scaledFrame);
+                return videoInfo->swsContext == nullptr ? AVERROR(EINVAL) : ret;
+            }
+            av_frame_copy_props(scaledFrame, frame.get());
+            sws_scale(videoInfo->swsContext,
+                      frame->data,
+                      frame->linesize,
+                      0,
+                      frame->height,
+                      scaledFrame->data,
+                      scaledFrame->linesize);
+        }
+        double framePTSClock =
+                av_q2d(videoInfo->input.stream(videoInfo->videoIndex)->time_base) *
+                scaledFrame->best_effort_timestamp;
+        auto ptsClock = syncing_video(videoInfo, scaledFrame, framePTSClock);
+        queue_frame(videoInfo, scaledFrame, ptsClock);
+        frame.unref();
+    }
+}
+
+/**
+ * (Re)build the graph when the decoded frame no longer matches the buffersrc
+ * parameters or a new description was typed; otherwise keep the current graph.
+ */
+int configure_filter(VideoInfo *videoInfo, const AVFrame *frame, media::Frame &filtered) {
+    string description;
+    bool descriptionChanged;
+    {
+        lock_guard<mutex> lock(videoInfo->filterDescriptionMutex);
+        descriptionChanged = videoInfo->filterDescriptionChanged;
+        videoInfo->filterDescriptionChanged = false;
+        description = descriptionChanged ? videoInfo->pendingFilterDescription : videoInfo->filterDescription;
+    }
+    bool inputChanged = !videoInfo->filter.matches(frame);
+    if (!inputChanged && !descriptionChanged)
+        return 0;
+    if (videoInfo->filter.configured()) {
+        print_filter_stats(videoInfo);
+        if (inputChanged) {
+            // the old graph can not take this frame any more, flush what it still holds
+            videoInfo->filter.push(nullptr);
+            auto ret = filter_output(videoInfo, filtered);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    auto ret = videoInfo->filter.configure(frame, videoInfo->input.stream(videoInfo->videoIndex)->time_base,
+                                           description, videoInfo->filterThreads);
+    if (ret < 0 && !inputChanged) {
+        // a bad description typed at runtime keeps the current graph running
+        cerr << "failed in init filter \"" << description << "\" error:" << media::errorString(ret) << ", keep \""
+             << videoInfo->filter.description() << "\"" << endl;
+        return 0;
+    }
+    return ret;
+}
+
+// stdin 可读时由 eventLoop 调用:每读到一行,就把它作为新的 filter description,解码线程在下一帧之前重建 graph
+void filterCommandFunction(VideoInfo *videoInfo, int events) {
+    char buf[4096];
+    auto n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0) {
+        // stdin 关闭了,不再监听
+        videoInfo->eventLoop.unwatch(STDIN_FILENO);
+        return;
+    }
+    videoInfo->filterCommandBuffer.append(buf, n);
+    size_t pos;
+    while ((pos = videoInfo->filterCommandBuffer.find('\n')) != string::npos) {
+        auto line = videoInfo->filterCommandBuffer.substr(0, pos);
+        videoInfo->filterCommandBuffer.erase(0, pos + 1);
+        if (line.empty())
+            continue;
+        lock_guard<mutex> lock(videoInfo->filterDescriptionMutex);
+        videoInfo->pendingFilterDescription = line;
+        videoInfo->filterDescriptionChanged = true;
+    }
+}
+
+void decodeVideo(VideoInfo *videoInfo) {
+    media::Frame frame;
+    media::Frame filtered;
+    while (!videoInfo->quit) {
+        media::Packet packet;
+        if (!videoInfo->videoPacketList.pop(packet))
+            break;
+        // on the flush packet the decoder gives out what it still holds and then AVERROR_EOF
+        auto flush = packet.isFlush();
+        videoInfo->videoDecoder.send(&packet);
+        int ret;
+        do {
+            ret = videoInfo->videoDecoder.receive(frame);
+            if (ret == AVERROR_EOF || AVERROR(EAGAIN) == ret) {
+                break;
+            }
+            if (ret < 0) {
+                error_out("decode video:failed in receive frame", ret);
+            }
+            if (videoInfo->firstFrameTime == 0)
+                videoInfo->firstFrameTime = av_gettime_relative() - videoInfo->startTime;
+            ret = configure_filter(videoInfo, frame.get(), filtered);
+            if (ret < 0) {
+                error_out("failed in init filter", ret);
+            }
+            ret = videoInfo->filter.push(&frame);
+            frame.unref();
+            if (ret < 0) {
+                error_out("failed in buffersrc add frame", ret);
+            }
+            ret = filter_output(videoInfo, filtered);
+            if (ret < 0) {
+                error_out("failed iin buffer sink get frame", ret);
+            }
+            if (videoInfo->filter.frames() >= FILTER_STATS_INTERVAL) {
+                print_filter_stats(videoInfo);
+            }
+        } while (ret == 0);
+        if (flush) {
+            // drain the graph too, then everything is in the ring
+            if (videoInfo->filter.configured()) {
+                ret = videoInfo->filter.push(nullptr);
+                if (ret >= 0)
+                    ret = filter_output(videoInfo, filtered);
+                if (ret < 0)
+                    error_out("failed in flush filter", ret);
+            }
+            videoInfo->videoDecodeFinished = true;
+            break;
+        }
+    }
+    print_filter_stats(videoInfo);
+    videoInfo->filter.reset();
+    cerr << "video decode thread exit" << endl;
+}
+
+/**
+ * Open the decoder of stream index when it is the first audio or the first video stream,
+ * and start the video decode thread for the video one.
+ */
+static void open_stream(VideoInfo *videoInfo, int index) {
+    auto stream = videoInfo->input.stream(index);
+    int ret;
+    switch (stream->codecpar->codec_type) {
+        case AVMEDIA_TYPE_AUDIO: {
+            if (videoInfo->audioIndex != -1)
+                return;
+            ret = videoInfo->audioDecoder.open(stream);
+            if (ret < 0) {
+                error_out("failed in open audio decoder", ret);
+            }
+            // the resampler follows on the first decoded frame, see audio_decode_frame()
+            videoInfo->audioIndex = index;
+            videoInfo->audioOpened = true;
+            break;
+        }
+        case AVMEDIA_TYPE_VIDEO: {
+            if (videoInfo->videoIndex != -1)
+                return;
+            ret = videoInfo->videoDecoder.open(stream);
+            if (ret < 0) {
+                error_out("failed in open video decoder", ret);
+            }
+            videoInfo->videoIndex = index;
+            videoInfo->timerClock = av_gettime() / 1000000.0;
+            videoInfo->frameLastDelay = 40e-3;
+            videoInfo->videoOpened = true;
+            if (videoInfo->decodeVideoThread == nullptr) {
+                videoInfo->decodeVideoThread = make_shared<thread>(decodeVideo, videoInfo);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void demuxerFunction(VideoInfo *videoInfo) {
+    int ret = -1;
+    auto formatContext = videoInfo->input.get();
+    // a fast start opens each decoder when the first packet of its stream arrives instead
+    if (!videoInfo->fastStart) {
+        for (int i = 0; i < formatContext->nb_streams; ++i) {
+            open_stream(videoInfo, i);
+        }
+        if (videoInfo->videoIndex == -1)
+            videoInfo->videoDecodeFinished = true;
+        if (videoInfo->audioIndex == -1)
+            videoInfo->audioEnded = true;
+    }
+    // nothing before the first keyframe can be shown, a fast start does not decode it
+    bool keyframeSeen = !videoInfo->fastStart;
+    while (!videoInfo->quit) {
+        media::Packet packet;
+        ret = videoInfo->input.read(packet);
+        if (ret == AVERROR(EAGAIN)) {
+            // FFmpeg does not expose the fd behind the AVIOContext, so there is nothing for the
+            // event loop to watch; a custom AVIOContext can not return EAGAIN without ending the stream
+            SDL_Delay(10);
+            continue;
+        }
+        if (ret == AVERROR_EOF) {
+            // 在每个队列的最后放一个 flush packet,把 end of stream 传给解码线程和音频回调,然后 demuxer 线程结束
+            if (videoInfo->videoIndex != -1)
+                videoInfo->videoPacketList.push(media::Packet());
+            else
+                videoInfo->videoDecodeFinished = true;
+            if (videoInfo->audioIndex != -1)
+                videoInfo->audioPacketList.push(media::Packet());
+            else
+                videoInfo->audioEnded = true;
+            break;
+        }
+        if (ret < 0) {
+            error_out("failed in read packet");
+            return;
+        }
+        auto index = packet->stream_index;
+        if (videoInfo->fastStart && index != videoInfo->videoIndex && index != videoInfo->audioIndex) {
+            open_stream(videoInfo, index);
+        }
+        // 队列满的时候阻塞在这里,直到解码线程取走 packet;其他 stream 的 packet 由 media::Packet 析构时释放
+        if (index == videoInfo->videoIndex) {
+            if (!keyframeSeen && !(packet->flags & AV_PKT_FLAG_KEY))
+                continue;
+            keyframeSeen = true;
+            if (videoInfo->firstPacketTime == 0)
+                videoInfo->firstPacketTime = av_gettime_relative() - videoInfo->startTime;
+            videoInfo->videoPacketList.push(std::move(packet));
+        } else if (index == videoInfo->audioIndex) {
+            videoInfo->audioPacketList.push(std::move(packet));
+        }
+    }
+}
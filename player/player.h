@@ -0,0 +1,257 @@
+//
+// play_video 的播放器状态和各线程的函数,play_video 和 bench 都链接它
+//
+
+#ifndef LEARNFFMPEG_PLAYER_H
+#define LEARNFFMPEG_PLAYER_H
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+#include <libavutil/avutil.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_audio.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+#include <libavutil/time.h>
+}
+
+#include "media/event_loop.h"
+#include "media/media.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+
+#define FF_REFRESH_EVENT (SDL_USEREVENT)
+#define  FF_QUIT_EVENT SDL_USEREVENT+1
+// the audio or the video sink played its last frame
+#define FF_EOS_EVENT (SDL_USEREVENT + 2)
+#define FRAME_RING_QUEUE_MAX_SIZE 1
+// demuxed packets waiting for each decoder, the demuxer blocks beyond this
+#define PACKET_QUEUE_MAX_SIZE 256
+#define MAX_AUDIO_FRAME_SIZE 192000
+
+// 每处理这么多帧输出一次 filter 耗时
+#define FILTER_STATS_INTERVAL 250
+// 每显示这么多帧输出一次纹理上传耗时
+#define UPLOAD_STATS_INTERVAL 250
+// 开启 dirtyTiles 时逐块比较新帧和上一帧的块大小(亮度像素)
+#define DIRTY_TILE_SIZE 64
+
+#define AV_SYNC_THRESHOLD 0.01
+#define AV_NO_SYNC_THRESHOLD 10.0
+
+class FrameWithClock {
+public:
+    FrameWithClock() {
+        frame = nullptr;
+        clock = 0;
+    }
+
+    AVFrame *frame;
+    double clock;
+};
+
+using PacketQueue = media::BoundedQueue<media::Packet>;
+
+class VideoInfo {
+public:
+    VideoInfo() : videoPacketList(PACKET_QUEUE_MAX_SIZE), audioPacketList(PACKET_QUEUE_MAX_SIZE) {
+        videoIndex = -1;
+        audioIndex = -1;
+        quit = false;
+        ringQMutex = SDL_CreateMutex();
+        ringQCond = SDL_CreateCond();
+        ringQSize = 0;
+        ringQWriteIndex = 0;
+        ringQReadIndex = 0;
+        videoClock = 0;
+        audioClock = 0;
+        timerClock = 0;
+        frameLastDelay = 0;
+        frameLastPTSClock = 0;
+        filterThreads = 0;
+        filterDescriptionChanged = false;
+        videoDecodeFinished = false;
+        videoEnded = false;
+        audioEnded = false;
+        swsContext = nullptr;
+        window = nullptr;
+        renderer = nullptr;
+        texture = nullptr;
+        textureWidth = 0;
+        textureHeight = 0;
+        uploadFrames = 0;
+        uploadTime = 0;
+        dirtyTiles = false;
+        skippedFrames = 0;
+        uploadBytes = 0;
+        fullBytes = 0;
+        resampleContext = nullptr;
+        audioNeedSendPacket = true;
+        videoOpened = false;
+        audioOpened = false;
+        fastStart = false;
+        startTime = av_gettime_relative();
+        openTime = 0;
+        probeBytes = 0;
+        firstPacketTime = 0;
+        firstFrameTime = 0;
+        firstShownTime = 0;
+    };
+    media::InputFormat input;
+    PacketQueue videoPacketList;
+    int videoIndex;
+    media::StreamDecoder videoDecoder;
+
+    FrameWithClock frameRingQ[FRAME_RING_QUEUE_MAX_SIZE];
+    SDL_mutex *ringQMutex;
+    SDL_cond *ringQCond;
+    int ringQSize;
+    int ringQReadIndex;
+    int ringQWriteIndex;
+
+    std::shared_ptr<std::thread> decodeVideoThread;
+    // converts graph output that is not YUV420P already, at the same size
+    SwsContext *swsContext;
+    // set by the main thread; texture is (re)created by showFrame() at the size of the frame
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    int textureWidth;
+    int textureHeight;
+    // frames given to showFrame() and microseconds spent comparing and uploading them since the last report
+    int64_t uploadFrames;
+    int64_t uploadTime;
+    // upload only the tiles that changed since lastShown and skip presenting unchanged frames
+    bool dirtyTiles;
+    media::Frame lastShown;
+    std::vector<SDL_Rect> dirtyRects;
+    int64_t skippedFrames;
+    // bytes uploaded and bytes full frame uploads would have taken
+    int64_t uploadBytes;
+    int64_t fullBytes;
+
+    //filter
+    media::VideoFilterGraph filter;
+    std::string filterDescription;
+    // graph->nb_threads, 0 means automatic
+    int filterThreads;
+    // a description typed on stdin, applied by the decode thread before the next frame
+    std::mutex filterDescriptionMutex;
+    std::string pendingFilterDescription;
+    bool filterDescriptionChanged;
+    // stdin read so far that does not end in a newline yet
+    std::string filterCommandBuffer;
+    // A/V syncing
+    double videoClock;
+    double timerClock;
+    double frameLastDelay;
+    double frameLastPTSClock;
+
+    int audioIndex;
+    media::StreamDecoder audioDecoder;
+    // to packed float, created from the first decoded frame
+    SwrContext *resampleContext;
+    PacketQueue audioPacketList;
+    double audioClock;
+    uint8_t audioBuffer[MAX_AUDIO_FRAME_SIZE * 3 / 2];
+    unsigned int audioBufferSize;
+    unsigned int audioBufferIndex;
+
+    bool quit;
+    bool audioNeedSendPacket;
+
+    // End of stream: the demuxer puts a flush packet into both queues. decodeVideo() drains the
+    // decoder and the graph into the ring and sets videoDecodeFinished, videoRefreshTimer() sets
+    // videoEnded once the ring is empty, audio_callback() sets audioEnded once the decoder is
+    // drained. Both send FF_EOS_EVENT and schedule nothing more.
+    std::atomic<bool> videoDecodeFinished;
+    std::atomic<bool> videoEnded;
+    std::atomic<bool> audioEnded;
+
+    // set by the demuxer once videoIndex/audioIndex and the decoder are ready for the other threads
+    std::atomic<bool> videoOpened;
+    std::atomic<bool> audioOpened;
+
+    // Fast start: the input was opened with media::fastStartOptions(), every decoder is opened on the
+    // first packet of its stream and video packets before the first keyframe are dropped.
+    bool fastStart;
+    // av_gettime_relative() when playback was started; the others are microseconds after it
+    // when the step finished, 0 until then
+    int64_t startTime;
+    int64_t openTime;
+    // bytes read from the input by opening and probing it
+    int64_t probeBytes;
+    std::atomic<int64_t> firstPacketTime;
+    std::atomic<int64_t> firstFrameTime;
+    int64_t firstShownTime;
+
+    // refresh timers and the stdin watch, run() on a thread of its own
+    media::EventLoop eventLoop;
+};
+
+void queue_frame(VideoInfo *videoInfo, AVFrame *frame, double pts_clock);
+
+// drop the frame at the read index once it was shown and wake queue_frame()
+void pop_frame(VideoInfo *videoInfo);
+
+double syncing_video(VideoInfo *videoInfo, AVFrame *frame, double clock);
+
+void error_out(std::string msg, int errCode = 0);
+
+void print_filter_stats(VideoInfo *videoInfo);
+
+int audio_decode_frame(VideoInfo *videoInfo, uint8_t *audio_buf, int buf_size);
+
+double get_audio_clock(VideoInfo *videoInfo);
+
+void audio_callback(void *userdata, Uint8 *stream, int len);
+
+void scheduleRefresh(VideoInfo *videoInfo, int delay);
+
+// upload the frame at the read index plane by plane and present it, scaled to the window by the renderer
+void showFrame(VideoInfo *videoInfo);
+
+void print_upload_stats(VideoInfo *videoInfo);
+
+/**
+ * Compare frame with previous, both YUV420P of the same size, in DIRTY_TILE_SIZE tiles over all three
+ * planes. Changed tiles next to each other in a row, and rows of them with the same columns, are merged.
+ * @param rects the changed regions in luma pixels, empty when the frames are the same
+ */
+void find_dirty_tiles(const AVFrame *previous, const AVFrame *frame, std::vector<SDL_Rect> &rects);
+
+// draw the texture again, e.g. after the window was exposed while unchanged frames were not presented
+void presentFrame(VideoInfo *videoInfo);
+
+void videoRefreshTimer(void *data);
+
+int filter_output(VideoInfo *videoInfo, media::Frame &frame);
+
+int configure_filter(VideoInfo *videoInfo, const AVFrame *frame, media::Frame &filtered);
+
+void filterCommandFunction(VideoInfo *videoInfo, int events);
+
+void decodeVideo(VideoInfo *videoInfo);
+
+void demuxerFunction(VideoInfo *videoInfo);
+
+// print how long each step up to the first shown frame took
+void print_startup_stats(VideoInfo *videoInfo);
+
+// tell the main thread that a sink finished, see videoEnded
+void notify_eos(VideoInfo *videoInfo);
+
+// wake queue_frame() and the packet queues so that every thread returns, call with quit set
+void abort_playback(VideoInfo *videoInfo);
+
+#endif //LEARNFFMPEG_PLAYER_H
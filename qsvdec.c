@@ -26,22 +26,84 @@
  * @example qsvdec.c
  * This example shows how to do QSV-accelerated H.264 decoding with output
  * frames in the GPU video surfaces.
+ *
+ * The decoder is driven through a DecodeBackend. Besides "qsv" there is a
+ * software backend, "sw", which runs on any machine: it decodes with the
+ * libavcodec H.264 decoder into a fixed pool of SURFACE_POOL_SIZE surfaces
+ * (plus one per frame thread) that are preallocated in one block and handed
+ * out round-robin, the same semantics as the QSV frames pool. Frames are
+ * then already in system memory, so there is no download.
+ *
+ * At the end the tool prints the decode rate, the surface pool footprint and
+ * the peak resident set size. An output file of "-" skips writing the frames.
+ *
+ * The "qsv" backend needs FFmpeg built with libmfx and the mfx headers; it is
+ * only compiled in with QSVDEC_WITH_QSV defined (the CMake option of the same
+ * name), the "sw" backend is always there.
  */
-#include "config.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
 #include "libavcodec/avcodec.h"
 #include "libavutil/buffer.h"
 #include "libavutil/error.h"
 #include "libavutil/hwcontext.h"
+#if QSVDEC_WITH_QSV
 #include "libavutil/hwcontext_qsv.h"
+#endif
+#include "libavutil/imgutils.h"
 #include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+
+#ifndef QSVDEC_WITH_QSV
+#define QSVDEC_WITH_QSV 0
+#endif
+
+#define SURFACE_POOL_SIZE 32
+#define MAX_SURFACES 128
+
+/* One generation of software surfaces, replaced when the frame size changes. */
+typedef struct SurfacePool {
+    pthread_mutex_t mutex;
+    /* the owner plus one per surface in use; freed at zero */
+    int refs;
+    uint8_t *memory;
+    size_t surface_size;
+    int nb_surfaces;
+    int next;
+    int in_use[MAX_SURFACES];
+    int nb_in_use, max_in_use;
+    int width, height;
+    enum AVPixelFormat format;
+    int linesize[4];
+    size_t plane_offset[4];
+} SurfacePool;
 
 typedef struct DecodeContext {
     AVBufferRef *hw_device_ref;
+    /* guards pool and pool_bytes, get_buffer2() may be called from the frame threads */
+    pthread_mutex_t mutex;
+    SurfacePool *pool;
+    /* bytes of all surface pools allocated so far and the pools' peak use */
+    size_t pool_bytes;
+    int max_in_use;
 } DecodeContext;
 
+typedef struct DecodeBackend {
+    const char *name;
+    const char *decoder_name;
+    /* set up the decoder context before avcodec_open2() */
+    int (*init)(DecodeContext *decode, AVCodecContext *avctx);
+    /* return the decoded frame in system memory, in sw_frame when it had to be downloaded */
+    int (*retrieve)(AVFrame *frame, AVFrame *sw_frame, AVFrame **out);
+    void (*uninit)(DecodeContext *decode);
+} DecodeBackend;
+
+#if QSVDEC_WITH_QSV
 static int get_format(AVCodecContext *avctx, const enum AVPixelFormat *pix_fmts) {
     while (*pix_fmts != AV_PIX_FMT_NONE) {
         if (*pix_fmts == AV_PIX_FMT_QSV) {
@@ -59,11 +121,14 @@ static int get_format(AVCodecContext *avctx, const enum AVPixelFormat *pix_fmts)
             frames_ctx->sw_format = avctx->sw_pix_fmt;
             frames_ctx->width = FFALIGN(avctx->coded_width, 32);
             frames_ctx->height = FFALIGN(avctx->coded_height, 32);
-            frames_ctx->initial_pool_size = 32;
+            frames_ctx->initial_pool_size = SURFACE_POOL_SIZE;
             frames_hwctx->frame_type = MFX_MEMTYPE_VIDEO_MEMORY_DECODER_TARGET;
             ret = av_hwframe_ctx_init(avctx->hw_frames_ctx);
             if (ret < 0)
                 return AV_PIX_FMT_NONE;
+            decode->pool_bytes += (size_t) SURFACE_POOL_SIZE *
+                                  av_image_get_buffer_size(avctx->sw_pix_fmt, frames_ctx->width,
+                                                           frames_ctx->height, 1);
             return AV_PIX_FMT_QSV;
         }
         pix_fmts++;
@@ -72,7 +137,186 @@ static int get_format(AVCodecContext *avctx, const enum AVPixelFormat *pix_fmts)
     return AV_PIX_FMT_NONE;
 }
 
-static int decode_packet(DecodeContext *decode, AVCodecContext *decoder_ctx,
+static int qsv_init(DecodeContext *decode, AVCodecContext *avctx) {
+    /* open the hardware device */
+    int ret = av_hwdevice_ctx_create(&decode->hw_device_ref, AV_HWDEVICE_TYPE_QSV,
+                                     "auto", NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open the hardware device, try -backend sw\n");
+        return ret;
+    }
+    avctx->get_format = get_format;
+    return 0;
+}
+
+static int qsv_retrieve(AVFrame *frame, AVFrame *sw_frame, AVFrame **out) {
+    int ret = av_hwframe_transfer_data(sw_frame, frame, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Error transferring the data to system memory\n");
+        return ret;
+    }
+    *out = sw_frame;
+    return 0;
+}
+
+static void qsv_uninit(DecodeContext *decode) {
+    av_buffer_unref(&decode->hw_device_ref);
+}
+#endif
+
+static void surface_pool_unref(SurfacePool *pool) {
+    int refs;
+    pthread_mutex_lock(&pool->mutex);
+    refs = --pool->refs;
+    pthread_mutex_unlock(&pool->mutex);
+    if (refs)
+        return;
+    pthread_mutex_destroy(&pool->mutex);
+    av_free(pool->memory);
+    av_free(pool);
+}
+
+static void surface_release(void *opaque, uint8_t *data) {
+    SurfacePool *pool = opaque;
+    int index = (data - pool->memory) / pool->surface_size;
+    pthread_mutex_lock(&pool->mutex);
+    pool->in_use[index] = 0;
+    pool->nb_in_use--;
+    pthread_mutex_unlock(&pool->mutex);
+    surface_pool_unref(pool);
+}
+
+static SurfacePool *surface_pool_alloc(AVCodecContext *avctx, const AVFrame *frame) {
+    SurfacePool *pool = av_mallocz(sizeof(*pool));
+    int w = frame->width, h = frame->height, linesize_align[AV_NUM_DATA_POINTERS];
+    uint8_t *data[4];
+    int i, size;
+    if (!pool)
+        return NULL;
+    pool->format = frame->format;
+    pool->width = frame->width;
+    pool->height = frame->height;
+    /* the same geometry the default get_buffer2() would use, aligned like the QSV surfaces */
+    avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+    w = FFALIGN(w, 32);
+    h = FFALIGN(h, 32);
+    if (av_image_fill_linesizes(pool->linesize, pool->format, w) < 0)
+        goto fail;
+    for (i = 0; i < 4; i++)
+        pool->linesize[i] = FFALIGN(pool->linesize[i], 64);
+    size = av_image_fill_pointers(data, pool->format, h, NULL, pool->linesize);
+    if (size < 0)
+        goto fail;
+    for (i = 0; i < 4; i++)
+        pool->plane_offset[i] = data[i] ? (size_t) (data[i] - data[0]) : 0;
+    /* decoders may read a little past the end of a plane */
+    pool->surface_size = FFALIGN(size + 64, 64);
+    /* frame threads hold one surface each on top of the QSV sized pool */
+    pool->nb_surfaces = FFMIN(SURFACE_POOL_SIZE + FFMAX(avctx->thread_count, 1), MAX_SURFACES);
+    pool->memory = av_malloc(pool->surface_size * pool->nb_surfaces);
+    if (!pool->memory)
+        goto fail;
+    pool->refs = 1;
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+    fail:
+    av_free(pool);
+    return NULL;
+}
+
+/* Hand out the next free surface of the preallocated pool, round-robin. */
+static int sw_get_buffer(AVCodecContext *avctx, AVFrame *frame, int flags) {
+    DecodeContext *decode = avctx->opaque;
+    SurfacePool *pool;
+    int i, index = -1;
+    pthread_mutex_lock(&decode->mutex);
+    pool = decode->pool;
+    if (!pool || pool->format != frame->format || pool->width != frame->width ||
+        pool->height != frame->height) {
+        SurfacePool *new_pool = surface_pool_alloc(avctx, frame);
+        if (!new_pool) {
+            pthread_mutex_unlock(&decode->mutex);
+            return AVERROR(ENOMEM);
+        }
+        if (pool) {
+            decode->max_in_use = FFMAX(decode->max_in_use, pool->max_in_use);
+            /* surfaces still referenced keep the old generation alive */
+            surface_pool_unref(pool);
+        }
+        decode->pool = pool = new_pool;
+        decode->pool_bytes += pool->surface_size * pool->nb_surfaces;
+    }
+    /* lock the pool before the swap can be seen, so another thread can not drop it under us */
+    pthread_mutex_lock(&pool->mutex);
+    pthread_mutex_unlock(&decode->mutex);
+    for (i = 0; i < pool->nb_surfaces; i++) {
+        int candidate = (pool->next + i) % pool->nb_surfaces;
+        if (!pool->in_use[candidate]) {
+            index = candidate;
+            break;
+        }
+    }
+    if (index >= 0) {
+        pool->in_use[index] = 1;
+        pool->next = (index + 1) % pool->nb_surfaces;
+        pool->refs++;
+        pool->max_in_use = FFMAX(pool->max_in_use, ++pool->nb_in_use);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    if (index < 0) {
+        fprintf(stderr, "All %d surfaces are in use\n", pool->nb_surfaces);
+        return AVERROR(ENOMEM);
+    }
+    frame->buf[0] = av_buffer_create(pool->memory + index * pool->surface_size, pool->surface_size,
+                                     surface_release, pool, 0);
+    if (!frame->buf[0]) {
+        surface_release(pool, pool->memory + index * pool->surface_size);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < 4; i++) {
+        if (!pool->linesize[i])
+            break;
+        frame->data[i] = frame->buf[0]->data + pool->plane_offset[i];
+        frame->linesize[i] = pool->linesize[i];
+    }
+    return 0;
+}
+
+static int sw_init(DecodeContext *decode, AVCodecContext *avctx) {
+    avctx->get_buffer2 = sw_get_buffer;
+    avctx->thread_count = 0;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 134, 100)
+    /* sw_get_buffer locks the pool; without this the frame threads hand every
+     * get_buffer2 call back to the user thread and allocation is serialized */
+    avctx->thread_safe_callbacks = 1;
+#endif
+    return 0;
+}
+
+static int sw_retrieve(AVFrame *frame, AVFrame *sw_frame, AVFrame **out) {
+    *out = frame;
+    return 0;
+}
+
+static void sw_uninit(DecodeContext *decode) {
+    if (decode->pool) {
+        decode->max_in_use = FFMAX(decode->max_in_use, decode->pool->max_in_use);
+        surface_pool_unref(decode->pool);
+        decode->pool = NULL;
+    }
+}
+
+/* the first one is the default */
+static const DecodeBackend backends[] = {
+#if QSVDEC_WITH_QSV
+    { "qsv", "h264_qsv", qsv_init, qsv_retrieve, qsv_uninit },
+#endif
+    { "sw",  "h264",     sw_init,  sw_retrieve,  sw_uninit  },
+};
+
+static int64_t frame_count;
+
+static int decode_packet(const DecodeBackend *backend, AVCodecContext *decoder_ctx,
                          AVFrame *frame, AVFrame *sw_frame,
                          AVPacket *pkt, AVIOContext *output_ctx) {
     int ret = 0;
@@ -82,6 +326,9 @@ static int decode_packet(DecodeContext *decode, AVCodecContext *decoder_ctx,
         return ret;
     }
     while (ret >= 0) {
+        const AVPixFmtDescriptor *desc;
+        AVFrame *out;
+        int row_size[4];
         int i, j;
         ret = avcodec_receive_frame(decoder_ctx, frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
@@ -90,17 +337,26 @@ static int decode_packet(DecodeContext *decode, AVCodecContext *decoder_ctx,
             fprintf(stderr, "Error during decoding\n");
             return ret;
         }
+        frame_count++;
+        if (!output_ctx) {
+            av_frame_unref(frame);
+            continue;
+        }
         /* A real program would do something useful with the decoded frame here.
          * We just retrieve the raw data and write it to a file, which is rather
          * useless but pedagogic. */
-        ret = av_hwframe_transfer_data(sw_frame, frame, 0);
-        if (ret < 0) {
-            fprintf(stderr, "Error transferring the data to system memory\n");
+        ret = backend->retrieve(frame, sw_frame, &out);
+        if (ret < 0)
+            goto fail;
+        desc = av_pix_fmt_desc_get(out->format);
+        ret = av_image_fill_linesizes(row_size, out->format, out->width);
+        if (ret < 0 || !desc)
             goto fail;
+        for (i = 0; i < FF_ARRAY_ELEMS(out->data) && out->data[i]; i++) {
+            int h = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(out->height, desc->log2_chroma_h) : out->height;
+            for (j = 0; j < h; j++)
+                avio_write(output_ctx, out->data[i] + j * out->linesize[i], row_size[i]);
         }
-        for (i = 0; i < FF_ARRAY_ELEMS(sw_frame->data) && sw_frame->data[i]; i++)
-            for (j = 0; j < (sw_frame->height >> (i > 0)); j++)
-                avio_write(output_ctx, sw_frame->data[i] + j * sw_frame->linesize[i], sw_frame->width);
         fail:
         av_frame_unref(sw_frame);
         av_frame_unref(frame);
@@ -115,13 +371,31 @@ int main(int argc, char **argv) {
     AVStream *video_st = NULL;
     AVCodecContext *decoder_ctx = NULL;
     const AVCodec *decoder;
+    const DecodeBackend *backend = &backends[0];
     AVPacket pkt = {0};
     AVFrame *frame = NULL, *sw_frame = NULL;
     DecodeContext decode = {NULL};
     AVIOContext *output_ctx = NULL;
-    int ret, i;
+    struct rusage usage;
+    int64_t start = 0, elapsed;
+    int ret = 0, i;
+    pthread_mutex_init(&decode.mutex, NULL);
+    if (argc > 2 && !strcmp(argv[1], "-backend")) {
+        for (i = 0; i < FF_ARRAY_ELEMS(backends); i++) {
+            if (!strcmp(argv[2], backends[i].name))
+                backend = &backends[i];
+        }
+        if (strcmp(argv[2], backend->name)) {
+            fprintf(stderr, "Unknown backend '%s'\n", argv[2]);
+            return 1;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-backend %s] <input file> <output file>|-\n", argv[0],
+                QSVDEC_WITH_QSV ? "qsv|sw" : "sw");
         return 1;
     }
     /* open the input file */
@@ -142,17 +416,10 @@ int main(int argc, char **argv) {
         fprintf(stderr, "No H.264 video stream in the input file\n");
         goto finish;
     }
-    /* open the hardware device */
-    ret = av_hwdevice_ctx_create(&decode.hw_device_ref, AV_HWDEVICE_TYPE_QSV,
-                                 "auto", NULL, 0);
-    if (ret < 0) {
-        fprintf(stderr, "Cannot open the hardware device\n");
-        goto finish;
-    }
     /* initialize the decoder */
-    decoder = avcodec_find_decoder_by_name("h264_qsv");
+    decoder = avcodec_find_decoder_by_name(backend->decoder_name);
     if (!decoder) {
-        fprintf(stderr, "The QSV decoder is not present in libavcodec\n");
+        fprintf(stderr, "The %s decoder is not present in libavcodec\n", backend->decoder_name);
         goto finish;
     }
     decoder_ctx = avcodec_alloc_context3(decoder);
@@ -173,17 +440,21 @@ int main(int argc, char **argv) {
         decoder_ctx->extradata_size = video_st->codecpar->extradata_size;
     }
     decoder_ctx->opaque = &decode;
-    decoder_ctx->get_format = get_format;
+    ret = backend->init(&decode, decoder_ctx);
+    if (ret < 0)
+        goto finish;
     ret = avcodec_open2(decoder_ctx, NULL, NULL);
     if (ret < 0) {
         fprintf(stderr, "Error opening the decoder: ");
         goto finish;
     }
     /* open the output stream */
-    ret = avio_open(&output_ctx, argv[2], AVIO_FLAG_WRITE);
-    if (ret < 0) {
-        fprintf(stderr, "Error opening the output context: ");
-        goto finish;
+    if (strcmp(argv[2], "-")) {
+        ret = avio_open(&output_ctx, argv[2], AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            fprintf(stderr, "Error opening the output context: ");
+            goto finish;
+        }
     }
     frame = av_frame_alloc();
     sw_frame = av_frame_alloc();
@@ -192,18 +463,27 @@ int main(int argc, char **argv) {
         goto finish;
     }
     /* actual decoding */
+    start = av_gettime_relative();
     while (ret >= 0) {
         ret = av_read_frame(input_ctx, &pkt);
         if (ret < 0)
             break;
         if (pkt.stream_index == video_st->index)
-            ret = decode_packet(&decode, decoder_ctx, frame, sw_frame, &pkt, output_ctx);
+            ret = decode_packet(backend, decoder_ctx, frame, sw_frame, &pkt, output_ctx);
         av_packet_unref(&pkt);
     }
     /* flush the decoder */
     pkt.data = NULL;
     pkt.size = 0;
-    ret = decode_packet(&decode, decoder_ctx, frame, sw_frame, &pkt, output_ctx);
+    ret = decode_packet(backend, decoder_ctx, frame, sw_frame, &pkt, output_ctx);
+    elapsed = av_gettime_relative() - start;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "%s: %"PRId64" frames in %.3fs, %.1f fps, surface pools %.1f MB "
+                    "(peak %d surfaces in use), max RSS %.1f MB\n",
+            backend->name, frame_count, elapsed / 1e6, elapsed ? frame_count * 1e6 / elapsed : 0,
+            decode.pool_bytes / 1048576.0,
+            FFMAX(decode.max_in_use, decode.pool ? decode.pool->max_in_use : 0),
+            usage.ru_maxrss / 1024.0);
     finish:
     if (ret < 0) {
         char buf[1024];
@@ -213,8 +493,10 @@ int main(int argc, char **argv) {
     avformat_close_input(&input_ctx);
     av_frame_free(&frame);
     av_frame_free(&sw_frame);
+    /* the decoder drops its surfaces before the backend releases the pool */
     avcodec_free_context(&decoder_ctx);
-    av_buffer_unref(&decode.hw_device_ref);
+    backend->uninit(&decode);
+    pthread_mutex_destroy(&decode.mutex);
     avio_close(output_ctx);
     return ret;
-}
\ No newline at end of file
+}
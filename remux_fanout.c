@@ -0,0 +1,354 @@
+/**
+ * @file
+ * Remux one input to several outputs without transcoding.
+ *
+ * @example remux_fanout.c
+ * The input is demuxed once. Every packet is shared by reference
+ * (av_packet_ref, no copy of the payload) with one queue per output, and
+ * every output is written by its own thread, so one output (a stalled RTSP
+ * server, a slow disk) never holds back the others.
+ *
+ * Each queue is bounded. When an output falls MAX_QUEUE_PACKETS behind, its
+ * new packets are dropped until the next video keyframe, so it resumes on a
+ * decodable packet. Per output the program reports packets written and
+ * dropped, the queue depth and the lag between demuxing a packet and writing
+ * it.
+ *
+ * Outputs are given as [format=]url, e.g.
+ *
+ *     remux_fanout -re input.mp4 hls=out/live.m3u8 rtsp=rtsp://127.0.0.1/live archive.mp4
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include <libavutil/timestamp.h>
+#include <libavformat/avformat.h>
+
+#define MAX_OUTPUTS 16
+#define MAX_QUEUE_PACKETS 1024
+/* microseconds between two status lines */
+#define REPORT_INTERVAL 5000000
+
+typedef struct QueueEntry {
+    AVPacket *pkt;
+    /* av_gettime_relative() when the packet was demuxed */
+    int64_t enqueue_time;
+} QueueEntry;
+
+typedef struct Output {
+    const char *url;
+    const char *format;
+    AVFormatContext *ofmt_ctx;
+    pthread_t thread;
+    int thread_started;
+    /* set once the header is written, an output that failed is skipped */
+    int active;
+
+    QueueEntry queue[MAX_QUEUE_PACKETS];
+    int queue_head, queue_count;
+    int eof;
+    /* after an overflow, drop everything until the next video keyframe */
+    int need_keyframe;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    int64_t written, dropped;
+    int64_t lag_sum, lag_max;
+    int error;
+} Output;
+
+static AVFormatContext *ifmt_ctx = NULL;
+static int *stream_mapping = NULL;
+static int stream_mapping_size = 0;
+static Output outputs[MAX_OUTPUTS];
+static int nb_outputs;
+
+/* [format=]url, an '=' after "://" belongs to the url */
+static void parse_output(Output *out, char *arg) {
+    char *sep = strchr(arg, '=');
+    char *scheme = strstr(arg, "://");
+    if (sep && (!scheme || sep < scheme)) {
+        *sep = 0;
+        out->format = arg;
+        out->url = sep + 1;
+    } else {
+        out->url = arg;
+    }
+}
+
+static int open_output(Output *out) {
+    AVDictionary *dict = NULL;
+    int ret, i;
+    avformat_alloc_output_context2(&out->ofmt_ctx, NULL, out->format, out->url);
+    if (!out->ofmt_ctx) {
+        fprintf(stderr, "Could not create output context for '%s'\n", out->url);
+        return AVERROR_UNKNOWN;
+    }
+    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+        AVStream *out_stream;
+        if (stream_mapping[i] < 0)
+            continue;
+        out_stream = avformat_new_stream(out->ofmt_ctx, NULL);
+        if (!out_stream) {
+            fprintf(stderr, "Failed allocating output stream\n");
+            return AVERROR_UNKNOWN;
+        }
+        ret = avcodec_parameters_copy(out_stream->codecpar, ifmt_ctx->streams[i]->codecpar);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to copy codec parameters\n");
+            return ret;
+        }
+        out_stream->codecpar->codec_tag = 0;
+    }
+    av_dump_format(out->ofmt_ctx, 0, out->url, 1);
+    if (!(out->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&out->ofmt_ctx->pb, out->url, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            fprintf(stderr, "Could not open output file '%s'\n", out->url);
+            return ret;
+        }
+    }
+    /* the same options remuxing.c uses for its rtsp output */
+    if (!strcmp(out->ofmt_ctx->oformat->name, "rtsp"))
+        av_dict_set(&dict, "rtsp_transport", "tcp", 0);
+    ret = avformat_write_header(out->ofmt_ctx, &dict);
+    av_dict_free(&dict);
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred when opening output '%s'\n", out->url);
+        return ret;
+    }
+    out->active = 1;
+    return 0;
+}
+
+static void close_output(Output *out) {
+    int i;
+    if (out->ofmt_ctx && out->active)
+        av_write_trailer(out->ofmt_ctx);
+    if (out->ofmt_ctx && !(out->ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&out->ofmt_ctx->pb);
+    avformat_free_context(out->ofmt_ctx);
+    out->ofmt_ctx = NULL;
+    for (i = 0; i < out->queue_count; i++)
+        av_packet_free(&out->queue[(out->queue_head + i) % MAX_QUEUE_PACKETS].pkt);
+    out->queue_count = 0;
+    pthread_mutex_destroy(&out->mutex);
+    pthread_cond_destroy(&out->cond);
+}
+
+/* Share pkt with out; never blocks, drops instead when the output is too far behind. */
+static void output_put(Output *out, const AVPacket *pkt, int is_video_key) {
+    QueueEntry *entry;
+    pthread_mutex_lock(&out->mutex);
+    if (!out->active || out->error) {
+        pthread_mutex_unlock(&out->mutex);
+        return;
+    }
+    if (out->need_keyframe && !is_video_key) {
+        out->dropped++;
+        pthread_mutex_unlock(&out->mutex);
+        return;
+    }
+    if (out->queue_count == MAX_QUEUE_PACKETS) {
+        out->dropped++;
+        out->need_keyframe = 1;
+        pthread_mutex_unlock(&out->mutex);
+        return;
+    }
+    out->need_keyframe = 0;
+    entry = &out->queue[(out->queue_head + out->queue_count) % MAX_QUEUE_PACKETS];
+    entry->pkt = av_packet_alloc();
+    if (!entry->pkt || av_packet_ref(entry->pkt, pkt) < 0) {
+        av_packet_free(&entry->pkt);
+        out->dropped++;
+        pthread_mutex_unlock(&out->mutex);
+        return;
+    }
+    entry->enqueue_time = av_gettime_relative();
+    out->queue_count++;
+    pthread_cond_signal(&out->cond);
+    pthread_mutex_unlock(&out->mutex);
+}
+
+static void *output_thread(void *arg) {
+    Output *out = arg;
+    QueueEntry entry;
+    int ret;
+    for (;;) {
+        AVStream *in_stream, *out_stream;
+        int64_t lag;
+        pthread_mutex_lock(&out->mutex);
+        while (!out->queue_count && !out->eof)
+            pthread_cond_wait(&out->cond, &out->mutex);
+        if (!out->queue_count) {
+            pthread_mutex_unlock(&out->mutex);
+            break;
+        }
+        entry = out->queue[out->queue_head];
+        out->queue_head = (out->queue_head + 1) % MAX_QUEUE_PACKETS;
+        out->queue_count--;
+        pthread_mutex_unlock(&out->mutex);
+
+        in_stream = ifmt_ctx->streams[entry.pkt->stream_index];
+        entry.pkt->stream_index = stream_mapping[entry.pkt->stream_index];
+        out_stream = out->ofmt_ctx->streams[entry.pkt->stream_index];
+        av_packet_rescale_ts(entry.pkt, in_stream->time_base, out_stream->time_base);
+        entry.pkt->pos = -1;
+        ret = av_interleaved_write_frame(out->ofmt_ctx, entry.pkt);
+        av_packet_free(&entry.pkt);
+        lag = av_gettime_relative() - entry.enqueue_time;
+
+        pthread_mutex_lock(&out->mutex);
+        if (ret < 0) {
+            fprintf(stderr, "Error muxing packet to '%s': %s\n", out->url, av_err2str(ret));
+            out->error = ret;
+            pthread_mutex_unlock(&out->mutex);
+            break;
+        }
+        out->written++;
+        out->lag_sum += lag;
+        if (lag > out->lag_max)
+            out->lag_max = lag;
+        pthread_mutex_unlock(&out->mutex);
+    }
+    return NULL;
+}
+
+static void report(void) {
+    int i;
+    for (i = 0; i < nb_outputs; i++) {
+        Output *out = &outputs[i];
+        pthread_mutex_lock(&out->mutex);
+        fprintf(stderr, "%-40s %s written:%8"PRId64" dropped:%6"PRId64" queued:%4d lag avg:%7.1fms max:%7.1fms\n",
+                out->url, !out->active ? "FAILED " : out->error ? "ERROR  " : "ok     ",
+                out->written, out->dropped, out->queue_count,
+                out->written ? out->lag_sum / 1000.0 / out->written : 0, out->lag_max / 1000.0);
+        pthread_mutex_unlock(&out->mutex);
+    }
+}
+
+int main(int argc, char **argv) {
+    AVPacket pkt;
+    const char *in_filename;
+    int ret, i, realtime = 0, nb_active = 0, has_video = 0;
+    int stream_index = 0;
+    int64_t start_time, last_report;
+    /* first dts seen in AV_TIME_BASE, -re paces relative to it; inputs rarely start at 0 */
+    int64_t first_dts = AV_NOPTS_VALUE;
+    if (argc > 1 && !strcmp(argv[1], "-re")) {
+        realtime = 1;
+        argv++;
+        argc--;
+    }
+    if (argc < 3 || argc - 2 > MAX_OUTPUTS) {
+        printf("usage: %s [-re] input [format=]output...\n"
+               "Remux one input to up to %d outputs, each written by its own thread.\n"
+               "-re reads the input at its native rate, like a live ingest.\n"
+               "\n", argv[0], MAX_OUTPUTS);
+        return 1;
+    }
+    in_filename = argv[1];
+    if ((ret = avformat_open_input(&ifmt_ctx, in_filename, 0, 0)) < 0) {
+        fprintf(stderr, "Could not open input file '%s'", in_filename);
+        goto end;
+    }
+    if ((ret = avformat_find_stream_info(ifmt_ctx, 0)) < 0) {
+        fprintf(stderr, "Failed to retrieve input stream information");
+        goto end;
+    }
+    av_dump_format(ifmt_ctx, 0, in_filename, 0);
+    stream_mapping_size = ifmt_ctx->nb_streams;
+    stream_mapping = av_mallocz_array(stream_mapping_size, sizeof(*stream_mapping));
+    if (!stream_mapping) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+        AVCodecParameters *in_codecpar = ifmt_ctx->streams[i]->codecpar;
+        if (in_codecpar->codec_type != AVMEDIA_TYPE_AUDIO &&
+            in_codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+            in_codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE) {
+            stream_mapping[i] = -1;
+            continue;
+        }
+        stream_mapping[i] = stream_index++;
+        has_video |= in_codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    }
+    for (i = 2; i < argc; i++) {
+        Output *out = &outputs[nb_outputs++];
+        pthread_mutex_init(&out->mutex, NULL);
+        pthread_cond_init(&out->cond, NULL);
+        parse_output(out, argv[i]);
+        /* one failed output does not stop the others */
+        if (open_output(out) < 0)
+            continue;
+        if (pthread_create(&out->thread, NULL, output_thread, out)) {
+            fprintf(stderr, "Could not create writer thread for '%s'\n", out->url);
+            out->active = 0;
+            continue;
+        }
+        out->thread_started = 1;
+        nb_active++;
+    }
+    if (!nb_active) {
+        fprintf(stderr, "No output could be opened\n");
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+    start_time = last_report = av_gettime_relative();
+    while (1) {
+        AVStream *in_stream;
+        int is_video_key;
+        ret = av_read_frame(ifmt_ctx, &pkt);
+        if (ret < 0)
+            break;
+        if (pkt.stream_index >= stream_mapping_size ||
+            stream_mapping[pkt.stream_index] < 0) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        in_stream = ifmt_ctx->streams[pkt.stream_index];
+        if (realtime && pkt.dts != AV_NOPTS_VALUE) {
+            int64_t dts = av_rescale_q(pkt.dts, in_stream->time_base, AV_TIME_BASE_Q);
+            int64_t now;
+            if (first_dts == AV_NOPTS_VALUE)
+                first_dts = dts;
+            dts -= first_dts;
+            now = av_gettime_relative() - start_time;
+            if (dts > now)
+                av_usleep(dts - now);
+        }
+        /* without video any packet is a safe point to resume an output */
+        is_video_key = !has_video || (in_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+                                      (pkt.flags & AV_PKT_FLAG_KEY));
+        for (i = 0; i < nb_outputs; i++)
+            output_put(&outputs[i], &pkt, is_video_key);
+        av_packet_unref(&pkt);
+        if (av_gettime_relative() - last_report > REPORT_INTERVAL) {
+            report();
+            last_report = av_gettime_relative();
+        }
+    }
+    /* only the end of the input is success, a dropped ingest is reported once the writers are done */
+    end:
+    for (i = 0; i < nb_outputs; i++) {
+        Output *out = &outputs[i];
+        pthread_mutex_lock(&out->mutex);
+        out->eof = 1;
+        pthread_cond_signal(&out->cond);
+        pthread_mutex_unlock(&out->mutex);
+        if (out->thread_started)
+            pthread_join(out->thread, NULL);
+    }
+    report();
+    for (i = 0; i < nb_outputs; i++)
+        close_output(&outputs[i]);
+    avformat_close_input(&ifmt_ctx);
+    av_freep(&stream_mapping);
+    if (ret < 0 && ret != AVERROR_EOF) {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,507 @@
+/**
+ * @file
+ * Remux one large input into a fragmented MP4 in parallel.
+ *
+ * @example remux_segments.c
+ * The input is split into RANGES_PER_JOB ranges per job at keyframe
+ * boundaries, chosen from the demuxer index (MKV cues, MP4 sample tables)
+ * so that every range covers about the same number of bytes, or evenly over
+ * the duration when there is no index (TS). Every range is remuxed by a
+ * worker thread with its own input context into a fragmented MP4 part file,
+ * then the parts are stitched into one file.
+ *
+ * Every part is written with absolute timestamps (movflags frag_discont, so
+ * the tfdt of each fragment carries the dts of its first sample) shifted by
+ * one offset for the whole input, which keeps them consistent across parts.
+ * Stitching keeps the init segment of the first part, checks that all parts
+ * produced the same one, drops the later ones and renumbers the moof
+ * sequence numbers.
+ *
+ *     remux_segments -j 8 archive.mkv archive.mp4
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+
+#define MAX_JOBS 64
+#define RANGES_PER_JOB 2
+#define MAX_RANGES (MAX_JOBS * RANGES_PER_JOB)
+/* how far, in microseconds, packets of different streams with the same
+ * timestamp may be apart in the file; workers seek this much before their
+ * range so no packet of it is missed */
+#define SEEK_MARGIN 2000000
+#define COPY_BUFFER_SIZE (1 << 20)
+
+typedef struct Range {
+    int index;
+    /* nominal range of the reference stream in its time base, open ends are
+     * INT64_MIN and INT64_MAX; the reference stream starts at its first
+     * keyframe with pts >= start, other streams at their first pts >= start */
+    int64_t start, end;
+    char filename[1024];
+    int64_t packets, bytes;
+    double seconds;
+    int ret;
+} Range;
+
+static const char *in_filename, *out_filename;
+static int ref_index;
+static AVRational ref_time_base;
+/* subtracted from every timestamp, in AV_TIME_BASE units */
+static int64_t ts_offset;
+static Range ranges[MAX_RANGES];
+static int nb_ranges;
+static int next_range;
+static pthread_mutex_t range_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t packet_ts(const AVPacket *pkt) {
+    return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+}
+
+/* first dts of the input over all streams, so shifted timestamps never go negative */
+static int64_t probe_ts_offset(AVFormatContext *ifmt_ctx) {
+    AVPacket pkt;
+    int64_t offset = INT64_MAX;
+    uint8_t *seen = av_mallocz(ifmt_ctx->nb_streams);
+    int nb_seen = 0, i;
+    if (!seen)
+        return 0;
+    for (i = 0; i < 500 && nb_seen < ifmt_ctx->nb_streams && av_read_frame(ifmt_ctx, &pkt) >= 0; i++) {
+        AVStream *st = ifmt_ctx->streams[pkt.stream_index];
+        if (pkt.dts != AV_NOPTS_VALUE && !seen[pkt.stream_index]) {
+            offset = FFMIN(offset, av_rescale_q(pkt.dts, st->time_base, AV_TIME_BASE_Q));
+            seen[pkt.stream_index] = 1;
+            nb_seen++;
+        }
+        av_packet_unref(&pkt);
+    }
+    av_free(seen);
+    return offset == INT64_MAX ? 0 : offset;
+}
+
+/* Split the input at keyframes of the reference stream, balanced by file position when possible. */
+static void plan_ranges(AVFormatContext *ifmt_ctx, int wanted) {
+    AVStream *st = ifmt_ctx->streams[ref_index];
+    int64_t file_size = ifmt_ctx->pb ? avio_size(ifmt_ctx->pb) : -1;
+    int64_t bounds[MAX_RANGES + 1];
+    int nb_bounds = 0, i, k;
+    int nb_keys = 0;
+    for (i = 0; i < st->nb_index_entries; i++)
+        nb_keys += !!(st->index_entries[i].flags & AVINDEX_KEYFRAME);
+    bounds[nb_bounds++] = INT64_MIN;
+    if (nb_keys >= wanted) {
+        int use_pos = file_size > 0 && st->index_entries[st->nb_index_entries - 1].pos > 0;
+        int seen = 0;
+        for (i = 0, k = 1; i < st->nb_index_entries && k < wanted; i++) {
+            AVIndexEntry *e = &st->index_entries[i];
+            if (!(e->flags & AVINDEX_KEYFRAME))
+                continue;
+            seen++;
+            if (use_pos ? e->pos < file_size * k / wanted : seen < (int64_t) nb_keys * k / wanted)
+                continue;
+            if (e->timestamp > bounds[nb_bounds - 1])
+                bounds[nb_bounds++] = e->timestamp;
+            k++;
+        }
+    } else if (ifmt_ctx->duration > 0) {
+        int64_t start = ifmt_ctx->start_time != AV_NOPTS_VALUE ? ifmt_ctx->start_time : 0;
+        for (k = 1; k < wanted; k++)
+            bounds[nb_bounds++] = av_rescale_q(start + ifmt_ctx->duration * k / wanted,
+                                               AV_TIME_BASE_Q, st->time_base);
+    }
+    bounds[nb_bounds++] = INT64_MAX;
+    nb_ranges = nb_bounds - 1;
+    for (i = 0; i < nb_ranges; i++) {
+        ranges[i].index = i;
+        ranges[i].start = bounds[i];
+        ranges[i].end = bounds[i + 1];
+        snprintf(ranges[i].filename, sizeof(ranges[i].filename), "%s.part%03d", out_filename, i);
+    }
+}
+
+static int open_part(AVFormatContext **ofmt_ctx, AVFormatContext *ifmt_ctx, const Range *range,
+                     int *stream_mapping, int has_video) {
+    AVDictionary *opts = NULL;
+    int ret, i, nb_out = 0;
+    if ((ret = avformat_alloc_output_context2(ofmt_ctx, NULL, "mp4", range->filename)) < 0)
+        return ret;
+    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+        AVStream *in_stream = ifmt_ctx->streams[i];
+        AVStream *out_stream;
+        enum AVMediaType type = in_stream->codecpar->codec_type;
+        /* subtitles of MKV/TS inputs are mostly not storable in MP4 */
+        if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO) {
+            stream_mapping[i] = -1;
+            continue;
+        }
+        out_stream = avformat_new_stream(*ofmt_ctx, NULL);
+        if (!out_stream)
+            return AVERROR(ENOMEM);
+        if ((ret = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar)) < 0)
+            return ret;
+        out_stream->codecpar->codec_tag = 0;
+        /* same hint in every part, so every part picks the same track timescale */
+        out_stream->time_base = in_stream->time_base;
+        stream_mapping[i] = nb_out++;
+    }
+    if ((ret = avio_open(&(*ofmt_ctx)->pb, range->filename, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    /* frag_keyframe cuts audio only files at every packet, use a duration there */
+    av_dict_set(&opts, "movflags", has_video ?
+                "+frag_keyframe+empty_moov+default_base_moof+frag_discont+skip_trailer" :
+                "+empty_moov+default_base_moof+frag_discont+skip_trailer", 0);
+    if (!has_video)
+        av_dict_set(&opts, "frag_duration", "2000000", 0);
+    av_dict_set(&opts, "use_editlist", "0", 0);
+    av_dict_set(&opts, "avoid_negative_ts", "0", 0);
+    ret = avformat_write_header(*ofmt_ctx, &opts);
+    av_dict_free(&opts);
+    return ret;
+}
+
+static int remux_range(Range *range) {
+    AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
+    AVPacket pkt;
+    int *stream_mapping = NULL;
+    /* per input stream: 1 once the range started, 2 once it is past the end */
+    uint8_t *state = NULL;
+    int nb_active = 0, has_video = 0;
+    int64_t ref_end_ts = AV_NOPTS_VALUE;
+    int64_t start = av_gettime_relative();
+    int ret, i;
+    if ((ret = avformat_open_input(&ifmt_ctx, in_filename, NULL, NULL)) < 0)
+        goto end;
+    if ((ret = avformat_find_stream_info(ifmt_ctx, NULL)) < 0)
+        goto end;
+    stream_mapping = av_mallocz_array(ifmt_ctx->nb_streams, sizeof(*stream_mapping));
+    state = av_mallocz(ifmt_ctx->nb_streams);
+    if (!stream_mapping || !state) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < ifmt_ctx->nb_streams; i++)
+        has_video |= ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    if ((ret = open_part(&ofmt_ctx, ifmt_ctx, range, stream_mapping, has_video)) < 0)
+        goto end;
+    for (i = 0; i < ifmt_ctx->nb_streams; i++)
+        nb_active += stream_mapping[i] >= 0 && i != ref_index;
+    if (range->start != INT64_MIN) {
+        int64_t target = range->start - av_rescale_q(SEEK_MARGIN, AV_TIME_BASE_Q, ref_time_base);
+        if ((ret = avformat_seek_file(ifmt_ctx, ref_index, INT64_MIN, target, target, 0)) < 0)
+            goto end;
+    }
+    while ((ret = av_read_frame(ifmt_ctx, &pkt)) >= 0) {
+        int si = pkt.stream_index;
+        AVStream *in_stream = ifmt_ctx->streams[si];
+        AVStream *out_stream;
+        int64_t ts = packet_ts(&pkt);
+        int64_t offset;
+        if (stream_mapping[si] < 0) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        if (si == ref_index) {
+            int key = pkt.flags & AV_PKT_FLAG_KEY;
+            if (state[si] == 0 && key && ts != AV_NOPTS_VALUE && ts >= range->start)
+                state[si] = 1;
+            if (state[si] == 1 && key && ts != AV_NOPTS_VALUE && ts >= range->end) {
+                state[si] = 2;
+                ref_end_ts = av_rescale_q(ts, ref_time_base, AV_TIME_BASE_Q);
+            }
+        } else if (ts != AV_NOPTS_VALUE) {
+            if (state[si] == 0 && (range->start == INT64_MIN ||
+                                   av_compare_ts(ts, in_stream->time_base, range->start, ref_time_base) >= 0))
+                state[si] = 1;
+            if (state[si] == 1 && range->end != INT64_MAX &&
+                av_compare_ts(ts, in_stream->time_base, range->end, ref_time_base) >= 0) {
+                state[si] = 2;
+                nb_active--;
+            }
+        }
+        /* done once every stream is past the end, or the stragglers are too far behind */
+        if (state[ref_index] == 2 &&
+            (nb_active <= 0 || (ts != AV_NOPTS_VALUE &&
+                                av_rescale_q(ts, in_stream->time_base, AV_TIME_BASE_Q) >= ref_end_ts + SEEK_MARGIN))) {
+            av_packet_unref(&pkt);
+            break;
+        }
+        if (state[si] != 1) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        pkt.stream_index = stream_mapping[si];
+        out_stream = ofmt_ctx->streams[pkt.stream_index];
+        offset = av_rescale_q(ts_offset, AV_TIME_BASE_Q, in_stream->time_base);
+        if (pkt.pts != AV_NOPTS_VALUE)
+            pkt.pts -= offset;
+        if (pkt.dts != AV_NOPTS_VALUE)
+            pkt.dts -= offset;
+        av_packet_rescale_ts(&pkt, in_stream->time_base, out_stream->time_base);
+        pkt.pos = -1;
+        range->packets++;
+        range->bytes += pkt.size;
+        if ((ret = av_interleaved_write_frame(ofmt_ctx, &pkt)) < 0)
+            goto end;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+    if (ret >= 0)
+        ret = av_write_trailer(ofmt_ctx);
+    end:
+    if (ofmt_ctx) {
+        avio_closep(&ofmt_ctx->pb);
+        avformat_free_context(ofmt_ctx);
+    }
+    avformat_close_input(&ifmt_ctx);
+    av_freep(&stream_mapping);
+    av_freep(&state);
+    range->seconds = (av_gettime_relative() - start) / 1e6;
+    return ret;
+}
+
+static void *worker_thread(void *arg) {
+    while (1) {
+        Range *range;
+        pthread_mutex_lock(&range_mutex);
+        range = next_range < nb_ranges ? &ranges[next_range++] : NULL;
+        pthread_mutex_unlock(&range_mutex);
+        if (!range)
+            break;
+        range->ret = remux_range(range);
+        if (range->ret < 0)
+            fprintf(stderr, "part %d failed: %s\n", range->index, av_err2str(range->ret));
+    }
+    return NULL;
+}
+
+static int read_full(int fd, uint8_t *buf, int64_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, offset);
+        if (n <= 0)
+            return n < 0 ? AVERROR(errno) : AVERROR_INVALIDDATA;
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const uint8_t *buf, int64_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0)
+            return AVERROR(errno);
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Copy without going through user space where the file system allows it. */
+static int copy_range(int in_fd, int64_t offset, int out_fd, int64_t size, uint8_t *buffer) {
+    while (size > 0) {
+        off64_t off = offset;
+        ssize_t n = copy_file_range(in_fd, &off, out_fd, NULL, size, 0);
+        if (n <= 0) {
+            int ret;
+            n = FFMIN(size, COPY_BUFFER_SIZE);
+            if ((ret = read_full(in_fd, buffer, n, offset)) < 0 ||
+                (ret = write_full(out_fd, buffer, n)) < 0)
+                return ret;
+        }
+        offset += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Append the boxes of one part, keeping only the first init segment. */
+static int stitch_part(int out_fd, const Range *range, uint8_t **moov, int64_t *moov_size,
+                       uint32_t *sequence, uint8_t *buffer) {
+    struct stat st;
+    int64_t offset = 0;
+    int ret = 0;
+    int fd = open(range->filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        ret = AVERROR(errno);
+        goto end;
+    }
+    while (offset + 8 <= st.st_size) {
+        uint8_t header[16];
+        int64_t size;
+        uint32_t type;
+        if ((ret = read_full(fd, header, 8, offset)) < 0)
+            goto end;
+        size = AV_RB32(header);
+        type = AV_RB32(header + 4);
+        if (size == 1) {
+            if ((ret = read_full(fd, header + 8, 8, offset + 8)) < 0)
+                goto end;
+            size = AV_RB64(header + 8);
+        } else if (size == 0) {
+            size = st.st_size - offset;
+        }
+        if (size < 8 || offset + size > st.st_size) {
+            ret = AVERROR_INVALIDDATA;
+            goto end;
+        }
+        if (type == MKBETAG('m', 'o', 'o', 'v') && *moov) {
+            uint8_t *box = av_malloc(size);
+            if (!box) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            ret = read_full(fd, box, size, offset);
+            if (ret >= 0 && (size != *moov_size || memcmp(box, *moov, size))) {
+                fprintf(stderr, "%s has a different init segment than the first part\n", range->filename);
+                ret = AVERROR_INVALIDDATA;
+            }
+            av_free(box);
+            if (ret < 0)
+                goto end;
+        } else if (type == MKBETAG('f', 't', 'y', 'p') && *moov) {
+            /* only the first part keeps its file header */
+        } else if (type == MKBETAG('m', 'o', 'o', 'v') || type == MKBETAG('m', 'o', 'o', 'f')) {
+            uint8_t *box = av_malloc(size);
+            if (!box) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            if ((ret = read_full(fd, box, size, offset)) < 0) {
+                av_free(box);
+                goto end;
+            }
+            if (type == MKBETAG('m', 'o', 'o', 'v')) {
+                *moov = box;
+                *moov_size = size;
+                ret = write_full(out_fd, box, size);
+            } else {
+                /* mfhd is the first child of moof: size, type, version and flags, sequence_number */
+                if (size >= 24 && AV_RB32(box + 12) == MKBETAG('m', 'f', 'h', 'd'))
+                    AV_WB32(box + 20, ++*sequence);
+                ret = write_full(out_fd, box, size);
+                av_free(box);
+            }
+            if (ret < 0)
+                goto end;
+        } else if ((ret = copy_range(fd, offset, out_fd, size, buffer)) < 0) {
+            goto end;
+        }
+        offset += size;
+    }
+    end:
+    if (fd >= 0)
+        close(fd);
+    return ret;
+}
+
+static int stitch(void) {
+    uint8_t *moov = NULL;
+    int64_t moov_size = 0;
+    uint32_t sequence = 0;
+    uint8_t *buffer = av_malloc(COPY_BUFFER_SIZE);
+    int ret = 0, i;
+    int out_fd = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0 || !buffer) {
+        ret = out_fd < 0 ? AVERROR(errno) : AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_ranges && ret >= 0; i++)
+        ret = stitch_part(out_fd, &ranges[i], &moov, &moov_size, &sequence, buffer);
+    end:
+    if (out_fd >= 0 && close(out_fd) < 0 && ret >= 0)
+        ret = AVERROR(errno);
+    av_free(moov);
+    av_free(buffer);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    AVFormatContext *ifmt_ctx = NULL;
+    pthread_t threads[MAX_JOBS];
+    int jobs = 4;
+    int ret, i;
+    int64_t start, remux_end;
+    int64_t packets = 0, bytes = 0;
+    if (argc > 2 && !strcmp(argv[1], "-j")) {
+        jobs = av_clip(atoi(argv[2]), 1, MAX_JOBS);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 3) {
+        printf("usage: %s [-j jobs] input output.mp4\n"
+               "Remux a large input into a fragmented MP4, several keyframe ranges at a time.\n"
+               "\n", argv[0]);
+        return 1;
+    }
+    in_filename = argv[1];
+    out_filename = argv[2];
+    start = av_gettime_relative();
+    if ((ret = avformat_open_input(&ifmt_ctx, in_filename, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open input file '%s'\n", in_filename);
+        goto end;
+    }
+    if ((ret = avformat_find_stream_info(ifmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Failed to retrieve input stream information\n");
+        goto end;
+    }
+    av_dump_format(ifmt_ctx, 0, in_filename, 0);
+    ret = av_find_best_stream(ifmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (ret < 0)
+        ret = av_find_best_stream(ifmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Input has neither video nor audio\n");
+        goto end;
+    }
+    ref_index = ret;
+    ref_time_base = ifmt_ctx->streams[ref_index]->time_base;
+    plan_ranges(ifmt_ctx, jobs * RANGES_PER_JOB);
+    ts_offset = probe_ts_offset(ifmt_ctx);
+    avformat_close_input(&ifmt_ctx);
+    fprintf(stderr, "%d ranges, %d jobs\n", nb_ranges, jobs);
+
+    jobs = FFMIN(jobs, nb_ranges);
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, worker_thread, NULL)) {
+            fprintf(stderr, "Could not start worker thread\n");
+            jobs = i;
+            break;
+        }
+    }
+    for (i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    ret = jobs ? 0 : AVERROR(EAGAIN);
+    for (i = 0; i < nb_ranges; i++) {
+        Range *range = &ranges[i];
+        fprintf(stderr, "part %d: %"PRId64" packets %"PRId64" bytes in %.3fs\n",
+                range->index, range->packets, range->bytes, range->seconds);
+        packets += range->packets;
+        bytes += range->bytes;
+        if (range->ret < 0)
+            ret = range->ret;
+    }
+    remux_end = av_gettime_relative();
+    if (ret >= 0 && (ret = stitch()) < 0)
+        fprintf(stderr, "Could not stitch the parts into '%s'\n", out_filename);
+    fprintf(stderr, "%"PRId64" packets %.1f MB, remux %.3fs, stitch %.3fs, %.1f MB/s overall\n",
+            packets, bytes / 1e6, (remux_end - start) / 1e6, (av_gettime_relative() - remux_end) / 1e6,
+            bytes / ((av_gettime_relative() - start) / 1e6) / 1e6);
+    for (i = 0; i < nb_ranges; i++)
+        unlink(ranges[i].filename);
+    end:
+    avformat_close_input(&ifmt_ctx);
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+    return 0;
+}
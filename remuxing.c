@@ -25,10 +25,75 @@
  *
  * Remux streams from one container format to another.
  * @example remuxing.c
+ *
+ * Besides the default av_interleaved_write_frame() path there are two modes:
+ *
+ * lowlatency: packets go through a REORDER_DEPTH packet dts reorder buffer
+ * and are written with av_write_frame(), the output is flushed after every
+ * packet and the input is read without buffering.
+ *
+ * throughput: file outputs get a THROUGHPUT_IO_BUFFER byte AVIO buffer and
+ * per-packet flushing is disabled, so the muxer output is coalesced into
+ * large writes.
+ *
+ * Every mode reports the latency from reading a packet until it is written.
+ * lowlatency measures it when av_write_frame() and avio_flush() return. The
+ * other two can only infer from the dts when av_interleaved_write_frame()
+ * releases a packet: default reports that estimate, throughput also waits
+ * until io_write() has put the packet's bytes on the fd.
  */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavutil/time.h>
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
 
+#define REORDER_DEPTH 4
+#define THROUGHPUT_IO_BUFFER (4 << 20)
+/* latency histogram in 1 ms buckets, the last one collects everything slower */
+#define LATENCY_BUCKETS 10000
+#define MAX_PENDING 8192
+
+enum RemuxMode {
+    MODE_DEFAULT,
+    MODE_LOW_LATENCY,
+    MODE_THROUGHPUT,
+};
+
+typedef struct PendingPacket {
+    AVPacket *pkt;
+    /* av_gettime_relative() right after av_read_frame() */
+    int64_t read_time;
+    /* dts in AV_TIME_BASE units */
+    int64_t dts;
+} PendingPacket;
+
+typedef struct FlushingPacket {
+    int64_t read_time;
+    /* avio_tell() when the muxer released the packet, its bytes end before this */
+    int64_t end;
+} FlushingPacket;
+
+static enum RemuxMode mode = MODE_DEFAULT;
+static int64_t latency_hist[LATENCY_BUCKETS];
+static int64_t latency_count, latency_sum, latency_max;
+/* packets handed to av_interleaved_write_frame() but possibly still queued in it */
+static PendingPacket interleaved[MAX_PENDING];
+static int interleaved_head, interleaved_count;
+static int64_t *last_dts_in;
+/* the lowlatency reorder buffer, sorted by dts */
+static PendingPacket reorder[REORDER_DEPTH];
+static int reorder_count;
+static int64_t *last_dts_out;
+/* throughput: released packets whose bytes may still be in the AVIO buffer, by end offset */
+static FlushingPacket flushing[MAX_PENDING];
+static int flushing_head, flushing_count;
+/* the output fd offset io_write() and io_seek() have reached */
+static int64_t io_pos;
+
 static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt, const char *tag) {
     AVRational *time_base = &fmt_ctx->streams[pkt->stream_index]->time_base;
     printf("%s: pts:%s pts_time:%s dts:%s dts_time:%s duration:%s duration_time:%s stream_index:%d\n",
@@ -39,25 +104,205 @@ static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt, cons
            pkt->stream_index);
 }
 
+static void add_latency(int64_t read_time) {
+    int64_t latency = av_gettime_relative() - read_time;
+    latency_hist[FFMIN(latency / 1000, LATENCY_BUCKETS - 1)]++;
+    latency_count++;
+    latency_sum += latency;
+    if (latency > latency_max)
+        latency_max = latency;
+}
+
+static double latency_percentile(double p) {
+    int64_t target = latency_count * p, seen = 0;
+    int i;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latency_hist[i];
+        if (seen > target)
+            break;
+    }
+    return i;
+}
+
+/* Account for the flushing packets whose bytes are on the fd, or all of them with flush set. */
+static void account_flushed(int flush) {
+    while (flushing_count && (flush || flushing[flushing_head].end <= io_pos)) {
+        add_latency(flushing[flushing_head].read_time);
+        flushing_head = (flushing_head + 1) % MAX_PENDING;
+        flushing_count--;
+    }
+}
+
+/*
+ * av_interleaved_write_frame() holds a packet back until every stream has
+ * delivered a packet with a later dts; account for the packets that this
+ * rule has released. With flush set, everything left is accounted for.
+ * In throughput mode a released packet ends somewhere before avio_tell(),
+ * it waits in flushing until io_write() has written up to there.
+ */
+static void account_interleaved(AVFormatContext *ofmt_ctx, int flush) {
+    int64_t released = INT64_MAX;
+    int i;
+    for (i = 0; i < ofmt_ctx->nb_streams; i++) {
+        if (last_dts_in[i] != AV_NOPTS_VALUE)
+            released = FFMIN(released, last_dts_in[i]);
+    }
+    while (interleaved_count &&
+           (flush || interleaved[interleaved_head].dts <= released || interleaved_count == MAX_PENDING)) {
+        if (mode == MODE_THROUGHPUT && ofmt_ctx->pb) {
+            FlushingPacket *pending;
+            if (flushing_count == MAX_PENDING)
+                account_flushed(0);
+            if (flushing_count == MAX_PENDING) {
+                /* should not happen, the AVIO buffer holds far fewer packets */
+                add_latency(flushing[flushing_head].read_time);
+                flushing_head = (flushing_head + 1) % MAX_PENDING;
+                flushing_count--;
+            }
+            pending = &flushing[(flushing_head + flushing_count++) % MAX_PENDING];
+            pending->read_time = interleaved[interleaved_head].read_time;
+            pending->end = avio_tell(ofmt_ctx->pb);
+        } else {
+            add_latency(interleaved[interleaved_head].read_time);
+        }
+        interleaved_head = (interleaved_head + 1) % MAX_PENDING;
+        interleaved_count--;
+    }
+}
+
+/* Write one packet that is already in the output time base. */
+static int write_packet(AVFormatContext *ofmt_ctx, AVPacket *pkt, int64_t read_time, int64_t dts) {
+    int ret;
+    if (mode == MODE_LOW_LATENCY) {
+        /* the muxer rejects non monotonic dts, which the reorder buffer can not always prevent */
+        int64_t *last = &last_dts_out[pkt->stream_index];
+        if (pkt->dts != AV_NOPTS_VALUE) {
+            if (*last != AV_NOPTS_VALUE && pkt->dts <= *last) {
+                pkt->dts = *last + 1;
+                if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+                    pkt->pts = pkt->dts;
+            }
+            *last = pkt->dts;
+        }
+        ret = av_write_frame(ofmt_ctx, pkt);
+        av_packet_unref(pkt);
+        if (ofmt_ctx->pb)
+            avio_flush(ofmt_ctx->pb);
+        if (ret >= 0)
+            add_latency(read_time);
+        return ret;
+    }
+    if (mode == MODE_DEFAULT)
+        log_packet(ofmt_ctx, pkt, "out");
+    ret = av_interleaved_write_frame(ofmt_ctx, pkt);
+    if (ret < 0)
+        return ret;
+    if (interleaved_count < MAX_PENDING) {
+        PendingPacket *pending = &interleaved[(interleaved_head + interleaved_count++) % MAX_PENDING];
+        pending->read_time = read_time;
+        pending->dts = dts;
+    }
+    account_interleaved(ofmt_ctx, 0);
+    return 0;
+}
+
+/* Emit the packet with the lowest dts from the reorder buffer. */
+static int reorder_pop(AVFormatContext *ofmt_ctx) {
+    PendingPacket first = reorder[0];
+    int ret;
+    memmove(reorder, reorder + 1, --reorder_count * sizeof(*reorder));
+    ret = write_packet(ofmt_ctx, first.pkt, first.read_time, first.dts);
+    av_packet_free(&first.pkt);
+    return ret;
+}
+
+static int reorder_push(AVFormatContext *ofmt_ctx, AVPacket *pkt, int64_t read_time, int64_t dts) {
+    int i;
+    if (reorder_count == REORDER_DEPTH) {
+        int ret = reorder_pop(ofmt_ctx);
+        if (ret < 0)
+            return ret;
+    }
+    for (i = reorder_count; i > 0 && reorder[i - 1].dts > dts; i--)
+        reorder[i] = reorder[i - 1];
+    reorder[i].pkt = av_packet_alloc();
+    if (!reorder[i].pkt)
+        return AVERROR(ENOMEM);
+    av_packet_move_ref(reorder[i].pkt, pkt);
+    reorder[i].read_time = read_time;
+    reorder[i].dts = dts;
+    reorder_count++;
+    return 0;
+}
+
+static int io_write(void *opaque, uint8_t *buf, int buf_size) {
+    int fd = *(int *) opaque;
+    int written = 0;
+    while (written < buf_size) {
+        ssize_t n = write(fd, buf + written, buf_size - written);
+        if (n < 0)
+            return AVERROR(errno);
+        written += n;
+    }
+    io_pos += written;
+    account_flushed(0);
+    return written;
+}
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence) {
+    int fd = *(int *) opaque;
+    if (whence == AVSEEK_SIZE) {
+        struct stat st;
+        return fstat(fd, &st) ? AVERROR(errno) : st.st_size;
+    }
+    offset = lseek(fd, offset, whence);
+    if (offset < 0)
+        return AVERROR(errno);
+    io_pos = offset;
+    return offset;
+}
+
 int main(int argc, char **argv) {
     AVOutputFormat *ofmt = NULL;
     AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
     AVPacket pkt;
-    const char *in_filename, *out_filename;
+    const char *in_filename, *out_filename, *out_format = "rtsp";
     AVDictionary *dict = NULL;
     int ret, i;
     int stream_index = 0;
     int *stream_mapping = NULL;
     int stream_mapping_size = 0;
+    int out_fd = -1;
+    int64_t start;
+    if (argc > 2 && !strcmp(argv[1], "-mode")) {
+        if (!strcmp(argv[2], "lowlatency"))
+            mode = MODE_LOW_LATENCY;
+        else if (!strcmp(argv[2], "throughput"))
+            mode = MODE_THROUGHPUT;
+        else if (strcmp(argv[2], "default"))
+            argc = 0;
+        argv += 2;
+        argc -= 2;
+    }
     if (argc < 3) {
-        printf("usage: %s input output\n"
+        printf("usage: %s [-mode default|lowlatency|throughput] input output [format]\n"
                "API example program to remux a media file with libavformat and libavcodec.\n"
-               "The output format is guessed according to the file extension.\n"
+               "The output format defaults to rtsp.\n"
                "\n", argv[0]);
         return 1;
     }
     in_filename = argv[1];
     out_filename = argv[2];
+    if (argc > 3)
+        out_format = argv[3];
+    if (mode == MODE_LOW_LATENCY) {
+        ifmt_ctx = avformat_alloc_context();
+        if (!ifmt_ctx) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ifmt_ctx->flags |= AVFMT_FLAG_NOBUFFER;
+    }
     if ((ret = avformat_open_input(&ifmt_ctx, in_filename, 0, 0)) < 0) {
         fprintf(stderr, "Could not open input file '%s'", in_filename);
         goto end;
@@ -67,7 +312,7 @@ int main(int argc, char **argv) {
         goto end;
     }
     av_dump_format(ifmt_ctx, 0, in_filename, 0);
-    avformat_alloc_output_context2(&ofmt_ctx, NULL, "rtsp", out_filename);
+    avformat_alloc_output_context2(&ofmt_ctx, NULL, out_format, out_filename);
     if (!ofmt_ctx) {
         fprintf(stderr, "Could not create output context\n");
         ret = AVERROR_UNKNOWN;
@@ -104,26 +349,70 @@ int main(int argc, char **argv) {
         }
         out_stream->codecpar->codec_tag = 0;
     }
+    last_dts_in = av_malloc_array(ofmt_ctx->nb_streams, sizeof(*last_dts_in));
+    last_dts_out = av_malloc_array(ofmt_ctx->nb_streams, sizeof(*last_dts_out));
+    if (!last_dts_in || !last_dts_out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < ofmt_ctx->nb_streams; i++)
+        last_dts_in[i] = last_dts_out[i] = AV_NOPTS_VALUE;
     av_dump_format(ofmt_ctx, 0, out_filename, 1);
     if (!(ofmt->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&ofmt_ctx->pb, out_filename, AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            fprintf(stderr, "Could not open output file '%s'", out_filename);
-            goto end;
+        if (mode == MODE_THROUGHPUT) {
+            /* a large buffer of our own instead of the default 32 KiB one of avio_open() */
+            uint8_t *buffer = av_malloc(THROUGHPUT_IO_BUFFER);
+            out_fd = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (!buffer || out_fd < 0) {
+                av_free(buffer);
+                fprintf(stderr, "Could not open output file '%s'", out_filename);
+                ret = buffer ? AVERROR(errno) : AVERROR(ENOMEM);
+                goto end;
+            }
+            ofmt_ctx->pb = avio_alloc_context(buffer, THROUGHPUT_IO_BUFFER, 1, &out_fd,
+                                              NULL, io_write, io_seek);
+            if (!ofmt_ctx->pb) {
+                av_free(buffer);
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+        } else {
+            ret = avio_open(&ofmt_ctx->pb, out_filename, AVIO_FLAG_WRITE);
+            if (ret < 0) {
+                fprintf(stderr, "Could not open output file '%s'", out_filename);
+                goto end;
+            }
         }
     }
-    av_dict_set(&dict, "rtsp_transport", "tcp", 0);
-    av_dict_set(&dict, "muxdelay", "0.1", 0);
+    if (!strcmp(ofmt->name, "rtsp"))
+        av_dict_set(&dict, "rtsp_transport", "tcp", 0);
+    switch (mode) {
+        case MODE_LOW_LATENCY:
+            av_dict_set(&dict, "muxdelay", "0", 0);
+            ofmt_ctx->flush_packets = 1;
+            break;
+        case MODE_THROUGHPUT:
+            av_dict_set(&dict, "muxdelay", "0.7", 0);
+            ofmt_ctx->flush_packets = 0;
+            break;
+        default:
+            av_dict_set(&dict, "muxdelay", "0.1", 0);
+            break;
+    }
     ret = avformat_write_header(ofmt_ctx, &dict);
+    av_dict_free(&dict);
     if (ret < 0) {
         fprintf(stderr, "Error occurred when opening output file\n");
         goto end;
     }
+    start = av_gettime_relative();
     while (1) {
         AVStream *in_stream, *out_stream;
+        int64_t read_time, dts;
         ret = av_read_frame(ifmt_ctx, &pkt);
         if (ret < 0)
             break;
+        read_time = av_gettime_relative();
         in_stream = ifmt_ctx->streams[pkt.stream_index];
         if (pkt.stream_index >= stream_mapping_size ||
             stream_mapping[pkt.stream_index] < 0) {
@@ -132,7 +421,14 @@ int main(int argc, char **argv) {
         }
         pkt.stream_index = stream_mapping[pkt.stream_index];
         out_stream = ofmt_ctx->streams[pkt.stream_index];
-        log_packet(ifmt_ctx, &pkt, "in");
+        if (mode == MODE_DEFAULT)
+            log_packet(ifmt_ctx, &pkt, "in");
+        dts = pkt.dts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+              av_rescale_q(pkt.dts, in_stream->time_base, AV_TIME_BASE_Q);
+        if (dts != AV_NOPTS_VALUE)
+            last_dts_in[pkt.stream_index] = dts;
+        else
+            dts = last_dts_in[pkt.stream_index] != AV_NOPTS_VALUE ? last_dts_in[pkt.stream_index] : 0;
         /* copy packet */
         pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base,
                                    AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
@@ -140,25 +436,56 @@ int main(int argc, char **argv) {
                                    AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
         pkt.duration = av_rescale_q(pkt.duration, in_stream->time_base, out_stream->time_base);
         pkt.pos = -1;
-        log_packet(ofmt_ctx, &pkt, "out");
-        ret = av_interleaved_write_frame(ofmt_ctx, &pkt);
+        if (mode == MODE_LOW_LATENCY)
+            ret = reorder_push(ofmt_ctx, &pkt, read_time, dts);
+        else
+            ret = write_packet(ofmt_ctx, &pkt, read_time, dts);
         if (ret < 0) {
             fprintf(stderr, "Error muxing packet\n");
             break;
         }
         av_packet_unref(&pkt);
     }
+    while (reorder_count) {
+        if (reorder_pop(ofmt_ctx) < 0)
+            fprintf(stderr, "Error muxing packet\n");
+    }
     av_write_trailer(ofmt_ctx);
+    account_interleaved(ofmt_ctx, 1);
+    /* av_write_trailer() flushed the AVIO buffer */
+    account_flushed(1);
+    if (latency_count) {
+        fprintf(stderr, "%s mode: %"PRId64" packets in %.3fs, %s "
+                        "avg:%.3fms p50:%.0fms p99:%.0fms max:%.3fms\n",
+                mode == MODE_LOW_LATENCY ? "lowlatency" : mode == MODE_THROUGHPUT ? "throughput" : "default",
+                latency_count, (av_gettime_relative() - start) / 1e6,
+                mode == MODE_LOW_LATENCY ? "measured read to write latency" :
+                mode == MODE_THROUGHPUT ? "read to fd latency (muxer release estimated from dts)" :
+                "estimated read to mux latency (from dts, AVIO buffering not included)",
+                latency_sum / 1000.0 / latency_count, latency_percentile(0.5), latency_percentile(0.99),
+                latency_max / 1000.0);
+    }
     end:
     avformat_close_input(&ifmt_ctx);
     /* close output */
-    if (ofmt_ctx && !(ofmt->flags & AVFMT_NOFILE))
+    if (ofmt_ctx && out_fd >= 0) {
+        if (ofmt_ctx->pb) {
+            avio_flush(ofmt_ctx->pb);
+            av_freep(&ofmt_ctx->pb->buffer);
+        }
+        avio_context_free(&ofmt_ctx->pb);
+        close(out_fd);
+    } else if (ofmt_ctx && !(ofmt->flags & AVFMT_NOFILE))
         avio_closep(&ofmt_ctx->pb);
     avformat_free_context(ofmt_ctx);
     av_freep(&stream_mapping);
+    av_freep(&last_dts_in);
+    av_freep(&last_dts_out);
+    for (i = 0; i < reorder_count; i++)
+        av_packet_free(&reorder[i].pkt);
     if (ret < 0 && ret != AVERROR_EOF) {
         fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
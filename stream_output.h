@@ -0,0 +1,324 @@
+/**
+ * @file
+ * Stream decoded video frames as Y4M or NUT to stdout, a FIFO or a file.
+ *
+ * Used by decode_video.cpp, decode_video_implement.cpp and
+ * demuxing_decoding.c so that a decoder can feed an analysis tool through a
+ * pipe instead of a temp file:
+ *
+ *     demuxing_decoding input.mp4 y4m:- audio.pcm | analysis -
+ *
+ * The url "-" writes to stdout; anything the program itself prints on stdout
+ * is redirected to stderr then, so it can not corrupt the stream.
+ *
+ * When the output is a pipe, its buffer is raised to STREAM_PIPE_SIZE with
+ * F_SETPIPE_SZ and the data is handed over with vmsplice(). vmsplice() only
+ * references the pages, so the bytes are staged in a ring of
+ * STREAM_RING_PIPES pipe sizes: a region is reused only after more than a
+ * pipe size has been spliced behind it, at which point the reader has
+ * consumed it. Other outputs use plain write() from the same staging buffer,
+ * one call per STREAM_FLUSH_SIZE bytes.
+ */
+#ifndef LEARNFFMPEG_STREAM_OUTPUT_H
+#define LEARNFFMPEG_STREAM_OUTPUT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavformat/avformat.h>
+#ifdef __cplusplus
+}
+#endif
+
+#define STREAM_PIPE_SIZE (1 << 20)
+#define STREAM_RING_PIPES 4
+#define STREAM_FLUSH_SIZE (256 << 10)
+#define STREAM_NUT_IO_SIZE (64 << 10)
+
+enum StreamFormat {
+    STREAM_Y4M,
+    STREAM_NUT,
+};
+
+typedef struct StreamOutput {
+    int fd;
+    enum StreamFormat format;
+    /* the output is a pipe and vmsplice() works on it */
+    int use_vmsplice;
+    size_t pipe_size;
+    /* staged bytes are [flushed, pos) */
+    uint8_t *ring;
+    size_t ring_size, flushed, pos;
+
+    int width, height;
+    enum AVPixelFormat pix_fmt;
+    AVRational frame_rate;
+    int header_written;
+
+    /* NUT goes through libavformat with an AVIOContext writing into the ring */
+    AVFormatContext *nut;
+    AVPacket *pkt;
+    int64_t frame_count;
+} StreamOutput;
+
+/* "y4m:url" or "nut:url", anything else is not a stream output */
+static inline int stream_output_parse(const char *arg, enum StreamFormat *format, const char **url)
+{
+    if (!strncmp(arg, "y4m:", 4))
+        *format = STREAM_Y4M;
+    else if (!strncmp(arg, "nut:", 4))
+        *format = STREAM_NUT;
+    else
+        return 0;
+    *url = arg + 4;
+    return 1;
+}
+
+static inline int stream_output_flush(StreamOutput *so)
+{
+    while (so->flushed < so->pos) {
+        size_t size = so->pos - so->flushed;
+        ssize_t n;
+        if (so->use_vmsplice) {
+            struct iovec iov;
+            iov.iov_base = so->ring + so->flushed;
+            iov.iov_len = size;
+            n = vmsplice(so->fd, &iov, 1, 0);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                so->use_vmsplice = 0;
+                continue;
+            }
+        } else {
+            n = write(so->fd, so->ring + so->flushed, size);
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        so->flushed += n;
+    }
+    if (!so->use_vmsplice)
+        so->flushed = so->pos = 0;
+    return 0;
+}
+
+static inline int stream_output_append(StreamOutput *so, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        size_t n;
+        int ret;
+        if (so->pos == so->ring_size) {
+            if ((ret = stream_output_flush(so)) < 0)
+                return ret;
+            so->flushed = so->pos = 0;
+        }
+        /* never stage more than STREAM_FLUSH_SIZE: when a region is reused,
+         * at least ring_size - STREAM_FLUSH_SIZE bytes were spliced behind it */
+        n = FFMIN(size, so->ring_size - so->pos);
+        n = FFMIN(n, STREAM_FLUSH_SIZE - (so->pos - so->flushed));
+        memcpy(so->ring + so->pos, data, n);
+        so->pos += n;
+        data += n;
+        size -= n;
+        if (so->pos - so->flushed >= STREAM_FLUSH_SIZE && (ret = stream_output_flush(so)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static inline int stream_output_nut_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    int ret = stream_output_append((StreamOutput *) opaque, buf, buf_size);
+    return ret < 0 ? ret : buf_size;
+}
+
+static inline int stream_output_open(StreamOutput *so, const char *url, enum StreamFormat format)
+{
+    struct stat st;
+    memset(so, 0, sizeof(*so));
+    so->format = format;
+    so->pix_fmt = AV_PIX_FMT_NONE;
+    if (!strcmp(url, "-") || !strcmp(url, "pipe:")) {
+        /* keep the real stdout for the stream, send everything else to stderr */
+        fflush(stdout);
+        so->fd = dup(STDOUT_FILENO);
+        if (so->fd >= 0)
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+        /* blocks on a FIFO until the reader opened it */
+        so->fd = open(url, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (so->fd < 0 || fstat(so->fd, &st) < 0) {
+        fprintf(stderr, "Could not open stream output %s: %s\n", url, strerror(errno));
+        return AVERROR(errno);
+    }
+    so->pipe_size = STREAM_FLUSH_SIZE;
+    if (S_ISFIFO(st.st_mode)) {
+        int size;
+        fcntl(so->fd, F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+        size = fcntl(so->fd, F_GETPIPE_SZ);
+        if (size > 0)
+            so->pipe_size = size;
+        so->use_vmsplice = 1;
+    }
+    so->ring_size = STREAM_RING_PIPES * FFMAX(so->pipe_size, (size_t) STREAM_FLUSH_SIZE);
+    so->ring = (uint8_t *) av_malloc(so->ring_size);
+    return so->ring ? 0 : AVERROR(ENOMEM);
+}
+
+static inline const char *stream_output_y4m_colorspace(enum AVPixelFormat pix_fmt)
+{
+    switch (pix_fmt) {
+        case AV_PIX_FMT_GRAY8:       return "mono";
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:    return "420jpeg";
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P:    return "422";
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P:    return "444";
+        case AV_PIX_FMT_YUV420P10LE: return "420p10 XYSCSS=420P10";
+        case AV_PIX_FMT_YUV422P10LE: return "422p10 XYSCSS=422P10";
+        case AV_PIX_FMT_YUV444P10LE: return "444p10 XYSCSS=444P10";
+        default:                     return NULL;
+    }
+}
+
+static inline int stream_output_header(StreamOutput *so, const AVFrame *frame)
+{
+    char header[256];
+    int ret;
+    so->width = frame->width;
+    so->height = frame->height;
+    so->pix_fmt = (enum AVPixelFormat) frame->format;
+    if (so->format == STREAM_Y4M) {
+        const char *colorspace = stream_output_y4m_colorspace(so->pix_fmt);
+        AVRational sar = frame->sample_aspect_ratio;
+        if (!colorspace) {
+            fprintf(stderr, "Pixel format %s can not be stored in Y4M\n", av_get_pix_fmt_name(so->pix_fmt));
+            return AVERROR(EINVAL);
+        }
+        snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d I%c A%d:%d C%s\n",
+                 so->width, so->height, so->frame_rate.num, so->frame_rate.den,
+                 !frame->interlaced_frame ? 'p' : frame->top_field_first ? 't' : 'b',
+                 sar.num, sar.num ? sar.den : 0, colorspace);
+        return stream_output_append(so, (const uint8_t *) header, strlen(header));
+    } else {
+        AVStream *st;
+        uint8_t *buffer;
+        if ((ret = avformat_alloc_output_context2(&so->nut, NULL, "nut", NULL)) < 0)
+            return ret;
+        st = avformat_new_stream(so->nut, NULL);
+        buffer = (uint8_t *) av_malloc(STREAM_NUT_IO_SIZE);
+        so->pkt = av_packet_alloc();
+        if (!st || !buffer || !so->pkt) {
+            av_free(buffer);
+            return AVERROR(ENOMEM);
+        }
+        so->nut->pb = avio_alloc_context(buffer, STREAM_NUT_IO_SIZE, 1, so, NULL,
+                                         stream_output_nut_write, NULL);
+        if (!so->nut->pb) {
+            av_free(buffer);
+            return AVERROR(ENOMEM);
+        }
+        st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        st->codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+        st->codecpar->width = so->width;
+        st->codecpar->height = so->height;
+        st->codecpar->format = so->pix_fmt;
+        st->codecpar->sample_aspect_ratio = frame->sample_aspect_ratio;
+        st->time_base = av_inv_q(so->frame_rate);
+        st->avg_frame_rate = so->frame_rate;
+        return avformat_write_header(so->nut, NULL);
+    }
+}
+
+/* frame_rate may be 0/0 when unknown, 25 fps is assumed then */
+static inline int stream_output_write_frame(StreamOutput *so, const AVFrame *frame, AVRational frame_rate)
+{
+    int ret, i, y;
+    if (!so->header_written) {
+        so->frame_rate = frame_rate.num > 0 && frame_rate.den > 0 ? frame_rate : av_make_q(25, 1);
+        if ((ret = stream_output_header(so, frame)) < 0)
+            return ret;
+        so->header_written = 1;
+    } else if (frame->width != so->width || frame->height != so->height || frame->format != so->pix_fmt) {
+        fprintf(stderr, "Video changed from %dx%d %s to %dx%d %s, which a %s stream can not carry\n",
+                so->width, so->height, av_get_pix_fmt_name(so->pix_fmt),
+                frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat) frame->format),
+                so->format == STREAM_Y4M ? "Y4M" : "NUT");
+        return AVERROR(EINVAL);
+    }
+    if (so->format == STREAM_Y4M) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(so->pix_fmt);
+        int row_size[4];
+        if ((ret = av_image_fill_linesizes(row_size, so->pix_fmt, so->width)) < 0 ||
+            (ret = stream_output_append(so, (const uint8_t *) "FRAME\n", 6)) < 0)
+            return ret;
+        for (i = 0; i < av_pix_fmt_count_planes(so->pix_fmt); i++) {
+            int h = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(so->height, desc->log2_chroma_h) : so->height;
+            if (frame->linesize[i] == row_size[i]) {
+                if ((ret = stream_output_append(so, frame->data[i], (size_t) row_size[i] * h)) < 0)
+                    return ret;
+                continue;
+            }
+            for (y = 0; y < h; y++) {
+                if ((ret = stream_output_append(so, frame->data[i] + (ptrdiff_t) y * frame->linesize[i],
+                                                row_size[i])) < 0)
+                    return ret;
+            }
+        }
+        return 0;
+    }
+    ret = av_image_get_buffer_size(so->pix_fmt, so->width, so->height, 1);
+    if (ret < 0 || (ret = av_new_packet(so->pkt, ret)) < 0)
+        return ret;
+    av_image_copy_to_buffer(so->pkt->data, so->pkt->size, (const uint8_t * const *) frame->data,
+                            frame->linesize, so->pix_fmt, so->width, so->height, 1);
+    so->pkt->pts = so->pkt->dts = so->frame_count++;
+    so->pkt->duration = 1;
+    so->pkt->flags |= AV_PKT_FLAG_KEY;
+    return av_write_frame(so->nut, so->pkt);
+}
+
+static inline int stream_output_close(StreamOutput *so)
+{
+    int ret = 0;
+    if (so->nut) {
+        if (so->header_written)
+            ret = av_write_trailer(so->nut);
+        if (so->nut->pb) {
+            avio_flush(so->nut->pb);
+            av_freep(&so->nut->pb->buffer);
+            avio_context_free(&so->nut->pb);
+        }
+        avformat_free_context(so->nut);
+        so->nut = NULL;
+    }
+    av_packet_free(&so->pkt);
+    if (so->fd >= 0 && so->ring) {
+        int flush_ret = stream_output_flush(so);
+        if (ret >= 0)
+            ret = flush_ret;
+    }
+    if (so->fd >= 0)
+        close(so->fd);
+    so->fd = -1;
+    av_freep(&so->ring);
+    return ret;
+}
+
+#endif //LEARNFFMPEG_STREAM_OUTPUT_H
@@ -0,0 +1,341 @@
+#include "wall.h"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+#include <chrono>
+#include <cmath>
+
+namespace wall {
+
+Session::Session(Engine &engine) : engine(engine), videoIndex(-1), timeBase(AVRational{1, 1}), loop(false),
+                                   loopOffset(0), startPts(AV_NOPTS_VALUE), endPts(AV_NOPTS_VALUE),
+                                   demuxScheduled(false), demuxDelayed(false), decodeScheduled(false), demuxEnded(false),
+                                   decodeEnded(false), stopped(true), counters() {}
+
+int Session::open(const std::string &url, bool loop) {
+    auto ret = input.open(url);
+    if (ret < 0)
+        return ret;
+    videoIndex = input.findBestStream(AVMEDIA_TYPE_VIDEO);
+    if (videoIndex < 0)
+        return videoIndex;
+    // a wall is muted, the demuxer can skip everything but the video
+    for (unsigned i = 0; i < input->nb_streams; i++) {
+        if (static_cast<int>(i) != videoIndex)
+            input.stream(i)->discard = AVDISCARD_ALL;
+    }
+    timeBase = input.stream(videoIndex)->time_base;
+    this->loop = loop;
+    // one thread per decoder, the decode pool runs the sessions in parallel instead
+    return decoder.open(input.stream(videoIndex), 1);
+}
+
+void Session::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = false;
+    kick();
+}
+
+void Session::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+}
+
+void Session::kick() {
+    if (stopped)
+        return;
+    if (!demuxScheduled && !demuxDelayed && !demuxEnded && packets.size() < WALL_PACKET_QUEUE_SIZE / 2) {
+        demuxScheduled = true;
+        engine.ioPool().submit([this] { demux(); });
+    }
+    if (!decodeScheduled && !decodeEnded && !packets.empty() && frames.size() < WALL_FRAME_QUEUE_SIZE) {
+        decodeScheduled = true;
+        engine.decodePool().submit([this] { decode(); });
+    }
+}
+
+void Session::demux() {
+    // packets read since the last seek, a file without any does not loop forever
+    auto read = 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopped || packets.size() >= WALL_PACKET_QUEUE_SIZE) {
+                demuxScheduled = false;
+                return;
+            }
+        }
+        media::Packet packet;
+        auto ret = input.read(packet);
+        if (ret == AVERROR_EOF && loop && read > 0 && startPts != AV_NOPTS_VALUE && endPts != AV_NOPTS_VALUE) {
+            auto startTime = input->start_time != AV_NOPTS_VALUE ? input->start_time : 0;
+            if (av_seek_frame(input.get(), -1, startTime, AVSEEK_FLAG_BACKWARD) >= 0) {
+                // the first packet of the next round continues where this one ended
+                loopOffset = endPts - startPts;
+                read = 0;
+                continue;
+            }
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            // no data yet: free the I/O thread for the other sessions and read again after a delay
+            std::lock_guard<std::mutex> lock(mutex);
+            demuxScheduled = false;
+            demuxDelayed = true;
+            engine.eventLoop().schedule(WALL_DEMUX_RETRY_DELAY, [this] {
+                std::lock_guard<std::mutex> lock(mutex);
+                demuxDelayed = false;
+                kick();
+            });
+            return;
+        }
+        if (ret < 0) {
+            // the end or a read error: the flush packet drains the decoder
+            std::lock_guard<std::mutex> lock(mutex);
+            packets.emplace_back();
+            demuxEnded = true;
+            demuxScheduled = false;
+            kick();
+            return;
+        }
+        if (packet->stream_index != videoIndex)
+            continue;
+        read++;
+        if (packet->pts != AV_NOPTS_VALUE) {
+            if (startPts == AV_NOPTS_VALUE)
+                startPts = packet->pts;
+            packet->pts += loopOffset;
+            endPts = FFMAX(endPts == AV_NOPTS_VALUE ? packet->pts : endPts, packet->pts + packet->duration);
+        }
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts += loopOffset;
+        std::lock_guard<std::mutex> lock(mutex);
+        packets.push_back(std::move(packet));
+        kick();
+    }
+}
+
+void Session::decode() {
+    media::Packet packet;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped || packets.empty() || frames.size() >= WALL_FRAME_QUEUE_SIZE) {
+            decodeScheduled = false;
+            return;
+        }
+        packet = std::move(packets.front());
+        packets.pop_front();
+        // decodeScheduled stays set, this only lets demux() refill
+        kick();
+    }
+    // a broken packet is skipped, the decoder recovers at the next keyframe
+    decoder.send(&packet);
+    media::Frame frame;
+    int ret;
+    while ((ret = decoder.receive(frame)) >= 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.decoded++;
+        frames.push_back(std::move(frame));
+        frame = media::Frame();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ret == AVERROR_EOF)
+            decodeEnded = true;
+        decodeScheduled = false;
+        // back to the end of the pool's queue, behind every other session
+        kick();
+    }
+    engine.notifyReady();
+}
+
+const AVFrame *Session::take(double time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = false;
+    while (!frames.empty()) {
+        auto pts = frames.front()->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE && startPts != AV_NOPTS_VALUE && (pts - startPts) * av_q2d(timeBase) > time)
+            break;
+        if (found)
+            counters.dropped++;
+        // the previous frame ends up in the queue and goes away with pop_front()
+        current = std::move(frames.front());
+        frames.pop_front();
+        found = true;
+    }
+    if (found)
+        counters.shown++;
+    else if (frames.empty() && !decodeEnded)
+        counters.underruns++;
+    kick();
+    return found ? current.get() : nullptr;
+}
+
+bool Session::finished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return decodeEnded && frames.empty();
+}
+
+bool Session::ready() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames.size() >= WALL_FRAME_QUEUE_SIZE || decodeEnded;
+}
+
+SessionStats Session::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void Session::resetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters = SessionStats();
+}
+
+Compositor::Compositor(int threads) : remaining(0), composeCalls(0), scaledTiles(0), composeTime(0) {
+    if (threads <= 0)
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (threads > 1)
+        pool.reset(new media::ThreadPool(threads));
+}
+
+Compositor::~Compositor() {
+    pool.reset();
+    for (auto context : contexts)
+        sws_freeContext(context);
+}
+
+void Compositor::resetStats() {
+    composeCalls = 0;
+    scaledTiles = 0;
+    composeTime = 0;
+}
+
+void Compositor::scale(size_t index, const AVFrame *frame, AVFrame *mosaic, int x, int y, int width, int height) {
+    contexts[index] = sws_getCachedContext(contexts[index], frame->width, frame->height,
+                                           static_cast<AVPixelFormat>(frame->format), width, height,
+                                           AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (contexts[index] == nullptr)
+        return;
+    uint8_t *tile[4] = {
+            mosaic->data[0] + y * mosaic->linesize[0] + x,
+            mosaic->data[1] + y / 2 * mosaic->linesize[1] + x / 2,
+            mosaic->data[2] + y / 2 * mosaic->linesize[2] + x / 2,
+            nullptr
+    };
+    sws_scale(contexts[index], (const uint8_t *const *) frame->data, frame->linesize, 0, frame->height,
+              tile, mosaic->linesize);
+}
+
+bool Compositor::tileSize(int count, int width, int height, int *tileWidth, int *tileHeight) {
+    auto columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    auto rows = (count + columns - 1) / columns;
+    // Tile widths are a multiple of 32, so every tile starts 16 byte aligned in the chroma planes
+    // too and sws_scale() keeps its SIMD path; heights are even for the 4:2:0 chroma rows.
+    // Tiles narrower than 32 pixels fall back to even widths and lose the alignment.
+    *tileWidth = width / columns & ~31;
+    if (*tileWidth == 0)
+        *tileWidth = width / columns & ~1;
+    *tileHeight = height / rows & ~1;
+    return *tileWidth > 0 && *tileHeight > 0;
+}
+
+void Compositor::compose(const std::vector<const AVFrame *> &frames, AVFrame *mosaic) {
+    if (frames.empty())
+        return;
+    auto start = av_gettime_relative();
+    auto count = static_cast<int>(frames.size());
+    auto columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    int tileWidth, tileHeight;
+    if (!tileSize(count, mosaic->width, mosaic->height, &tileWidth, &tileHeight))
+        return;
+    if (contexts.size() < frames.size())
+        contexts.resize(frames.size(), nullptr);
+    auto tiles = 0;
+    for (int i = 0; i < count; i++) {
+        if (frames[i] == nullptr)
+            continue;
+        auto x = i % columns * tileWidth;
+        auto y = i / columns * tileHeight;
+        tiles++;
+        if (!pool) {
+            scale(i, frames[i], mosaic, x, y, tileWidth, tileHeight);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining++;
+        }
+        auto frame = frames[i];
+        pool->submit([this, i, frame, mosaic, x, y, tileWidth, tileHeight] {
+            scale(i, frame, mosaic, x, y, tileWidth, tileHeight);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0)
+                done.notify_one();
+        });
+    }
+    if (pool) {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return remaining == 0; });
+    }
+    composeCalls++;
+    scaledTiles += tiles;
+    composeTime += av_gettime_relative() - start;
+}
+
+Engine::Engine(int ioThreads, int decodeThreads, int composeThreads)
+        : timerThread([this] { timers.run(); }),
+          io(new media::ThreadPool(ioThreads)),
+          decoders(new media::ThreadPool(decodeThreads > 0 ? decodeThreads
+                                                           : static_cast<int>(std::thread::hardware_concurrency()))),
+          tileCompositor(new Compositor(composeThreads)) {}
+
+Engine::~Engine() {
+    for (auto &session : sessions)
+        session->stop();
+    // no retry timer kicks a session after this
+    timers.stop();
+    timerThread.join();
+    io.reset();
+    decoders.reset();
+}
+
+int Engine::addSession(const std::string &url, bool loop) {
+    std::unique_ptr<Session> session(new Session(*this));
+    auto ret = session->open(url, loop);
+    if (ret < 0)
+        return ret;
+    sessions.push_back(std::move(session));
+    return static_cast<int>(sessions.size()) - 1;
+}
+
+void Engine::start() {
+    for (auto &session : sessions)
+        session->start();
+}
+
+void Engine::notifyReady() {
+    std::lock_guard<std::mutex> lock(readyMutex);
+    readyCond.notify_all();
+}
+
+bool Engine::waitReady(int64_t timeout) {
+    std::unique_lock<std::mutex> lock(readyMutex);
+    return readyCond.wait_for(lock, std::chrono::microseconds(timeout), [this] {
+        for (auto &session : sessions) {
+            if (!session->ready())
+                return false;
+        }
+        return true;
+    });
+}
+
+void Engine::compose(double time, AVFrame *mosaic) {
+    frames.resize(sessions.size());
+    // a session without a new frame gives nullptr and its tile keeps the previous one
+    for (size_t i = 0; i < sessions.size(); i++)
+        frames[i] = sessions[i]->take(time);
+    tileCompositor->compose(frames, mosaic);
+}
+
+}
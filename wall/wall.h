@@ -0,0 +1,227 @@
+//
+// play_wall 的多路播放引擎:一个进程中的 N 个 session 共用一个 demux(I/O)线程池、一个解码线程池,
+// 由 Compositor 把每个 session 当前的帧按宫格并行缩放到同一张 YUV420P 大图中,线程数不随 session 数增长.
+//
+
+#ifndef LEARNFFMPEG_WALL_H
+#define LEARNFFMPEG_WALL_H
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include "media/event_loop.h"
+#include "media/media.h"
+#include "media/thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// demuxed packets per session, demux stops reading beyond this and starts again below half of it
+#define WALL_PACKET_QUEUE_SIZE 16
+// decoded frames per session waiting for the compositor, decoding pauses beyond this
+#define WALL_FRAME_QUEUE_SIZE 3
+// microseconds before a session reads again after its input returned AVERROR(EAGAIN)
+#define WALL_DEMUX_RETRY_DELAY 10000
+
+namespace wall {
+
+class Engine;
+
+struct SessionStats {
+    // frames that came out of the decoder
+    int64_t decoded;
+    // frames the compositor put into the mosaic
+    int64_t shown;
+    // frames the compositor skipped because a later one was already due, i.e. decoding is behind
+    int64_t dropped;
+    // compose() calls that found no frame decoded ahead while the stream was not over
+    int64_t underruns;
+};
+
+/**
+ * One input played on the wall. It never blocks a pool thread: demux() and decode() run
+ * one bounded step on the I/O and the decode pool and hand the session back to the pool
+ * through kick(). Only one step of each kind is queued at a time, so a session waits in
+ * line behind all the others before it decodes its next packet. An input that has no data
+ * yet (AVERROR(EAGAIN)) gives its I/O thread back and is kicked again by a timer.
+ */
+class Session {
+public:
+    explicit Session(Engine &engine);
+
+    Session(const Session &) = delete;
+
+    Session &operator=(const Session &) = delete;
+
+    // the best video stream of url; loop seeks back to the start at the end of the file
+    int open(const std::string &url, bool loop);
+
+    void start();
+
+    void stop();
+
+    /**
+     * Take the newest frame due at time seconds after the start, older ones are dropped.
+     * Called from the compositor only.
+     * @return the new frame to show, valid until the next call, or nullptr when the tile keeps its frame
+     */
+    const AVFrame *take(double time);
+
+    // whether the decoder was drained and every frame was taken
+    bool finished();
+
+    // at least WALL_FRAME_QUEUE_SIZE frames decoded or the end reached
+    bool ready();
+
+    SessionStats stats();
+
+    void resetStats();
+
+private:
+    void demux();
+
+    void decode();
+
+    // queue the next demux() and decode() step when there is room for them, call with mutex held
+    void kick();
+
+    Engine &engine;
+    media::InputFormat input;
+    int videoIndex;
+    AVRational timeBase;
+    media::StreamDecoder decoder;
+    bool loop;
+    // added to the timestamps of every packet after the file looped
+    int64_t loopOffset;
+    int64_t startPts;
+    int64_t endPts;
+    // the frame the compositor shows
+    media::Frame current;
+
+    std::mutex mutex;
+    std::deque<media::Packet> packets;
+    std::deque<media::Frame> frames;
+    bool demuxScheduled;
+    // waiting for the WALL_DEMUX_RETRY_DELAY timer after AVERROR(EAGAIN), kick() leaves demux alone
+    bool demuxDelayed;
+    bool decodeScheduled;
+    bool demuxEnded;
+    bool decodeEnded;
+    bool stopped;
+    SessionStats counters;
+};
+
+/**
+ * Scales frames straight into the tiles of one YUV420P mosaic: the destination of each
+ * sws_scale() is the tile's offset inside the mosaic planes, so there is no intermediate
+ * frame, and the tiles are scaled in parallel, one task per tile.
+ */
+class Compositor {
+public:
+    // threads <= 0 uses one thread per core, 1 scales on the calling thread
+    explicit Compositor(int threads);
+
+    ~Compositor();
+
+    Compositor(const Compositor &) = delete;
+
+    Compositor &operator=(const Compositor &) = delete;
+
+    /**
+     * Scale frames[i] into tile i of a grid as square as possible over mosaic, an allocated
+     * YUV420P frame. A nullptr leaves its tile as it is. Returns once every tile is written.
+     */
+    void compose(const std::vector<const AVFrame *> &frames, AVFrame *mosaic);
+
+    // the tile size of count tiles on a width x height mosaic, false when a tile would be under 2x2 pixels
+    static bool tileSize(int count, int width, int height, int *tileWidth, int *tileHeight);
+
+    int threads() const { return pool ? pool->size() : 1; }
+
+    // compose() calls, tiles scaled and microseconds spent in compose() since resetStats()
+    int64_t calls() const { return composeCalls; }
+
+    int64_t tiles() const { return scaledTiles; }
+
+    int64_t time() const { return composeTime; }
+
+    void resetStats();
+
+private:
+    void scale(size_t index, const AVFrame *frame, AVFrame *mosaic, int x, int y, int width, int height);
+
+    std::unique_ptr<media::ThreadPool> pool;
+    // one per tile, each tile is only ever scaled by one task at a time
+    std::vector<SwsContext *> contexts;
+    std::mutex mutex;
+    std::condition_variable done;
+    int remaining;
+    int64_t composeCalls;
+    int64_t scaledTiles;
+    int64_t composeTime;
+};
+
+class Engine {
+public:
+    // threads <= 0 uses one thread per core for decoding and compositing
+    Engine(int ioThreads, int decodeThreads, int composeThreads = 0);
+
+    ~Engine();
+
+    Engine(const Engine &) = delete;
+
+    Engine &operator=(const Engine &) = delete;
+
+    // open url as the next session, a negative error code when it has no playable video
+    int addSession(const std::string &url, bool loop);
+
+    // start demuxing and decoding every session
+    void start();
+
+    // wait at most timeout microseconds until every session is ready(), false on timeout
+    bool waitReady(int64_t timeout);
+
+    // Put the frame every session has due at time seconds into its tile of mosaic, see Compositor.
+    void compose(double time, AVFrame *mosaic);
+
+    size_t size() const { return sessions.size(); }
+
+    Session &session(size_t index) { return *sessions[index]; }
+
+    media::ThreadPool &ioPool() { return *io; }
+
+    media::ThreadPool &decodePool() { return *decoders; }
+
+    Compositor &compositor() { return *tileCompositor; }
+
+    // runs the retry timers of the sessions on its own thread
+    media::EventLoop &eventLoop() { return timers; }
+
+    // called by a session that has decoded frames
+    void notifyReady();
+
+private:
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::mutex readyMutex;
+    std::condition_variable readyCond;
+    std::vector<const AVFrame *> frames;
+    media::EventLoop timers;
+    std::thread timerThread;
+    // destroyed before the sessions, so no task runs while a session goes away
+    std::unique_ptr<media::ThreadPool> io;
+    std::unique_ptr<media::ThreadPool> decoders;
+    std::unique_ptr<Compositor> tileCompositor;
+};
+
+}
+
+#endif //LEARNFFMPEG_WALL_H